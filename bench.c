@@ -0,0 +1,269 @@
+/*
+    gstplay -- Simple gstreamer-based media player
+
+    Copyright 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+    gstplay is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    gstplay is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with gstplay.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Benchmark timing and reporting. Phases are timed with the monotonic clock;
+ * every repetition adds one sample per phase, and the report prints
+ * min/median/p95/max per phase as JSON on stdout.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "gstplay.h"
+
+static const char *bench_phase_name[BENCH_NU_PHASES] = {
+	"gst_init", "gui_init", "probe", "create_pipeline", "parse_launch", "ready",
+	"preroll", "first_buffer"
+};
+
+static gboolean enabled = FALSE;
+static int nu_repetitions;
+static gint64 repetition_start_time;
+static gint64 phase_begin_time[BENCH_NU_PHASES];
+static gint64 phase_duration[BENCH_NU_PHASES];
+static volatile gboolean phase_ended[BENCH_NU_PHASES];
+static int nu_samples[BENCH_NU_PHASES];
+static gint64 *samples[BENCH_NU_PHASES];
+
+void bench_init(int repetitions) {
+	enabled = TRUE;
+	nu_repetitions = repetitions;
+	for (int i = 0; i < BENCH_NU_PHASES; i++) {
+		/* One extra slot for phases that are only measured once. */
+		samples[i] = malloc(sizeof(gint64) * (repetitions + 1));
+		nu_samples[i] = 0;
+	}
+	stats_begin_process_usage();
+}
+
+gboolean bench_enabled() {
+	return enabled;
+}
+
+int bench_get_repetitions() {
+	return nu_repetitions;
+}
+
+void bench_add_sample(BenchPhase phase, gint64 duration_us) {
+	if (!enabled || nu_samples[phase] > nu_repetitions)
+		return;
+	samples[phase][nu_samples[phase]] = duration_us;
+	nu_samples[phase]++;
+}
+
+void bench_start_repetition() {
+	if (!enabled)
+		return;
+	repetition_start_time = g_get_monotonic_time();
+	for (int i = 0; i < BENCH_NU_PHASES; i++) {
+		phase_begin_time[i] = repetition_start_time;
+		phase_ended[i] = FALSE;
+	}
+}
+
+void bench_phase_begin(BenchPhase phase) {
+	if (!enabled)
+		return;
+	phase_begin_time[phase] = g_get_monotonic_time();
+}
+
+/* May be called from a streaming thread. */
+
+void bench_phase_end(BenchPhase phase) {
+	if (!enabled || phase_ended[phase])
+		return;
+	phase_duration[phase] = g_get_monotonic_time() - phase_begin_time[phase];
+	bench_add_sample(phase, phase_duration[phase]);
+	phase_ended[phase] = TRUE;
+}
+
+gboolean bench_phase_ended(BenchPhase phase) {
+	return phase_ended[phase];
+}
+
+/* Duration of a phase that has ended in the current repetition, in microseconds. */
+
+gint64 bench_get_phase_duration(BenchPhase phase) {
+	return phase_duration[phase];
+}
+
+static int compare_samples(const void *a, const void *b) {
+	gint64 x = *(const gint64 *)a;
+	gint64 y = *(const gint64 *)b;
+	return x < y ? - 1 : (x > y ? 1 : 0);
+}
+
+/* Calculate min/median/p95/max in milliseconds; the samples are sorted in place. */
+
+void bench_calculate_statistics(gint64 *values, int n, double *min, double *median,
+double *p95, double *max) {
+	*min = *median = *p95 = *max = 0;
+	if (n == 0)
+		return;
+	qsort(values, n, sizeof(gint64), compare_samples);
+	*min = values[0] * 0.001;
+	*max = values[n - 1] * 0.001;
+	if (n & 1)
+		*median = values[n / 2] * 0.001;
+	else
+		*median = (values[n / 2 - 1] + values[n / 2]) * 0.0005;
+	/* Nearest-rank percentile. */
+	int i = (95 * n + 99) / 100 - 1;
+	*p95 = values[i] * 0.001;
+}
+
+void bench_print_json_string(const char *s) {
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", (unsigned char)*s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+void bench_print_json_statistics(const char *name, gint64 *values, int n, gboolean last) {
+	double min, median, p95, max;
+	bench_calculate_statistics(values, n, &min, &median, &p95, &max);
+	printf("    \"%s\": { \"samples\": %d, \"min_ms\": %.3lf, \"median_ms\": %.3lf, "
+		"\"p95_ms\": %.3lf, \"max_ms\": %.3lf }%s\n", name, n, min, median, p95, max,
+		last ? "" : ",");
+}
+
+/*
+ * Print the CPU and memory use of gstplay and the monitored helper processes
+ * since bench_init(), as the last member of a report.
+ */
+
+static void print_process_usage() {
+	StatsProcessUsage usage[STATS_MAX_MONITORED_PROCESSES + 1];
+	int n = stats_get_process_usage(usage, STATS_MAX_MONITORED_PROCESSES + 1);
+	printf(",\n  \"processes\": [\n");
+	for (int i = 0; i < n; i++) {
+		printf("    { \"name\": ");
+		bench_print_json_string(usage[i].name);
+		printf(", \"pid\": %d, \"cpu_percent\": %.2lf, \"cpu_s\": %.3lf, "
+			"\"rss_mib\": %.1lf }%s\n", usage[i].pid, usage[i].cpu_percent,
+			usage[i].cpu_seconds, usage[i].rss / (1024.0 * 1024.0), i == n - 1 ? "" : ",");
+	}
+	printf("  ]");
+}
+
+void bench_print_startup_report(const char *uri, const char *decode_path,
+const char *video_sink) {
+	printf("{\n  \"benchmark\": \"startup\",\n  \"uri\": ");
+	bench_print_json_string(uri);
+	printf(",\n  \"decode_path\": ");
+	bench_print_json_string(decode_path);
+	printf(",\n  \"video_sink\": ");
+	bench_print_json_string(video_sink);
+	printf(",\n  \"repetitions\": %d,\n  \"phases\": {\n", nu_repetitions);
+	for (int i = 0; i < BENCH_NU_PHASES; i++)
+		bench_print_json_statistics(bench_phase_name[i], samples[i], nu_samples[i],
+			i == BENCH_NU_PHASES - 1);
+	printf("  }");
+	print_process_usage();
+	printf("\n}\n");
+	fflush(stdout);
+}
+
+/*
+ * Print the source benchmark report. The throughput is based on the median
+ * wall-clock time.
+ */
+
+void bench_print_source_report(const char *filename, int nu_sources, const char **sources,
+gint64 **wall_us, gint64 **cpu_us, guint64 size) {
+	printf("{\n  \"benchmark\": \"source\",\n  \"file\": ");
+	bench_print_json_string(filename);
+	printf(",\n  \"size_bytes\": %" G_GUINT64_FORMAT ",\n  \"repetitions\": %d,\n"
+		"  \"sources\": [\n", size, nu_repetitions);
+	for (int i = 0; i < nu_sources; i++) {
+		double min, median, p95, max;
+		bench_calculate_statistics(wall_us[i], nu_repetitions, &min, &median, &p95, &max);
+		printf("   {\n    \"source\": ");
+		bench_print_json_string(sources[i]);
+		printf(",\n    \"throughput_mib_s\": %.1lf,\n",
+			median > 0 ? size / (1024.0 * 1024.0) / (median * 0.001) : 0);
+		bench_print_json_statistics("wall", wall_us[i], nu_repetitions, FALSE);
+		bench_print_json_statistics("cpu", cpu_us[i], nu_repetitions, TRUE);
+		printf("   }%s\n", i == nu_sources - 1 ? "" : ",");
+	}
+	printf("  ]");
+	print_process_usage();
+	printf("\n}\n");
+	fflush(stdout);
+}
+
+/*
+ * Print the file switch benchmark report: the time from the request to the
+ * first buffer at the video sink, when the playbin is switched to the next
+ * file and when the pipeline is destroyed and created again.
+ */
+
+void bench_print_switch_report(int nu_files, char **files, const char *video_sink,
+gint64 *switch_us, gint64 *recreate_us, int n) {
+	printf("{\n  \"benchmark\": \"switch\",\n  \"files\": [ ");
+	for (int i = 0; i < nu_files; i++) {
+		bench_print_json_string(files[i]);
+		printf("%s", i == nu_files - 1 ? " ],\n" : ", ");
+	}
+	printf("  \"video_sink\": ");
+	bench_print_json_string(video_sink);
+	printf(",\n  \"repetitions\": %d,\n  \"first_buffer\": {\n", nu_repetitions);
+	bench_print_json_statistics("switch_uri", switch_us, n, FALSE);
+	bench_print_json_statistics("recreate_pipeline", recreate_us, n, TRUE);
+	printf("  }");
+	print_process_usage();
+	printf("\n}\n");
+	fflush(stdout);
+}
+
+/*
+ * Print the seek benchmark report: the time from the seek request to the
+ * first buffer at the video sink, per series.
+ */
+
+void bench_print_seek_report(const char *uri, const char *decode_path,
+const char *video_sink, gint64 duration, int nu_seeks, gint64 **seek_us, int *n) {
+	static const char *series_name[BENCH_NU_SEEK_SERIES] = {
+		"random_key_unit", "random_accurate", "sequential_key_unit", "sequential_accurate"
+	};
+	printf("{\n  \"benchmark\": \"seek\",\n  \"uri\": ");
+	bench_print_json_string(uri);
+	printf(",\n  \"decode_path\": ");
+	bench_print_json_string(decode_path);
+	printf(",\n  \"video_sink\": ");
+	bench_print_json_string(video_sink);
+	printf(",\n  \"duration_s\": %.3lf,\n  \"seeks\": %d,\n  \"first_buffer\": {\n",
+		duration * 0.000000001, nu_seeks);
+	for (int i = 0; i < BENCH_NU_SEEK_SERIES; i++)
+		bench_print_json_statistics(series_name[i], seek_us[i], n[i],
+			i == BENCH_NU_SEEK_SERIES - 1);
+	printf("  }");
+	print_process_usage();
+	printf("\n}\n");
+	fflush(stdout);
+}
@@ -0,0 +1,297 @@
+/*
+    gstplay -- Simple gstreamer-based media player
+
+    Copyright 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+    gstplay is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    gstplay is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with gstplay.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Decoder calibration (--calibrate). For each codec, every installed video
+ * decoder (and, for decoders with a max-threads property, a few thread
+ * settings) decodes a clip into fakesink with sync=false, and the frame rate
+ * and CPU time per frame are measured. The clips are either given on the
+ * command line or encoded from videotestsrc for the codecs for which an
+ * encoder is installed.
+ *
+ * The ranking is stored in $XDG_CACHE_HOME/gstplay/decoder-ranking, with one
+ * group per codec listing the decoders fastest first. At startup the winners
+ * get their rank raised so that playbin prefers them, and the direct decode
+ * paths substitute the winner (including its thread setting) for {decoder}.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include "gstplay.h"
+
+#define CLIP_FRAMES 300
+
+typedef struct {
+	const char *caps;
+	const char *encoder;		/* Element that must be installed. */
+	const char *encode_description;
+} SyntheticClip;
+
+/* Alternatives for the same codec are tried in order. */
+static const SyntheticClip synthetic_clip[] = {
+	{ "video/x-h264", "x264enc", "x264enc speed-preset=ultrafast ! h264parse" },
+	{ "video/x-h264", "openh264enc", "openh264enc ! h264parse" },
+	{ "video/mpeg, mpegversion=(int)4", "avenc_mpeg4", "avenc_mpeg4 ! mpeg4videoparse" },
+	{ "video/x-vp8", "vp8enc", "vp8enc deadline=1" },
+};
+
+#define NU_SYNTHETIC_CLIPS ((int)(sizeof(synthetic_clip) / sizeof(synthetic_clip[0])))
+
+typedef struct {
+	char *decoder;		/* Element name with properties. */
+	double fps;
+	double cpu_ms_per_frame;
+} DecoderResult;
+
+static GKeyFile *ranking = NULL;
+static gboolean preferred_decoders_applied = FALSE;
+/* Lookup results by caps, NULL when there is no winner; entries are never replaced. */
+static GHashTable *best_decoder = NULL;
+
+static char *get_ranking_filename() {
+	return g_build_filename(g_get_user_cache_dir(), "gstplay", "decoder-ranking", NULL);
+}
+
+/* The element name is the first word of a decoder description. */
+
+static char *get_element_name(const char *decoder) {
+	const char *end = strchr(decoder, ' ');
+	return end == NULL ? g_strdup(decoder) : g_strndup(decoder, end - decoder);
+}
+
+/* Load the ranking. Call after gstreamer_init. */
+
+void calibrate_init() {
+	ranking = g_key_file_new();
+	char *filename = get_ranking_filename();
+	g_key_file_load_from_file(ranking, filename, G_KEY_FILE_NONE, NULL);
+	g_free(filename);
+}
+
+/*
+ * Make the calibration winners the preferred decoders. Raising a rank takes a
+ * registry scan per codec, so this is done once, just before the first
+ * pipeline that may autoplug a decoder is created, rather than at startup.
+ */
+
+void calibrate_apply_preferred_decoders() {
+	if (preferred_decoders_applied || ranking == NULL)
+		return;
+	preferred_decoders_applied = TRUE;
+	gchar **codecs = g_key_file_get_groups(ranking, NULL);
+	for (int i = 0; codecs[i] != NULL; i++) {
+		const char *best = calibrate_get_best_decoder(codecs[i]);
+		if (best == NULL)
+			continue;
+		char *name = get_element_name(best);
+		gstreamer_set_preferred_decoder(name, codecs[i]);
+		g_free(name);
+	}
+	g_strfreev(codecs);
+}
+
+/*
+ * Return the fastest installed decoder (with properties) for the codec, or
+ * NULL when the codec has not been calibrated. The result of a lookup is
+ * remembered, so the string stays valid until the program exits.
+ */
+
+const char *calibrate_get_best_decoder(const char *caps) {
+	if (ranking == NULL)
+		return NULL;
+	if (best_decoder == NULL)
+		best_decoder = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	gpointer value;
+	if (g_hash_table_lookup_extended(best_decoder, caps, NULL, &value))
+		return value;
+	gchar **codecs = g_key_file_get_groups(ranking, NULL);
+	char *result = NULL;
+	for (int i = 0; codecs[i] != NULL && result == NULL; i++) {
+		if (!gstreamer_caps_string_match(codecs[i], caps))
+			continue;
+		gchar **decoders = g_key_file_get_string_list(ranking, codecs[i], "decoders", NULL,
+			NULL);
+		for (int j = 0; decoders != NULL && decoders[j] != NULL; j++) {
+			char *name = get_element_name(decoders[j]);
+			gboolean available = gstreamer_element_available(name);
+			g_free(name);
+			if (available) {
+				result = g_strdup(decoders[j]);
+				break;
+			}
+		}
+		g_strfreev(decoders);
+	}
+	g_strfreev(codecs);
+	g_hash_table_insert(best_decoder, g_strdup(caps), result);
+	return result;
+}
+
+static int compare_results(const void *a, const void *b) {
+	const DecoderResult *r1 = a;
+	const DecoderResult *r2 = b;
+	return r1->fps < r2->fps ? 1 : (r1->fps > r2->fps ? - 1 : 0);
+}
+
+/* Add the decoder plus its thread setting variants to the list of candidates. */
+
+static void add_decoder_variants(GPtrArray *candidates, const char *decoder) {
+	g_ptr_array_add(candidates, g_strdup(decoder));
+	if (!gstreamer_element_has_property(decoder, "max-threads"))
+		return;
+	g_ptr_array_add(candidates, g_strdup_printf("%s max-threads=1", decoder));
+	long nu_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nu_cpus > 2)
+		g_ptr_array_add(candidates, g_strdup_printf("%s max-threads=%ld", decoder,
+			nu_cpus / 2));
+}
+
+/* Benchmark all decoders of a codec on a clip and store the ranking. */
+
+static void calibrate_codec(const char *caps, const char *clip) {
+	gchar **decoders = gstreamer_get_video_decoders(caps);
+	GPtrArray *candidates = g_ptr_array_new_with_free_func(g_free);
+	for (int i = 0; decoders[i] != NULL; i++)
+		add_decoder_variants(candidates, decoders[i]);
+	g_strfreev(decoders);
+	if (candidates->len == 0) {
+		printf("gstplay: No decoders installed for %s.\n", caps);
+		g_ptr_array_free(candidates, TRUE);
+		return;
+	}
+	printf("gstplay: Calibrating %s with %s\n", caps, clip);
+	DecoderResult *results = g_new(DecoderResult, candidates->len);
+	int nu_results = 0;
+	for (int i = 0; i < candidates->len; i++) {
+		const char *decoder = g_ptr_array_index(candidates, i);
+		char *s = g_strdup_printf("filesrc location=\"%s\" ! parsebin ! %s ! "
+			"fakesink name=sink sync=false", clip, decoder);
+		guint64 frames;
+		gint64 wall_us;
+		gdouble cpu_time = stats_get_process_cpu_time();
+		gboolean ok = gstreamer_run_to_eos(s, &frames, &wall_us);
+		cpu_time = stats_get_process_cpu_time() - cpu_time;
+		g_free(s);
+		if (!ok || frames == 0 || wall_us == 0) {
+			printf("    %-36s failed\n", decoder);
+			continue;
+		}
+		results[nu_results].decoder = (char *)decoder;
+		results[nu_results].fps = frames * 1000000.0 / wall_us;
+		results[nu_results].cpu_ms_per_frame = cpu_time * 1000.0 / frames;
+		printf("    %-36s %8.1lf fps, %6.2lf ms CPU per frame\n", decoder,
+			results[nu_results].fps, results[nu_results].cpu_ms_per_frame);
+		nu_results++;
+	}
+	if (nu_results > 0) {
+		qsort(results, nu_results, sizeof(DecoderResult), compare_results);
+		const gchar *names[nu_results];
+		gdouble fps[nu_results];
+		gdouble cpu[nu_results];
+		for (int i = 0; i < nu_results; i++) {
+			names[i] = results[i].decoder;
+			fps[i] = results[i].fps;
+			cpu[i] = results[i].cpu_ms_per_frame;
+		}
+		g_key_file_set_string_list(ranking, caps, "decoders", names, nu_results);
+		g_key_file_set_double_list(ranking, caps, "fps", fps, nu_results);
+		g_key_file_set_double_list(ranking, caps, "cpu_ms_per_frame", cpu, nu_results);
+		printf("gstplay: Preferred decoder for %s: %s\n", caps, results[0].decoder);
+	}
+	g_free(results);
+	g_ptr_array_free(candidates, TRUE);
+}
+
+/*
+ * Run the calibration on the given clips, or on synthetic clips when there are
+ * none, and save the ranking. Returns the exit status.
+ */
+
+int calibrate_run(int nu_clips, char **clips) {
+	if (!gstreamer_element_available("parsebin")) {
+		printf("gstplay: Calibration requires the parsebin element (gstreamer 1.10 or "
+			"later).\n");
+		return 1;
+	}
+	if (ranking == NULL)
+		ranking = g_key_file_new();
+	char *dir = g_build_filename(g_get_user_cache_dir(), "gstplay", NULL);
+	g_mkdir_with_parents(dir, 0755);
+	for (int i = 0; i < nu_clips; i++) {
+		char *path = realpath(clips[i], NULL);
+		if (path == NULL) {
+			printf("gstplay: Could not find %s.\n", clips[i]);
+			continue;
+		}
+		char *uri = g_filename_to_uri(path, NULL, NULL);
+		MediaInfo info;
+		if (uri != NULL && gstreamer_probe_media_sync(uri, &info) &&
+		info.video_codec[0] != '\0')
+			calibrate_codec(info.video_codec, path);
+		else
+			printf("gstplay: No video stream found in %s.\n", clips[i]);
+		g_free(uri);
+		free(path);
+	}
+	if (nu_clips == 0) {
+		GHashTable *calibrated = g_hash_table_new(g_str_hash, g_str_equal);
+		for (int i = 0; i < NU_SYNTHETIC_CLIPS; i++) {
+			const SyntheticClip *c = &synthetic_clip[i];
+			if (g_hash_table_contains(calibrated, c->caps) ||
+			!gstreamer_element_available(c->encoder))
+				continue;
+			char *clip = g_strdup_printf("%s/calibrate-%d.mkv", dir, i);
+			char *s = g_strdup_printf("videotestsrc num-buffers=%d horizontal-speed=4 ! "
+				"video/x-raw, width=1280, height=720, framerate=30/1 ! %s ! "
+				"matroskamux ! filesink location=\"%s\"", CLIP_FRAMES,
+				c->encode_description, clip);
+			printf("gstplay: Encoding a synthetic %s clip with %s.\n", c->caps,
+				c->encoder);
+			if (gstreamer_run_to_eos(s, NULL, NULL)) {
+				calibrate_codec(c->caps, clip);
+				g_hash_table_add(calibrated, (gpointer)c->caps);
+			}
+			unlink(clip);
+			g_free(clip);
+			g_free(s);
+		}
+		if (g_hash_table_size(calibrated) == 0)
+			printf("gstplay: No encoders available for synthetic clips; specify clips "
+				"to calibrate with.\n");
+		g_hash_table_destroy(calibrated);
+	}
+	g_free(dir);
+	char *filename = get_ranking_filename();
+	gsize length;
+	gchar *data = g_key_file_to_data(ranking, &length, NULL);
+	GError *error = NULL;
+	if (!g_file_set_contents(filename, data, length, &error)) {
+		printf("gstplay: Could not save the decoder ranking: %s\n", error->message);
+		g_error_free(error);
+	}
+	else
+		printf("gstplay: Decoder ranking saved to %s.\n", filename);
+	g_free(data);
+	g_free(filename);
+	return 0;
+}
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <glib.h>
 #include <glib-object.h>
 #include "gstplay.h"
@@ -41,6 +42,8 @@ static gboolean quit_on_stream_end;
 static gboolean software_volume;
 static gboolean software_color_balance;
 static gdouble global_color_balance_defaults[4];
+static int decoder_max_threads;
+static DecoderThreadType decoder_thread_type;
 
 void config_init() {
 	/* Initialize with defaults. */
@@ -66,6 +69,15 @@ void config_init() {
 	software_color_balance = TRUE;
 	for (int i = 0; i < 4; i++)
 		global_color_balance_defaults[i] = 50.0;
+	/*
+	 * Use all cores for decoding. On a single core, threading only adds
+	 * latency, so stick to one thread with slice threading.
+	 */
+	long nu_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nu_cpus < 1)
+		nu_cpus = 1;
+	decoder_max_threads = nu_cpus;
+	decoder_thread_type = nu_cpus == 1 ? DECODER_THREAD_TYPE_SLICE : DECODER_THREAD_TYPE_AUTO;
 }
 
 StartupState config_get_startup_preference() {
@@ -180,6 +192,24 @@ gboolean config_software_color_balance() {
 	return software_color_balance;
 }
 
+// Decoder threading; a maximum of 0 threads leaves the choice to the decoder.
+
+void config_set_decoder_max_threads(int n) {
+	decoder_max_threads = n;
+}
+
+int config_get_decoder_max_threads() {
+	return decoder_max_threads;
+}
+
+void config_set_decoder_thread_type(DecoderThreadType type) {
+	decoder_thread_type = type;
+}
+
+DecoderThreadType config_get_decoder_thread_type() {
+	return decoder_thread_type;
+}
+
 void config_set_global_color_balance_default(int channel, gdouble value) {
 	global_color_balance_defaults[channel] = value;
 }
@@ -0,0 +1,431 @@
+/*
+    gstplay -- Simple gstreamer-based media player
+
+    Copyright 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+    gstplay is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    gstplay is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with gstplay.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Registry of decode paths. Apart from the generic playbin and decodebin
+ * paths, each entry describes a direct pipeline for one container/video codec
+ * combination, which avoids the autoplugging and (with --videoonly) all audio
+ * processing. The built-in paths are constructed element by element by the
+ * pipeline builder in gstreamer.c. User paths are parsed from a template with
+ * the placeholders
+ *
+ *     {source}     The source element with its properties.
+ *     {demuxer}    The demuxer of the entry.
+ *     {parser}     The parser of the entry followed by " ! ", or nothing.
+ *     {decoder}    The video decoder of the entry.
+ *     {videosink}  The video sink.
+ *     {audiosink}  The audio sink (fakesink when audio is disabled).
+ *     {audio}      The audio branch, starting at the element named "demuxer",
+ *                  or nothing when audio is disabled.
+ *
+ * Entries are matched in order, so more specific or leaner paths go first.
+ *
+ * Users can add decode paths, or replace built-in ones, in
+ * $XDG_CONFIG_HOME/gstplay/decode-paths.conf. Each group of the key file
+ * defines the path with the group's name, for example
+ *
+ *     [h264qt-4threads]
+ *     template={source} ! qtdemux name=demuxer  demuxer. ! queue ! avdec_h264 max-threads=4 ! queue ! {videosink}  {audio}
+ *     container=video/quicktime
+ *     video=video/x-h264
+ *
+ * The container and video keys are optional; when present the path is
+ * considered by --auto-path before the built-in paths. User templates are
+ * validated once at startup and invalid ones are dropped.
+ *
+ * The optional max-threads and thread-type (auto, frame or slice) keys set the
+ * decoder threading of a path. A group with the name of an existing path and
+ * only these keys changes the threading of that path, for example
+ *
+ *     [h264mkv]
+ *     max-threads=2
+ *     thread-type=slice
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <gst/gst.h>
+#include <glib.h>
+#include "gstplay.h"
+
+#if GST_CHECK_VERSION(1, 0, 0)
+#define DECODEBIN_STR "decodebin"
+#else
+#define DECODEBIN_STR "decodebin2"
+#endif
+
+typedef struct {
+	const char *name;
+	PipelineType type;
+	const char *container_caps;	/* NULL for the generic paths. */
+	const char *video_caps;
+	const char *demuxer;
+	const char *parser;		/* May be NULL. */
+	const char *decoder;
+	gboolean queue_after_decoder;
+	const char *template;		/* NULL for playbin. */
+	/*
+	 * Decoder threading from the configuration file, replacing the global
+	 * setting; - 1 when not given.
+	 */
+	gboolean threading_override;
+	int max_threads;
+	int thread_type;
+} DecodePath;
+
+#define DEMUX_TEMPLATE "{source} ! {demuxer} name=demuxer  demuxer. ! queue ! {parser}{decoder} ! " \
+	"{videosink}  {audio}"
+
+/*
+ * The built-in paths are constructed element by element by the pipeline
+ * builder; the template only provides the textual form.
+ */
+static const DecodePath builtin_decode_path[] = {
+	{ "playbin", PIPELINE_PLAYBIN, NULL, NULL, NULL, NULL, NULL, FALSE, NULL },
+	{ "decodebin", PIPELINE_DECODEBIN, NULL, NULL, DECODEBIN_STR, NULL, NULL, FALSE,
+	  "{source} ! {demuxer} name=demuxer  demuxer. ! queue ! {videosink}  {audio}" },
+	{ "mp4avi", PIPELINE_DEMUX, "video/x-msvideo", "video/mpeg, mpegversion=(int)4",
+	  "avidemux", NULL, "avdec_mpeg4", FALSE, DEMUX_TEMPLATE },
+	{ "mp4qt", PIPELINE_DEMUX, "video/quicktime", "video/mpeg, mpegversion=(int)4",
+	  "qtdemux", NULL, "avdec_mpeg4", FALSE, DEMUX_TEMPLATE },
+	{ "h264qt", PIPELINE_DEMUX, "video/quicktime", "video/x-h264", "qtdemux", NULL,
+	  "avdec_h264", FALSE, DEMUX_TEMPLATE },
+	{ "msmp4avi", PIPELINE_DEMUX, "video/x-msvideo", "video/x-msmpeg, msmpegversion=(int)42",
+	  "avidemux", NULL, "avdec_msmpeg4v2", TRUE,
+	  "{source} ! {demuxer} name=demuxer  demuxer. ! queue ! {decoder} ! queue ! "
+	  "{videosink}  {audio}" },
+	{ "h264mkv", PIPELINE_DEMUX, "video/x-matroska", "video/x-h264", "matroskademux",
+	  "h264parse", "avdec_h264", FALSE, DEMUX_TEMPLATE },
+	{ "h264ts", PIPELINE_DEMUX, "video/mpegts", "video/x-h264", "tsdemux", "h264parse",
+	  "avdec_h264", FALSE, DEMUX_TEMPLATE },
+};
+
+#define NU_BUILTIN_DECODE_PATHS \
+	((int)(sizeof(builtin_decode_path) / sizeof(builtin_decode_path[0])))
+
+static DecodePath *decode_path = (DecodePath *)builtin_decode_path;
+static int nu_decode_paths = NU_BUILTIN_DECODE_PATHS;
+
+int decode_path_get_count() {
+	return nu_decode_paths;
+}
+
+const char *decode_path_get_name(int i) {
+	return decode_path[i].name;
+}
+
+/* Returns - 1 if there is no decode path with the given name. */
+
+int decode_path_lookup(const char *name) {
+	for (int i = 0; i < nu_decode_paths; i++)
+		if (strcasecmp(decode_path[i].name, name) == 0)
+			return i;
+	return - 1;
+}
+
+gboolean decode_path_is_generic(int i) {
+	return decode_path[i].container_caps == NULL;
+}
+
+/*
+ * Select the first direct decode path that matches the container and video
+ * codec of the media and for which the elements are installed. Returns - 1
+ * when there is no match.
+ */
+
+/* The decoder of a path, replaced by the calibrated winner for the codec if there is one. */
+
+static const char *get_decoder(const DecodePath *path) {
+	if (path->decoder == NULL)
+		return NULL;
+	const char *best = NULL;
+	if (path->video_caps != NULL)
+		best = calibrate_get_best_decoder(path->video_caps);
+	return best != NULL ? best : path->decoder;
+}
+
+static gboolean decode_path_matches(const DecodePath *path, const MediaInfo *info) {
+	if (path->container_caps == NULL || path->video_caps == NULL)
+		return FALSE;
+	if (!gstreamer_caps_string_match(path->container_caps, info->container) ||
+	!gstreamer_caps_string_match(path->video_caps, info->video_codec))
+		return FALSE;
+	/* The elements of user paths have been checked when they were validated. */
+	if (path->demuxer != NULL && !gstreamer_element_available(path->demuxer))
+		return FALSE;
+	/* A calibrated decoder has already been checked. */
+	if (path->decoder != NULL && get_decoder(path) == path->decoder &&
+	!gstreamer_element_available(path->decoder))
+		return FALSE;
+	if (path->parser != NULL && !gstreamer_element_available(path->parser))
+		return FALSE;
+	return TRUE;
+}
+
+int decode_path_select(const MediaInfo *info) {
+	if (info->container[0] == '\0' || info->video_codec[0] == '\0')
+		return - 1;
+	/* User paths (appended after the built-in ones) take precedence. */
+	for (int i = NU_BUILTIN_DECODE_PATHS; i < nu_decode_paths; i++)
+		if (decode_path_matches(&decode_path[i], info))
+			return i;
+	for (int i = 0; i < NU_BUILTIN_DECODE_PATHS; i++)
+		if (decode_path_matches(&decode_path[i], info))
+			return i;
+	return - 1;
+}
+
+/*
+ * Substitute the {name} placeholders in a pipeline template. The values are
+ * given as a NULL-terminated list of name/value pairs; unknown placeholders
+ * are left in place so that gst_parse_launch reports them.
+ */
+
+char *decode_path_expand_template(const char *template, ...) {
+	GString *s = g_string_new("");
+	const char *p = template;
+	while (*p != '\0') {
+		const char *end;
+		if (*p != '{' || (end = strchr(p, '}')) == NULL) {
+			g_string_append_c(s, *p);
+			p++;
+			continue;
+		}
+		const char *value = NULL;
+		va_list args;
+		va_start(args, template);
+		for (;;) {
+			const char *name = va_arg(args, const char *);
+			if (name == NULL)
+				break;
+			const char *v = va_arg(args, const char *);
+			if (strlen(name) == end - p - 1 && strncmp(name, p + 1, end - p - 1) == 0) {
+				value = v;
+				break;
+			}
+		}
+		va_end(args);
+		if (value != NULL) {
+			g_string_append(s, value);
+			p = end + 1;
+		}
+		else {
+			g_string_append_c(s, *p);
+			p++;
+		}
+	}
+	return g_string_free(s, FALSE);
+}
+
+/*
+ * Fill in the elements and the description of a non-playbin decode path. The
+ * uri, location and sinks of the spec must already be set; the audio sink is
+ * NULL when audio is disabled.
+ */
+
+void decode_path_create_pipeline(int i, PipelineSpec *spec, const char *source) {
+	const DecodePath *path = &decode_path[i];
+	const char *decoder = get_decoder(path);
+	spec->type = path->type;
+	spec->demuxer = g_strdup(path->demuxer);
+	spec->parser = g_strdup(path->parser);
+	spec->decoder = g_strdup(decoder);
+	spec->queue_after_decoder = path->queue_after_decoder;
+	char *audio = spec->audio_sink == NULL ? g_strdup("") :
+		g_strdup_printf("demuxer. ! queue ! audioconvert ! audioresample ! %s",
+		spec->audio_sink);
+	char *parser = path->parser == NULL ? g_strdup("") :
+		g_strdup_printf("%s ! ", path->parser);
+	spec->description = decode_path_expand_template(path->template,
+		"source", source,
+		"demuxer", path->demuxer != NULL ? path->demuxer : "",
+		"parser", parser,
+		"decoder", decoder != NULL ? decoder : "",
+		"videosink", spec->video_sink,
+		"audiosink", spec->audio_sink != NULL ? spec->audio_sink : "fakesink",
+		"audio", audio,
+		NULL);
+	g_free(parser);
+	g_free(audio);
+}
+
+/*
+ * Check a user template by expanding it with stand-in elements and parsing
+ * the result, which catches syntax errors, unknown placeholders and missing
+ * elements.
+ */
+
+static gboolean validate_user_template(const char *name, const char *template) {
+	char *s = decode_path_expand_template(template,
+		"source", "fakesrc",
+		"videosink", "fakesink",
+		"audiosink", "fakesink",
+		"audio", "demuxer. ! queue ! audioconvert ! audioresample ! fakesink",
+		NULL);
+	char *error_message = NULL;
+	gboolean ok;
+	if (strchr(s, '{') != NULL) {
+		error_message = g_strdup("unknown placeholder");
+		ok = FALSE;
+	}
+	else
+		ok = gstreamer_check_pipeline_description(s, &error_message);
+	if (!ok)
+		printf("gstplay: Ignoring decode path %s from the configuration file: %s\n",
+			name, error_message);
+	g_free(error_message);
+	g_free(s);
+	return ok;
+}
+
+static const char *thread_type_name[] = { "auto", "frame", "slice" };
+
+const char *decode_path_get_thread_type_name(DecoderThreadType type) {
+	return thread_type_name[type];
+}
+
+gboolean decode_path_parse_thread_type(const char *name, DecoderThreadType *type) {
+	for (int i = 0; i < 3; i++)
+		if (strcasecmp(name, thread_type_name[i]) == 0) {
+			*type = i;
+			return TRUE;
+		}
+	return FALSE;
+}
+
+void decode_path_get_decoder_threading(int i, int *max_threads,
+DecoderThreadType *thread_type) {
+	const DecodePath *path = &decode_path[i];
+	*max_threads = config_get_decoder_max_threads();
+	*thread_type = config_get_decoder_thread_type();
+	if (!path->threading_override)
+		return;
+	if (path->max_threads >= 0)
+		*max_threads = path->max_threads;
+	if (path->thread_type >= 0)
+		*thread_type = path->thread_type;
+}
+
+/* Read the decoder threading keys of a group. Returns FALSE if a key is invalid. */
+
+static gboolean get_threading_keys(GKeyFile *key_file, const char *group, DecodePath *path) {
+	path->max_threads = - 1;
+	path->thread_type = - 1;
+	if (g_key_file_has_key(key_file, group, "max-threads", NULL)) {
+		GError *error = NULL;
+		path->max_threads = g_key_file_get_integer(key_file, group, "max-threads", &error);
+		if (error != NULL || path->max_threads < 0) {
+			printf("gstplay: Invalid max-threads for decode path %s in the configuration "
+				"file.\n", group);
+			if (error != NULL)
+				g_error_free(error);
+			return FALSE;
+		}
+		path->threading_override = TRUE;
+	}
+	char *thread_type = g_key_file_get_string(key_file, group, "thread-type", NULL);
+	if (thread_type != NULL) {
+		DecoderThreadType type;
+		gboolean ok = decode_path_parse_thread_type(thread_type, &type);
+		g_free(thread_type);
+		path->thread_type = type;
+		if (!ok) {
+			printf("gstplay: Invalid thread-type for decode path %s in the configuration "
+				"file.\n", group);
+			return FALSE;
+		}
+		path->threading_override = TRUE;
+	}
+	return TRUE;
+}
+
+/* Load the user-defined decode paths. Must be called after gstreamer_init. */
+
+void decode_path_init() {
+	char *filename = g_build_filename(g_get_user_config_dir(), "gstplay",
+		"decode-paths.conf", NULL);
+	GKeyFile *key_file = g_key_file_new();
+	GError *error = NULL;
+	if (!g_key_file_load_from_file(key_file, filename, G_KEY_FILE_NONE, &error)) {
+		if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			printf("gstplay: Could not load %s: %s\n", filename, error->message);
+		g_error_free(error);
+		g_key_file_free(key_file);
+		g_free(filename);
+		return;
+	}
+	g_free(filename);
+	gsize nu_groups;
+	gchar **groups = g_key_file_get_groups(key_file, &nu_groups);
+	decode_path = g_new(DecodePath, NU_BUILTIN_DECODE_PATHS + nu_groups);
+	memcpy(decode_path, builtin_decode_path, sizeof(builtin_decode_path));
+	nu_decode_paths = NU_BUILTIN_DECODE_PATHS;
+	for (int i = 0; i < nu_groups; i++) {
+		DecodePath path;
+		memset(&path, 0, sizeof(path));
+		if (!get_threading_keys(key_file, groups[i], &path))
+			continue;
+		char *template = g_key_file_get_string(key_file, groups[i], "template", NULL);
+		int j = decode_path_lookup(groups[i]);
+		if (template == NULL && j >= 0 && path.threading_override) {
+			/* Only the threading of an existing path is changed. */
+			decode_path[j].threading_override = TRUE;
+			decode_path[j].max_threads = path.max_threads;
+			decode_path[j].thread_type = path.thread_type;
+			continue;
+		}
+		if (template == NULL) {
+			printf("gstplay: Decode path %s in the configuration file has no template.\n",
+				groups[i]);
+			continue;
+		}
+		if (j == DECODE_PATH_PLAYBIN) {
+			printf("gstplay: The playbin decode path can't be redefined.\n");
+			g_free(template);
+			continue;
+		}
+		if (!validate_user_template(groups[i], template)) {
+			g_free(template);
+			continue;
+		}
+		path.name = g_strdup(groups[i]);
+		path.type = PIPELINE_DESCRIPTION;
+		path.container_caps = g_key_file_get_string(key_file, groups[i], "container", NULL);
+		path.video_caps = g_key_file_get_string(key_file, groups[i], "video", NULL);
+		path.template = template;
+		if (j >= 0) {
+			/*
+			 * Replace the path with the same name; a built-in path keeps
+			 * its caps unless they are given.
+			 */
+			if (path.container_caps == NULL && path.video_caps == NULL) {
+				path.container_caps = decode_path[j].container_caps;
+				path.video_caps = decode_path[j].video_caps;
+			}
+			decode_path[j] = path;
+		}
+		else
+			decode_path[nu_decode_paths++] = path;
+	}
+	g_strfreev(groups);
+	g_key_file_free(key_file);
+}
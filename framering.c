@@ -0,0 +1,240 @@
+/*
+    gstplay -- Simple gstreamer-based media player
+
+    Copyright 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+    gstplay is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    gstplay is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with gstplay.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Ring of the most recently decoded video frames, for stepping backwards
+ * without decoding. A buffer probe on the sink pad of the video sink keeps a
+ * reference to every buffer that reaches it, up to a memory budget; buffers
+ * are never copied. Stepping back renders an older buffer directly on the
+ * sink while the pipeline is paused, and stepping forward again walks
+ * back through the ring until the live (prerolled) frame is reached.
+ *
+ * The ring is emptied on flushes, caps changes and timestamp discontinuities.
+ * Buffers from a buffer pool with a maximum size are not kept, since holding
+ * on to them could starve the decoder.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <glib.h>
+#include "gstplay.h"
+
+#define DEFAULT_BUDGET_MIB 64
+
+static int budget_mib = DEFAULT_BUDGET_MIB;
+
+#if GST_CHECK_VERSION(1, 0, 0)
+
+/* Protects the ring; the probe runs in the streaming thread. */
+static GMutex mutex;
+/* Oldest frame at the head, newest at the tail. */
+static GQueue ring = G_QUEUE_INIT;
+static gsize ring_bytes;
+/* Number of frames the displayed frame is behind the newest one. */
+static guint cursor;
+static gboolean bounded_pool;
+static GstBufferPool *last_pool;
+static GstElement *sink = NULL;
+static GstPad *sink_pad = NULL;
+static gulong probe_id;
+static int nu_steps_from_ring;
+
+static void clear_ring() {
+	GstBuffer *buffer;
+	while ((buffer = g_queue_pop_head(&ring)) != NULL)
+		gst_buffer_unref(buffer);
+	ring_bytes = 0;
+	cursor = 0;
+}
+
+static GstPadProbeReturn frame_ring_probe_cb(GstPad *pad, GstPadProbeInfo *info,
+gpointer data) {
+	g_mutex_lock(&mutex);
+	if (info->type & GST_PAD_PROBE_TYPE_EVENT_BOTH) {
+		GstEventType type = GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info));
+		if (type == GST_EVENT_FLUSH_STOP || type == GST_EVENT_CAPS)
+			clear_ring();
+		g_mutex_unlock(&mutex);
+		return GST_PAD_PROBE_OK;
+	}
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	if (buffer->pool != last_pool) {
+		last_pool = buffer->pool;
+		bounded_pool = last_pool != NULL && gstreamer_buffer_pool_is_bounded(last_pool);
+	}
+	GstBuffer *newest = g_queue_peek_tail(&ring);
+	if (!GST_BUFFER_PTS_IS_VALID(buffer) || bounded_pool || (newest != NULL &&
+	GST_BUFFER_PTS(buffer) <= GST_BUFFER_PTS(newest)))
+		clear_ring();
+	if (GST_BUFFER_PTS_IS_VALID(buffer) && !bounded_pool) {
+		g_queue_push_tail(&ring, gst_buffer_ref(buffer));
+		ring_bytes += gst_buffer_get_size(buffer);
+		/* A frame arriving from upstream is live again. */
+		cursor = 0;
+		while (ring_bytes > (gsize)budget_mib * 1024 * 1024 && ring.length > 1) {
+			GstBuffer *oldest = g_queue_pop_head(&ring);
+			ring_bytes -= gst_buffer_get_size(oldest);
+			gst_buffer_unref(oldest);
+		}
+	}
+	g_mutex_unlock(&mutex);
+	return GST_PAD_PROBE_OK;
+}
+
+void frame_ring_detach() {
+	if (sink != NULL) {
+		gst_pad_remove_probe(sink_pad, probe_id);
+		gst_object_unref(sink_pad);
+		gst_object_unref(sink);
+		sink = NULL;
+		sink_pad = NULL;
+	}
+	g_mutex_lock(&mutex);
+	clear_ring();
+	last_pool = NULL;
+	bounded_pool = FALSE;
+	g_mutex_unlock(&mutex);
+}
+
+/*
+ * Start recording the frames that reach the rendering video sink (see
+ * gstreamer_get_rendering_video_sink). Can be called again whenever the
+ * pipeline prerolls; nothing changes unless the sink did.
+ */
+
+void frame_ring_attach(gpointer rendering_sink) {
+	if (rendering_sink == sink || budget_mib <= 0)
+		return;
+	frame_ring_detach();
+	if (rendering_sink == NULL)
+		return;
+	sink_pad = gst_element_get_static_pad(rendering_sink, "sink");
+	if (sink_pad == NULL)
+		return;
+	sink = gst_object_ref(rendering_sink);
+	nu_steps_from_ring = 0;
+	probe_id = gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER |
+		GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+		frame_ring_probe_cb, NULL, NULL);
+}
+
+/* Render the frame at the cursor; called with the ring locked. */
+
+static void render_cursor_frame() {
+	GstBuffer *buffer = gst_buffer_ref(g_queue_peek_nth(&ring, ring.length - 1 - cursor));
+	g_mutex_unlock(&mutex);
+	gstreamer_render_video_frame(sink, buffer);
+	gst_buffer_unref(buffer);
+	g_mutex_lock(&mutex);
+	nu_steps_from_ring++;
+}
+
+/* Display the frame before the displayed one; FALSE when the ring is exhausted. */
+
+gboolean frame_ring_step_back() {
+	if (sink == NULL)
+		return FALSE;
+	g_mutex_lock(&mutex);
+	gboolean available = cursor + 1 < ring.length;
+	if (available) {
+		cursor++;
+		render_cursor_frame();
+	}
+	g_mutex_unlock(&mutex);
+	return available;
+}
+
+/* Display the frame after the displayed one; FALSE when the live frame is displayed. */
+
+gboolean frame_ring_step_forward() {
+	if (sink == NULL)
+		return FALSE;
+	g_mutex_lock(&mutex);
+	gboolean available = cursor > 0 && cursor < ring.length;
+	if (available) {
+		cursor--;
+		render_cursor_frame();
+	}
+	g_mutex_unlock(&mutex);
+	return available;
+}
+
+/* How far the displayed frame is behind the live frame in nanoseconds, 0 when live. */
+
+gint64 frame_ring_get_displayed_offset() {
+	gint64 offset = 0;
+	g_mutex_lock(&mutex);
+	if (cursor > 0 && cursor < ring.length)
+		offset = GST_BUFFER_PTS((GstBuffer *)g_queue_peek_tail(&ring)) -
+			GST_BUFFER_PTS((GstBuffer *)g_queue_peek_nth(&ring, ring.length - 1 - cursor));
+	g_mutex_unlock(&mutex);
+	return offset;
+}
+
+gchar *frame_ring_get_stats_str() {
+	if (sink == NULL)
+		return NULL;
+	g_mutex_lock(&mutex);
+	gchar *s;
+	if (bounded_pool)
+		s = g_strdup_printf(
+			"Frame ring:                     disabled (bounded buffer pool)");
+	else
+		s = g_strdup_printf(
+			"Frame ring:                     %u frames, %.1lf of %d MiB\n"
+			"Backward steps from the ring:   %d",
+			ring.length, ring_bytes / (1024.0 * 1024.0), budget_mib, nu_steps_from_ring);
+	g_mutex_unlock(&mutex);
+	return s;
+}
+
+#else
+
+void frame_ring_attach(gpointer rendering_sink) {
+}
+
+void frame_ring_detach() {
+}
+
+gboolean frame_ring_step_back() {
+	return FALSE;
+}
+
+gboolean frame_ring_step_forward() {
+	return FALSE;
+}
+
+gint64 frame_ring_get_displayed_offset() {
+	return 0;
+}
+
+gchar *frame_ring_get_stats_str() {
+	return NULL;
+}
+
+#endif
+
+/* Memory budget of the ring in MiB; 0 disables it. Takes effect on the next attach. */
+
+void frame_ring_set_budget(int mib) {
+	budget_mib = mib;
+}
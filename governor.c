@@ -0,0 +1,266 @@
+/*
+    gstplay -- Simple gstreamer-based media player
+
+    Copyright 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+    gstplay is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    gstplay is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with gstplay.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Decode quality governor. The QoS messages of the pipeline report how many
+ * frames were processed and dropped; when the drop rate over a sliding window
+ * gets too high, the governor steps down to cheaper decoding so that frames
+ * are no longer decoded only to be dropped at the sink:
+ *
+ *     level 1   The decoders skip non-reference frames (skip-frame).
+ *     level 2   The decoders also decode at half resolution (lowres).
+ *     level 3   Deinterlacing is disabled.
+ *     level 4   Only keyframes are decoded (key units trick mode).
+ *
+ * When no frames have been dropped for a while, it steps back up. Stepping
+ * down again soon after a step up doubles the time before the next step up,
+ * so that the governor settles instead of oscillating.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <glib.h>
+#include "gstplay.h"
+
+#define WINDOW_SECONDS 5
+/* Step down when more than this percentage of frames is dropped in the window. */
+#define STEP_DOWN_DROP_PERCENTAGE 5.0
+/* Minimum time at a level before stepping down further. */
+#define STEP_DOWN_HOLD_SECONDS 3
+/* Time without dropped frames before stepping up; doubled on oscillation. */
+#define STEP_UP_SECONDS 10
+#define MAX_STEP_UP_SECONDS 160
+
+#if GST_CHECK_VERSION(1, 6, 0)
+#define MAX_LEVEL 4
+#else
+/* The key units trick mode is not available. */
+#define MAX_LEVEL 3
+#endif
+
+static const char *level_name[] = {
+	"full quality",
+	"skip non-reference frames",
+	"skip non-reference frames, half resolution",
+	"skip non-reference frames, half resolution, no deinterlacing",
+	"keyframes only"
+};
+
+typedef struct {
+	guint64 processed;
+	guint64 dropped;
+} FrameCounts;
+
+static gboolean enabled = TRUE;
+static GstElement *pipeline = NULL;
+static guint timeout_id = 0;
+static int level;
+static int nu_transitions;
+/* Last cumulative counts reported by each element. */
+static GHashTable *last_counts = NULL;
+/* Frames processed and dropped during each second of the window. */
+static FrameCounts window[WINDOW_SECONDS];
+static int window_index;
+static FrameCounts current_second;
+static int seconds_at_level;
+static int seconds_without_drops;
+static int step_up_seconds;
+static gboolean stepped_up_last;
+
+void governor_set_enabled(gboolean status) {
+	enabled = status;
+}
+
+static void get_window_counts(FrameCounts *counts) {
+	counts->processed = 0;
+	counts->dropped = 0;
+	for (int i = 0; i < WINDOW_SECONDS; i++) {
+		counts->processed += window[i].processed;
+		counts->dropped += window[i].dropped;
+	}
+}
+
+static double get_drop_percentage(const FrameCounts *counts) {
+	if (counts->processed + counts->dropped == 0)
+		return 0;
+	return counts->dropped * 100.0 / (counts->processed + counts->dropped);
+}
+
+static void reset_window() {
+	memset(window, 0, sizeof(window));
+	memset(&current_second, 0, sizeof(current_second));
+	window_index = 0;
+	seconds_at_level = 0;
+	seconds_without_drops = 0;
+}
+
+static void set_int_property(GObject *object, const char *name, int value) {
+	if (g_object_class_find_property(G_OBJECT_GET_CLASS(object), name) != NULL)
+		g_object_set(object, name, value, NULL);
+}
+
+static void apply_level_to_element(GstElement *element) {
+#if GST_CHECK_VERSION(1, 0, 0)
+	const char *klass = gst_element_class_get_metadata(GST_ELEMENT_GET_CLASS(element),
+		GST_ELEMENT_METADATA_KLASS);
+#else
+	const char *klass = GST_ELEMENT_GET_CLASS(element)->details.klass;
+#endif
+	if (klass != NULL && strstr(klass, "Decoder/Video") != NULL) {
+		/* The libav decoders: skip-frame 1 skips B-frames, lowres 1 is half size. */
+		set_int_property(G_OBJECT(element), "skip-frame", level >= 1 ? 1 : 0);
+		set_int_property(G_OBJECT(element), "lowres", level >= 2 ? 1 : 0);
+		return;
+	}
+	GstElementFactory *factory = gst_element_get_factory(element);
+	if (factory != NULL && strcmp(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)),
+	"deinterlace") == 0)
+		/* Mode 0 is automatic, 2 is disabled. */
+		set_int_property(G_OBJECT(element), "mode", level >= 3 ? 2 : 0);
+}
+
+#if GST_CHECK_VERSION(1, 0, 0)
+static void for_each_element_apply_level(const GValue *value, gpointer data) {
+	apply_level_to_element(g_value_get_object(value));
+}
+#else
+static void for_each_element_apply_level(gpointer value_data, gpointer data) {
+	apply_level_to_element(value_data);
+	gst_object_unref(value_data);
+}
+#endif
+
+static void set_level(int new_level, double drop_percentage) {
+	printf("gstplay: Decode quality level %d (%s) -> %d (%s), %.1lf%% of frames dropped\n",
+		level, level_name[level], new_level, level_name[new_level], drop_percentage);
+	gboolean key_units_changed = (level >= 4) != (new_level >= 4);
+	level = new_level;
+	nu_transitions++;
+	GstIterator *iterator = gst_bin_iterate_recurse(GST_BIN(pipeline));
+	gst_iterator_foreach(iterator, for_each_element_apply_level, NULL);
+	gst_iterator_free(iterator);
+	if (key_units_changed)
+		gstreamer_set_key_units_only(level >= 4);
+	reset_window();
+}
+
+static gboolean governor_tick_cb(gpointer data) {
+	if (pipeline == NULL) {
+		timeout_id = 0;
+		return FALSE;
+	}
+	if (!gstreamer_state_is_playing())
+		return TRUE;
+	window[window_index] = current_second;
+	window_index = (window_index + 1) % WINDOW_SECONDS;
+	seconds_at_level++;
+	if (current_second.dropped == 0)
+		seconds_without_drops++;
+	else
+		seconds_without_drops = 0;
+	memset(&current_second, 0, sizeof(current_second));
+
+	FrameCounts counts;
+	get_window_counts(&counts);
+	double drop_percentage = get_drop_percentage(&counts);
+	if (drop_percentage > STEP_DOWN_DROP_PERCENTAGE && level < MAX_LEVEL &&
+	seconds_at_level >= STEP_DOWN_HOLD_SECONDS) {
+		/* Back off when the last step up turned out to be too much. */
+		if (stepped_up_last && step_up_seconds < MAX_STEP_UP_SECONDS)
+			step_up_seconds *= 2;
+		stepped_up_last = FALSE;
+		set_level(level + 1, drop_percentage);
+	}
+	else if (level > 0 && seconds_without_drops >= step_up_seconds) {
+		stepped_up_last = TRUE;
+		set_level(level - 1, drop_percentage);
+	}
+	return TRUE;
+}
+
+/* Start governing a new pipeline at full quality. */
+
+void governor_start(gpointer _pipeline) {
+	governor_stop();
+	if (!enabled)
+		return;
+	pipeline = _pipeline;
+	level = 0;
+	nu_transitions = 0;
+	step_up_seconds = STEP_UP_SECONDS;
+	stepped_up_last = FALSE;
+	if (last_counts == NULL)
+		last_counts = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	reset_window();
+	/* The elements of a reused pipeline may still be set to a lower level. */
+	GstIterator *iterator = gst_bin_iterate_recurse(GST_BIN(pipeline));
+	gst_iterator_foreach(iterator, for_each_element_apply_level, NULL);
+	gst_iterator_free(iterator);
+	timeout_id = g_timeout_add_seconds(1, governor_tick_cb, NULL);
+}
+
+void governor_stop() {
+	if (timeout_id != 0)
+		g_source_remove(timeout_id);
+	timeout_id = 0;
+	pipeline = NULL;
+	if (last_counts != NULL)
+		g_hash_table_remove_all(last_counts);
+}
+
+/*
+ * Account the cumulative QoS frame counts of an element. Only the sinks are
+ * counted, since a frame dropped upstream is not rendered either and would
+ * otherwise be counted twice.
+ */
+
+void governor_report_qos(gpointer element, guint64 processed, guint64 dropped) {
+	if (pipeline == NULL)
+		return;
+	if (!GST_OBJECT_FLAG_IS_SET(element, GST_ELEMENT_FLAG_SINK))
+		return;
+	FrameCounts *last = g_hash_table_lookup(last_counts, element);
+	if (last == NULL) {
+		last = g_new0(FrameCounts, 1);
+		g_hash_table_insert(last_counts, element, last);
+	}
+	/* The counts restart after a flushing seek. */
+	if (processed < last->processed || dropped < last->dropped)
+		memset(last, 0, sizeof(FrameCounts));
+	current_second.processed += processed - last->processed;
+	current_second.dropped += dropped - last->dropped;
+	last->processed = processed;
+	last->dropped = dropped;
+}
+
+gchar *governor_get_stats_str() {
+	if (pipeline == NULL)
+		return NULL;
+	FrameCounts counts;
+	get_window_counts(&counts);
+	return g_strdup_printf(
+		"Decode quality level:           %d (%s)\n"
+		"Frames dropped (last %d s):      %.1lf%%\n"
+		"Quality level changes:          %d",
+		level, level_name[level], WINDOW_SECONDS, get_drop_percentage(&counts),
+		nu_transitions);
+}
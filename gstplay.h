@@ -20,14 +20,93 @@
 
 typedef enum { STARTUP_PLAYING, STARTUP_PAUSED } StartupState;
 
+/* How gstreamer_seek_to_time seeks; automatic uses the keyframe index when ready. */
+typedef enum { SEEK_MODE_AUTO, SEEK_MODE_KEY_UNIT, SEEK_MODE_ACCURATE } SeekMode;
+
 #define CHANNEL_BRIGHTNESS 0
 #define CHANNEL_CONTRAST 1
 #define CHANNEL_HUE 2
 #define CHANNEL_SATURATION 3
 
+/* Stream information gathered by the media probe. Fields are zero when unknown. */
+typedef struct {
+	int width;
+	int height;
+	int par_num;
+	int par_denom;
+	int framerate_num;
+	int framerate_denom;
+	gint64 duration;
+	char container[32];
+	char video_codec[64];
+	char decode_path[32];
+	/* Only meaningful when the container and video codec are known. */
+	gboolean has_audio;
+} MediaInfo;
+
+typedef void (*MediaProbeCallback)(const MediaInfo *info, gpointer user_data);
+
+/* Threading of the video decoders (the thread-type property of the libav decoders). */
+typedef enum {
+	DECODER_THREAD_TYPE_AUTO,
+	DECODER_THREAD_TYPE_FRAME,
+	DECODER_THREAD_TYPE_SLICE
+} DecoderThreadType;
+
+/* How gstreamer_run_pipeline constructs the pipeline. */
+typedef enum {
+	PIPELINE_PLAYBIN,
+	/* Source, decodebin, and video and audio branches linked on demand. */
+	PIPELINE_DECODEBIN,
+	/* Source, demuxer, then queue, parser and decoder before the video sink. */
+	PIPELINE_DEMUX,
+	/* Parsed from the description (user-defined decode paths). */
+	PIPELINE_DESCRIPTION
+} PipelineType;
+
+/*
+ * Pipeline specification created by main_create_pipeline. Element strings are
+ * an element name optionally followed by property=value pairs; the sinks may
+ * also be a bin description such as "videoconvert ! ximagesink".
+ */
+typedef struct {
+	PipelineType type;
+	char *uri;
+	char *location;			/* File name of local media, NULL otherwise. */
+	char *demuxer;
+	char *parser;			/* May be NULL. */
+	char *decoder;			/* May be NULL. */
+	gboolean queue_after_decoder;
+	char *video_sink;
+	char *audio_sink;		/* NULL when audio is disabled (except for playbin). */
+	int playbin_flags;
+	/* Applied to video decoders that don't set them explicitly; 0 threads is the default. */
+	int decoder_max_threads;
+	DecoderThreadType decoder_thread_type;
+	/* Textual form, shown to the user and used to recognize a cached pipeline. */
+	char *description;
+} PipelineSpec;
+
+/* Startup phases timed by the benchmark mode. */
+typedef enum {
+	BENCH_PHASE_GST_INIT = 0,
+	BENCH_PHASE_GUI_INIT,
+	BENCH_PHASE_PROBE,
+	BENCH_PHASE_CREATE_PIPELINE,
+	BENCH_PHASE_PARSE_LAUNCH,
+	BENCH_PHASE_READY,
+	BENCH_PHASE_PREROLL,
+	/* Measured from the start of the repetition. */
+	BENCH_PHASE_FIRST_BUFFER,
+	BENCH_NU_PHASES
+} BenchPhase;
+
+/* Series of the seek benchmark: random and sequential targets, key unit and accurate seeks. */
+#define BENCH_NU_SEEK_SERIES 4
+
 /* main.c */
 
-extern const char *main_create_pipeline(const char *uri, const char *video_title_filename);
+extern const PipelineSpec *main_create_pipeline(const char *uri, const char *video_title_filename);
 extern void main_create_uri(const char *filespec, char **uri, char **video_title_filename);
 extern void main_get_current_uri(const char **uri, const char **video_title_filename);
 extern GMainLoop *main_get_main_loop();
@@ -38,6 +117,153 @@ extern void main_show_error_message(const char *message, const char *details);
 extern void main_set_real_time_scheduling_policy();
 extern void main_set_normal_scheduling_policy();
 extern void main_thread_yield();
+/* Callback triggered when the first frame of the first pipeline has been prerolled. */
+extern void main_first_frame_cb();
+
+/* mediacache.c */
+
+/* Look up the cached media info of a local file; returns TRUE on a hit. */
+extern gboolean media_cache_lookup(const char *filename, MediaInfo *info);
+extern void media_cache_store(const char *filename, const MediaInfo *info);
+
+/* preload.c */
+
+/* Start preloading a local file in the background, replacing an earlier preload. */
+extern void preload_start(const char *filename, int window_size_mib);
+extern void preload_stop();
+extern gboolean preload_active();
+/* Report the playback position as a fraction of the duration. */
+extern void preload_set_position(double fraction);
+/* Returns NULL when no preload is active. */
+extern gchar *preload_get_stats_str();
+
+/* decodepath.c */
+
+/* The generic decode paths; the others are looked up by name. */
+#define DECODE_PATH_PLAYBIN 0
+#define DECODE_PATH_DECODEBIN 1
+
+/* Load the user-defined decode paths; call after gstreamer_init. */
+extern void decode_path_init();
+extern int decode_path_get_count();
+extern const char *decode_path_get_name(int i);
+extern int decode_path_lookup(const char *name);
+extern gboolean decode_path_is_generic(int i);
+/* Select a direct decode path for the container and video codec; - 1 if none matches. */
+extern int decode_path_select(const MediaInfo *info);
+extern char *decode_path_expand_template(const char *template, ...);
+/* Get the decoder threading of the path, which defaults to the configured setting. */
+extern void decode_path_get_decoder_threading(int i, int *max_threads,
+DecoderThreadType *thread_type);
+extern const char *decode_path_get_thread_type_name(DecoderThreadType type);
+/* Returns FALSE for an unknown name. */
+extern gboolean decode_path_parse_thread_type(const char *name, DecoderThreadType *type);
+/* Fill in the decode path part of the spec and its description. */
+extern void decode_path_create_pipeline(int i, PipelineSpec *spec, const char *source);
+
+/* calibrate.c */
+
+/* Load the decoder ranking; call after gstreamer_init. */
+extern void calibrate_init();
+/* Raise the rank of the calibrated decoders; done once, before decoders are autoplugged. */
+extern void calibrate_apply_preferred_decoders();
+extern const char *calibrate_get_best_decoder(const char *caps);
+extern int calibrate_run(int nu_clips, char **clips);
+
+/* governor.c */
+
+/* The decode quality governor is enabled by default. */
+extern void governor_set_enabled(gboolean status);
+extern void governor_start(gpointer pipeline);
+extern void governor_stop();
+extern void governor_report_qos(gpointer element, guint64 processed, guint64 dropped);
+/* Returns NULL when no pipeline is governed. */
+extern gchar *governor_get_stats_str();
+
+/* keyindex.c */
+
+/* Load the cached keyframe index of a local file or build it in the background. */
+extern void keyframe_index_start(const char *filename);
+extern void keyframe_index_stop();
+extern gboolean keyframe_index_ready();
+extern int keyframe_index_get_count();
+extern gint64 keyframe_index_get_time(int i);
+/* Byte offset of keyframe i in the file, - 1 when the demuxer doesn't report it. */
+extern gint64 keyframe_index_get_offset(int i);
+extern gint64 keyframe_index_snap(gint64 time);
+/* Number of frames to decode for an accurate seek, - 1 when unknown. */
+extern int keyframe_index_estimate_accurate_seek_cost(gint64 time, double framerate);
+/* Returns NULL when no file is indexed. */
+extern gchar *keyframe_index_get_stats_str();
+
+/* framering.c */
+
+/* Memory budget of the decoded frame ring in MiB, 0 disables it. Default 64. */
+extern void frame_ring_set_budget(int mib);
+extern void frame_ring_attach(gpointer rendering_sink);
+extern void frame_ring_detach();
+extern gboolean frame_ring_step_back();
+extern gboolean frame_ring_step_forward();
+extern gint64 frame_ring_get_displayed_offset();
+/* Returns NULL when no video sink is attached. */
+extern gchar *frame_ring_get_stats_str();
+
+/* reverse.c */
+
+/* Memory budget of the reverse playback frame cache in MiB, 0 disables it. Default 256. */
+extern void reverse_playback_set_budget(int mib);
+/* The rendering sink must belong to a paused pipeline; the rate is positive. */
+extern gboolean reverse_playback_start(const char *uri, gpointer rendering_sink,
+	gint64 position, double rate, double framerate);
+/* Returns the position of the frame shown last, - 1 when not active. */
+extern gint64 reverse_playback_stop();
+extern gboolean reverse_playback_active();
+extern void reverse_playback_set_paused(gboolean status);
+extern void reverse_playback_set_rate(double rate);
+extern gint64 reverse_playback_get_position();
+/* Returns NULL when reverse playback is not active. */
+extern gchar *reverse_playback_get_stats_str();
+
+/* thumbnail.c */
+
+/* Load the cached slider thumbnails of a local file or generate them in the background. */
+extern void thumbnail_start(const char *filename);
+extern void thumbnail_stop();
+/* Returns a new GdkPixbuf reference, or NULL when no thumbnail is available. */
+extern gpointer thumbnail_get_nearest(gint64 time);
+extern gchar *thumbnail_get_stats_str();
+
+/* mmapsrc.c */
+
+#define MMAPSRC_ELEMENT_NAME "gstplaymmapsrc"
+
+/* Register the zero-copy file source element; returns FALSE if it is not available. */
+extern gboolean mmapsrc_register();
+extern void mmapsrc_set_preferred(gboolean status);
+
+/* bench.c */
+
+extern void bench_init(int repetitions);
+extern gboolean bench_enabled();
+extern int bench_get_repetitions();
+extern void bench_add_sample(BenchPhase phase, gint64 duration_us);
+extern void bench_start_repetition();
+extern void bench_phase_begin(BenchPhase phase);
+extern void bench_phase_end(BenchPhase phase);
+extern gboolean bench_phase_ended(BenchPhase phase);
+extern gint64 bench_get_phase_duration(BenchPhase phase);
+extern void bench_calculate_statistics(gint64 *values, int n, double *min, double *median,
+double *p95, double *max);
+extern void bench_print_json_string(const char *s);
+extern void bench_print_json_statistics(const char *name, gint64 *values, int n, gboolean last);
+extern void bench_print_startup_report(const char *uri, const char *decode_path,
+const char *video_sink);
+extern void bench_print_source_report(const char *filename, int nu_sources,
+const char **sources, gint64 **wall_us, gint64 **cpu_us, guint64 size);
+extern void bench_print_switch_report(int nu_files, char **files, const char *video_sink,
+gint64 *switch_us, gint64 *recreate_us, int n);
+extern void bench_print_seek_report(const char *uri, const char *decode_path,
+	const char *video_sink, gint64 duration, int nu_seeks, gint64 **seek_us, int *n);
 
 /* config.c. */
 
@@ -67,12 +293,18 @@ extern void config_set_global_color_balance_default(int channel, gdouble value);
 extern gdouble config_get_global_color_balance_default(int channel);
 extern void config_set_uri_color_balance_default(int channel, gdouble value);
 extern gdouble config_get_uri_color_balance_default(int channel);
+extern void config_set_decoder_max_threads(int n);
+extern int config_get_decoder_max_threads();
+extern void config_set_decoder_thread_type(DecoderThreadType type);
+extern DecoderThreadType config_get_decoder_thread_type();
 
 /* gui.c */
 
 extern gboolean gui_init(int *argcp, char **argvp[]);
 extern void gui_setup_window(GMainLoop *loop, const char *video_filename, int video_width,
 	int video_height, gboolean full_screen);
+/* Resize the window so that the video area has the given size. */
+extern void gui_set_video_window_size(int width, int height);
 extern void gui_set_window_title(const char *title);
 extern guintptr gui_get_video_window_handle();
 extern void gui_get_render_rectangle(int *x, int *y, int *w, int *h);
@@ -80,8 +312,6 @@ extern void gui_get_version(guint *major, guint *minor, guint *micro);
 extern void gui_show_error_message(const gchar *message, const gchar *detail);
 /* Callback triggered when a state change to PLAYING occurs for the first time. */
 extern void gui_play_start_cb();
-/* Callback triggered when any state change to PLAYING occurs. */
-extern void gui_state_change_to_playing_cb();
 
 /* gstreamer.c */
 
@@ -89,10 +319,41 @@ extern void gstreamer_init(int *argcp, char **argvp[]);
 extern void gstreamer_get_version(guint *major, guint *minor, guint *micro);
 extern void gstreamer_get_compiled_version(guint *major, guint *minor, guint *micro);
 extern gboolean gstreamer_have_software_color_balance();
-extern void gstreamer_determine_video_dimensions(const char *uri, int *video_width, int *video_height);
+extern const char *gstreamer_get_file_source_element();
+/* Select filesrc instead of the memory-mapped source, for playbin as well. */
+extern void gstreamer_set_mmap_source_enabled(gboolean status);
+extern gboolean gstreamer_bench_source(const char *source, const char *filename,
+gint64 *wall_us, gint64 *cpu_us, guint64 *bytes);
+/* Start probing the media asynchronously; the callback is invoked from the main loop. */
+extern gboolean gstreamer_probe_media_async(const char *uri, MediaProbeCallback callback,
+gpointer user_data);
+/* Probe the media synchronously; returns FALSE if the media could not be identified. */
+extern gboolean gstreamer_probe_media_sync(const char *uri, MediaInfo *info);
+extern gboolean gstreamer_caps_string_match(const char *template_caps, const char *caps);
+extern gboolean gstreamer_element_available(const char *name);
+/* Video decoders for the codec, best rank first; free with g_strfreev. */
+extern gchar **gstreamer_get_video_decoders(const char *caps);
+extern gboolean gstreamer_element_has_property(const char *name, const char *property);
+extern void gstreamer_set_preferred_decoder(const char *name, const char *caps);
+/* Describe the threading of the video decoder of the pipeline; returns NULL when there is none. */
+extern gchar *gstreamer_get_decoder_threading_str();
+extern gboolean gstreamer_run_to_eos(const char *s, guint64 *frames, gint64 *wall_us);
+/* Parse a pipeline description without running it; returns FALSE and an error message on failure. */
+extern gboolean gstreamer_check_pipeline_description(const char *s, char **error_message);
+/*
+ * Report the media info from the playback pipeline itself when it first prerolls
+ * (playbin only), instead of running a separate probe.
+ */
+extern void gstreamer_probe_media_at_preroll(MediaProbeCallback callback, gpointer user_data);
 extern void gstreamer_expose_video_overlay(int x, int y, int w, int h);
-extern gboolean gstreamer_run_pipeline(GMainLoop *loop, const char *s, StartupState startup);
+extern gboolean gstreamer_run_pipeline(GMainLoop *loop, const PipelineSpec *spec,
+StartupState startup);
 extern void gstreamer_destroy_pipeline();
+/*
+ * Switch the running playbin to the uri of the spec without recreating it;
+ * returns FALSE when the spec requires a new pipeline.
+ */
+extern gboolean gstreamer_switch_uri(const PipelineSpec *spec, StartupState startup);
 extern void gstreamer_get_video_dimensions(int *width, int *height);
 extern void gstreamer_get_video_info(const char **format, int *width, int *height,
 int *framerate_numeratorp, int *framerate_denomp, int *pixel_aspect_ratio_nump,
@@ -114,6 +375,11 @@ extern gboolean gstreamer_no_video();
 extern void gstreamer_suspend_pipeline();
 /* Reconstruct the last-run pipeline and seek to the saved position. */
 extern void gstreamer_restart_pipeline();
+/*
+ * Apply new sinks and flags to the running pipeline and seek back to the
+ * current position; returns FALSE when the pipeline has to be restarted.
+ */
+extern gboolean gstreamer_reconfigure_pipeline(const PipelineSpec *spec);
 extern void gstreamer_set_volume(gdouble volume);
 extern gdouble gstreamer_get_volume();
 extern void gstreamer_inform_playbin_used(gboolean status);
@@ -129,9 +395,53 @@ extern void gstreamer_increase_playback_speed();
 extern void gstreamer_decrease_playback_speed();
 extern void gstreamer_set_playback_speed_reverse(gboolean state);
 extern void gstreamer_reset_playback_speed();
+/* Decode only keyframes (key units trick mode), used by the decode quality governor. */
+extern void gstreamer_set_key_units_only(gboolean status);
+extern void gstreamer_set_seek_mode(SeekMode mode);
+/* Seek with the mode and time the first buffer at the video sink (BENCH_PHASE_FIRST_BUFFER). */
+extern gboolean gstreamer_bench_seek(gint64 time_nanoseconds, SeekMode mode);
+extern gboolean gstreamer_bench_seek_done();
+/* Remove the probe of the last benchmark seek, whether it completed or timed out. */
+extern void gstreamer_bench_seek_end();
+/* Rate, speed strategy and displayed frame rate; NULL without a pipeline. */
+extern gchar *gstreamer_get_playback_speed_str();
+/* The element that renders the video (a GstBaseSink), referenced, or NULL. */
+extern gpointer gstreamer_get_rendering_video_sink();
+extern void gstreamer_render_video_frame(gpointer sink, gpointer buffer);
+/* Whether the GstBufferPool has a maximum number of buffers. */
+extern gboolean gstreamer_buffer_pool_is_bounded(gpointer pool);
+/* Keyframe-only seeking while the position slider is dragged. */
+extern void gstreamer_scrub_begin();
+extern void gstreamer_scrub_to_time(gint64 time_nanoseconds);
+extern void gstreamer_scrub_end(gint64 time_nanoseconds);
+/* Returns NULL when no scrubbing has been done yet. */
+extern gchar *gstreamer_get_scrub_stats_str();
 
 /* stats.c */
 
+/* Maximum number of threads sampled for the thread info. */
+#define STATS_MAX_THREADS 64
+#define STATS_SPARKLINE_POINTS 100
+
+/* Maximum number of helper processes monitored besides gstplay. */
+#define STATS_MAX_MONITORED_PROCESSES 8
+
+typedef struct {
+	char name[16];
+	int pid;
+	/* User + system time in percent of the time of all cores. */
+	gdouble cpu_percent;
+	gdouble cpu_seconds;
+	guint64 rss;
+} StatsProcessUsage;
+
+typedef struct {
+	int tid;
+	char name[16];
+	/* CPU usage in percent per sampling interval, oldest first; - 1 when unknown. */
+	float cpu_percent[STATS_SPARKLINE_POINTS];
+} StatsThreadHistory;
+
 extern void stats_set_enabled(gboolean status);
 extern void stats_set_thread_info(gboolean status);
 extern void stats_report_dropped_frames_cb(gpointer element, const char *name,
@@ -139,3 +449,9 @@ guint64 processed, guint64 dropped);
 extern void stats_reset();
 extern gchar *stats_get_cpu_utilization_str();
 extern gchar *stats_get_dropped_frames_str();
+extern gchar *stats_get_playback_info_str();
+extern gdouble stats_get_process_cpu_time();
+extern int stats_get_thread_history(StatsThreadHistory *threads, int max_threads);
+extern void stats_set_monitored_processes(const char *list);
+extern void stats_begin_process_usage();
+extern int stats_get_process_usage(StatsProcessUsage *usage, int max_processes);
@@ -22,6 +22,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <gst/gst.h>
 #if GST_CHECK_VERSION(1, 0, 0)
 #include <gst/video/videooverlay.h>
@@ -33,6 +36,10 @@
 #else
 #include <gst/interfaces/colorbalance.h>
 #endif
+#include <gst/pbutils/pbutils.h>
+#if GST_CHECK_VERSION(1, 0, 0)
+#include <gst/base/gstbasesink.h>
+#endif
 #include <glib.h>
 #include "gstplay.h"
 
@@ -86,26 +93,116 @@ static inline GstCaps *gst_pad_get_current_caps(GstPad *pad) {
 	return gst_pad_get_negotiated_caps(pad);
 }
 
+static inline GstCaps *gst_pad_query_caps(GstPad *pad, GstCaps *filter) {
+	return gst_pad_get_caps(pad);
+}
+
 #endif
 
 static GSTREAMER_VIDEO_OVERLAY *video_window_overlay = NULL;
-static GstElement *playbin_pipeline;
 static GstElement *pipeline;
 static guint bus_watch_id;
-static gboolean bus_quit_on_playing = FALSE;
 static gboolean state_change_to_playing_already_occurred = FALSE;
+static gboolean first_preroll_already_occurred = FALSE;
+static MediaProbeCallback preroll_probe_callback = NULL;
+static gpointer preroll_probe_user_data;
 static GList *created_pads_list = NULL;
-static const char *pipeline_description = "";
+static char *pipeline_description = NULL;
 static GstState suspended_state;
 static GstClockTime suspended_pos;
 static GstClockTime requested_position;
 static gdouble suspended_audio_volume;
+/* Seek to requested_position as soon as the pipeline has prerolled. */
+static gboolean seek_when_prerolled = FALSE;
+static GstState state_after_seek;
 static gboolean end_of_stream = FALSE;
 static gboolean using_playbin;
 static GList *inform_pipeline_destroyed_cb_list;
-static gboolean pause_on_state_change_to_playing = FALSE;
+static gboolean have_mmap_source = FALSE;
+static gboolean key_units_only = FALSE;
+static gdouble playback_rate = 1.0;
+/* Faster rates decode keyframes only, see get_speed_seek_flags(). */
+#define MAX_FULL_DECODE_RATE 2.0
+/* Set when a playbin is switched to a new uri, until it reaches PLAYING again. */
+static gboolean uri_switched = FALSE;
+/* The sinks and flags of the running playbin, NULL for other pipelines. */
+static char *playbin_setup = NULL;
+/* Duration of the stream, - 1 until known; refreshed on ASYNC_DONE and DURATION_CHANGED. */
+static gint64 cached_duration = - 1;
+/*
+ * Stream time of the last buffer at the video sink, written by a pad probe in
+ * the streaming thread and read without locking; - 1 when unknown.
+ */
+static gint64 sink_position = - 1;
+static GstPad *position_pad = NULL;
+static gulong position_probe_id;
+/* Set when the audio was muted for fast forward playback. */
+static gboolean muted_for_speed = FALSE;
+static gboolean have_scaletempo = FALSE;
+/* Sample of the rendered frame count of the video sink, for the displayed frame rate. */
+static guint64 last_rendered_frames;
+static gint64 last_rendered_frames_time;
+static double displayed_fps = - 1.0;
+/* Whether reverse playback was paused, and has to be resumed after a scrub. */
+static gboolean reverse_paused = FALSE;
+static gboolean reverse_after_scrub = FALSE;
+/* Target of a backward frame step that went past the frame ring, - 1 if none. */
+static gint64 step_back_target = - 1;
+/* Keyframe scrubbing: at most one seek in flight, the latest target pending. */
+static gboolean scrubbing = FALSE;
+static gboolean scrub_seek_in_flight;
+static gint64 scrub_pending_target;
+static gint64 scrub_start_time;
+static int scrub_nu_frames;
+static double last_scrub_frame_rate = - 1.0;
+
+/*
+ * Compiled pipeline cache. When the pipeline is suspended, its element graph is
+ * kept in the NULL state so that gstreamer_restart_pipeline can bring it up
+ * again without parsing the description. The links that gst_parse_launch
+ * makes when a sometimes pad appears are one-shot, so they are recorded before
+ * the pipeline is shut down and redone by a pad-added handler of our own.
+ */
+typedef struct {
+	char *src_element;
+	char *src_pad;
+	char *sink_element;
+	char *sink_pad;
+	/* Media type class of the source pad ("video", "audio", ...), NULL when unknown. */
+	char *media_class;
+} DynamicLink;
+
+static GstElement *cached_pipeline = NULL;
+static char *cached_pipeline_description = NULL;
+static GList *cached_dynamic_links = NULL;
+static gboolean cache_pipeline_on_destroy = FALSE;
+
+/*
+ * Typed handles to the elements of a pipeline made by the pipeline builder.
+ * The pipeline owns the elements; handles that don't apply are NULL, and all
+ * of them are NULL for pipelines parsed from a description.
+ */
+typedef struct {
+	GstElement *source;
+	GstElement *demuxer;
+	GstElement *video_queue;
+	GstElement *parser;
+	GstElement *decoder;
+	GstElement *decoder_queue;
+	GstElement *video_sink;
+	GstElement *audio_queue;
+	GstElement *audio_convert;
+	GstElement *audio_resample;
+	GstElement *audio_sink;
+} PipelineElements;
+
+static PipelineElements elements;
+static PipelineElements cached_elements;
+static gboolean pipeline_built;
+static gboolean cached_pipeline_built;
 
 static GstElement *find_xvimagesink();
+static void get_playbin_media_info(MediaInfo *info);
 
 void gstreamer_expose_video_overlay(int x, int y, int w, int h) {
 	if (video_window_overlay == NULL)
@@ -117,6 +214,18 @@ void gstreamer_expose_video_overlay(int x, int y, int w, int h) {
 	// Calling expose explicitly causes lock-ups.
 }
 
+static void restore_position();
+static void scrub_seek_done();
+static void attach_frame_ring();
+static void update_cached_duration();
+static void detach_position_probe();
+static gboolean start_reverse_playback(gint64 pos);
+static void setup_audio_tempo();
+static void set_speed_mute(gboolean status);
+static GstSeekFlags get_speed_seek_flags();
+static void step_to_target();
+static gboolean get_framerate(double *frameratep);
+
 static gboolean bus_callback(GstBus *bus, GstMessage *msg, gpointer data) {
 	GMainLoop *loop = (GMainLoop *)data;
 
@@ -152,6 +261,7 @@ static gboolean bus_callback(GstBus *bus, GstMessage *msg, gpointer data) {
 		if (format == GST_FORMAT_BUFFERS)  {
 			GstElement *src = GST_MESSAGE_SRC(msg);
 			char *name = gst_element_get_name(src);
+			governor_report_qos(src, processed, dropped);
 			stats_report_dropped_frames_cb(src, name, processed, dropped);
 //			printf("gstplay: %s reports %lu out of %lu frames (%d%%) dropped.\n",
 //				name,
@@ -161,16 +271,47 @@ static gboolean bus_callback(GstBus *bus, GstMessage *msg, gpointer data) {
 		}
 		break;
 	}
+	case GST_MESSAGE_DURATION_CHANGED:
+		cached_duration = - 1;
+		break;
+	case GST_MESSAGE_ASYNC_DONE:
+		if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline))
+			update_cached_duration();
+		if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline) && seek_when_prerolled)
+			restore_position();
+		if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline) && scrubbing)
+			scrub_seek_done();
+		if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline)) {
+			attach_frame_ring();
+			if (step_back_target >= 0)
+				step_to_target();
+		}
+		// The first preroll of a pipeline means the first frame has reached the sink.
+		if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline) && !first_preroll_already_occurred) {
+			first_preroll_already_occurred = TRUE;
+			if (preroll_probe_callback != NULL && using_playbin) {
+				MediaInfo info;
+				get_playbin_media_info(&info);
+				MediaProbeCallback callback = preroll_probe_callback;
+				preroll_probe_callback = NULL;
+				callback(&info, preroll_probe_user_data);
+			}
+			main_first_frame_cb();
+		}
+		break;
 	case GST_MESSAGE_STATE_CHANGED:
-		if (bus_quit_on_playing) {
-			// When doing the initial run to determine video parameters,
-			// stop immediately when play starts.
-			if (GST_STATE(playbin_pipeline) == GST_STATE_PLAYING)
-				g_main_loop_quit(loop);
+		if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline)) {
+			GstState old_state, new_state;
+			gst_message_parse_state_changed(msg, &old_state, &new_state, NULL);
+			if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED)
+				bench_phase_end(BENCH_PHASE_PREROLL);
 		}
 		if (!state_change_to_playing_already_occurred &&
 		GST_STATE(pipeline) == GST_STATE_PLAYING) {
-			gstreamer_set_default_settings();
+			/* Keep the color balance of a playbin that was switched to a new uri. */
+			if (!uri_switched)
+				gstreamer_set_default_settings();
+			uri_switched = FALSE;
 #if !GST_CHECK_VERSION(1, 0, 0)
 			// GStreamer 0.10's xvimagesink does not force aspect ratio by default.
 			GstElement *xvimagesink = find_xvimagesink();
@@ -182,16 +323,8 @@ static gboolean bus_callback(GstBus *bus, GstMessage *msg, gpointer data) {
 			gui_play_start_cb();
 			state_change_to_playing_already_occurred = TRUE;
 		}
-		if (GST_STATE(pipeline) == GST_STATE_PLAYING)
-			gui_state_change_to_playing_cb();
-		if (GST_STATE(pipeline) == GST_STATE_PLAYING && pause_on_state_change_to_playing) {
-			pause_on_state_change_to_playing = FALSE;
-			gstreamer_pause();
-		}
 		break;
-	case GST_MESSAGE_BUFFERING:
-		if (bus_quit_on_playing)
-			break;
+	case GST_MESSAGE_BUFFERING: ;
 		gint percent = 0;
 		gst_message_parse_buffering(msg, &percent);
 		if (percent < 100) {
@@ -252,49 +385,490 @@ void gstreamer_init(int *argcp, char **argvp[]) {
 		printf("Warning: gstreamer API version is not %d.%d (version %d.%d found).\n",
 			GST_VERSION_MAJOR, GST_VERSION_MINOR, major, minor);
 	}
+	have_mmap_source = mmapsrc_register();
 }
 
-// Return the dimensions of a non-running pipeline by test-running it briefly.
+/* The element used to read local files in the custom decode paths. */
 
-void gstreamer_determine_video_dimensions(const char *uri, int *video_width,
-int *video_height) {
-	GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+const char *gstreamer_get_file_source_element() {
+	return have_mmap_source ? MMAPSRC_ELEMENT_NAME : "filesrc";
+}
 
-	char *playbin_launch_str = malloc(strlen(uri) + 64);
-	sprintf(playbin_launch_str, PLAYBIN_STR
-		" uri=%s audio-sink=fakesink video-sink=fakesink", uri);
-	GError *error2 = NULL;
-	GstElement *playbin = gst_parse_launch(playbin_launch_str, &error2);
-	if (error2) {
-		printf("Error: Could not create gstreamer pipeline for identification.\n");
-		printf("Parse error: %s\n", error2->message);
-		exit(1);
+void gstreamer_set_mmap_source_enabled(gboolean status) {
+	if (!have_mmap_source && status)
+		return;
+	mmapsrc_set_preferred(status);
+	have_mmap_source = status;
+}
+
+/*
+ * Source throughput benchmark. The source feeds a fakesink whose handoff
+ * touches every page of every buffer, like a demuxer would, so that the page
+ * faults of a memory-mapped source are accounted for. Returns FALSE when the
+ * pipeline could not be run to the end of the file.
+ */
+
+static void bench_source_handoff_cb(GstElement *sink, GstBuffer *buffer, GstPad *pad,
+gpointer data) {
+	guint64 *bytes = data;
+	volatile guint8 sum = 0;
+#if GST_CHECK_VERSION(1, 0, 0)
+	GstMapInfo map;
+	if (!gst_buffer_map(buffer, &map, GST_MAP_READ))
+		return;
+	for (gsize i = 0; i < map.size; i += 4096)
+		sum += map.data[i];
+	*bytes += map.size;
+	gst_buffer_unmap(buffer, &map);
+#else
+	for (guint i = 0; i < GST_BUFFER_SIZE(buffer); i += 4096)
+		sum += GST_BUFFER_DATA(buffer)[i];
+	*bytes += GST_BUFFER_SIZE(buffer);
+#endif
+}
+
+static gint64 get_cpu_time_us() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (gint64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+		usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+gboolean gstreamer_bench_source(const char *source, const char *filename, gint64 *wall_us,
+gint64 *cpu_us, guint64 *bytes) {
+	char *s = g_strdup_printf("%s location=\"%s\" ! fakesink name=sink sync=false "
+		"signal-handoffs=true", source, filename);
+	GError *error = NULL;
+	GstElement *p = gst_parse_launch(s, &error);
+	g_free(s);
+	if (p == NULL) {
+		printf("gstplay: Could not create source benchmark pipeline: %s\n", error->message);
+		g_error_free(error);
+		return FALSE;
 	}
+	GstElement *sink = gst_bin_get_by_name(GST_BIN(p), "sink");
+	*bytes = 0;
+	g_signal_connect(sink, "handoff", G_CALLBACK(bench_source_handoff_cb), bytes);
+	gst_object_unref(sink);
+	GstBus *bus = gst_element_get_bus(p);
+	gint64 cpu_start = get_cpu_time_us();
+	gint64 t = g_get_monotonic_time();
+	gst_element_set_state(p, GST_STATE_PLAYING);
+	GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+		GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+	*wall_us = g_get_monotonic_time() - t;
+	*cpu_us = get_cpu_time_us() - cpu_start;
+	gboolean ok = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+	if (!ok)
+		printf("gstplay: Source benchmark pipeline with %s failed.\n", source);
+	gst_message_unref(msg);
+	gst_object_unref(bus);
+	gst_element_set_state(p, GST_STATE_NULL);
+	gst_object_unref(p);
+	return ok;
+}
+
+/*
+ * Asynchronous media probe. GstDiscoverer only needs to get as far as the
+ * demuxer/parser caps to report the video dimensions, frame-rate and duration,
+ * and it runs from the default main context, so the window and the real
+ * pipeline can be set up while it is working.
+ */
 
-	playbin_pipeline = playbin;
-	bus_quit_on_playing = TRUE;
-	GstBus *playbin_bus = gst_pipeline_get_bus(GST_PIPELINE(playbin));
-	guint type_find_bus_watch_id = gst_bus_add_watch(playbin_bus, bus_callback, loop);
-	gst_object_unref(playbin_bus);
+typedef struct {
+	GstDiscoverer *discoverer;
+	MediaProbeCallback callback;
+	gpointer user_data;
+} MediaProbe;
 
-	gst_element_set_state(GST_ELEMENT(playbin), GST_STATE_READY);
-	gst_element_set_state(GST_ELEMENT(playbin), GST_STATE_PLAYING);
-	g_main_loop_run(loop);
-	gst_element_set_state(GST_ELEMENT(playbin), GST_STATE_PAUSED);
+/*
+ * Reduce caps to the media type plus the fields that identify the codec, for
+ * example "video/mpeg, mpegversion=(int)4", so that codec_data and the like
+ * don't end up in the string.
+ */
 
-	GstPad *pad = gst_pad_new("", GST_PAD_UNKNOWN);
-	g_signal_emit_by_name(playbin, "get-video-pad", 0, &pad, NULL);
-	GstCaps *caps = gst_pad_get_current_caps(pad);
-	*video_width = g_value_get_int(gst_structure_get_value(
-		gst_caps_get_structure(caps, 0), "width"));
-	*video_height = g_value_get_int(gst_structure_get_value(
-		gst_caps_get_structure(caps, 0), "height"));
-	g_object_unref(pad);
+static void caps_to_short_string(GstCaps *caps, char *s, int size) {
+	s[0] = '\0';
+	if (caps == NULL || gst_caps_get_size(caps) == 0)
+		return;
+	const GstStructure *str = gst_caps_get_structure(caps, 0);
+	int version;
+	if (gst_structure_get_int(str, "mpegversion", &version))
+		snprintf(s, size, "%s, mpegversion=(int)%d", gst_structure_get_name(str), version);
+	else if (gst_structure_get_int(str, "msmpegversion", &version))
+		snprintf(s, size, "%s, msmpegversion=(int)%d", gst_structure_get_name(str),
+			version);
+	else
+		snprintf(s, size, "%s", gst_structure_get_name(str));
+}
+
+static gboolean media_probe_free_cb(gpointer data) {
+	MediaProbe *probe = data;
+	gst_discoverer_stop(probe->discoverer);
+	g_object_unref(probe->discoverer);
+	g_free(probe);
+	return FALSE;
+}
+
+static void get_discoverer_media_info(GstDiscovererInfo *info, MediaInfo *media_info) {
+	memset(media_info, 0, sizeof(MediaInfo));
+	GList *streams = gst_discoverer_info_get_video_streams(info);
+	if (streams != NULL) {
+		GstDiscovererVideoInfo *video_info = streams->data;
+		media_info->width = gst_discoverer_video_info_get_width(video_info);
+		media_info->height = gst_discoverer_video_info_get_height(video_info);
+		media_info->framerate_num = gst_discoverer_video_info_get_framerate_num(video_info);
+		media_info->framerate_denom =
+			gst_discoverer_video_info_get_framerate_denom(video_info);
+		media_info->par_num = gst_discoverer_video_info_get_par_num(video_info);
+		media_info->par_denom = gst_discoverer_video_info_get_par_denom(video_info);
+		GstCaps *caps = gst_discoverer_stream_info_get_caps(
+			GST_DISCOVERER_STREAM_INFO(video_info));
+		caps_to_short_string(caps, media_info->video_codec,
+			sizeof(media_info->video_codec));
+		if (caps != NULL)
+			gst_caps_unref(caps);
+	}
+	gst_discoverer_stream_info_list_free(streams);
+	streams = gst_discoverer_info_get_audio_streams(info);
+	media_info->has_audio = streams != NULL;
+	gst_discoverer_stream_info_list_free(streams);
+	GstDiscovererStreamInfo *stream_info = gst_discoverer_info_get_stream_info(info);
+	if (stream_info != NULL) {
+		if (GST_IS_DISCOVERER_CONTAINER_INFO(stream_info)) {
+			GstCaps *caps = gst_discoverer_stream_info_get_caps(stream_info);
+			caps_to_short_string(caps, media_info->container,
+				sizeof(media_info->container));
+			if (caps != NULL)
+				gst_caps_unref(caps);
+		}
+		gst_discoverer_stream_info_unref(stream_info);
+	}
+	media_info->duration = gst_discoverer_info_get_duration(info);
+}
+
+static void media_probe_discovered_cb(GstDiscoverer *discoverer, GstDiscovererInfo *info,
+GError *error, MediaProbe *probe) {
+	MediaInfo media_info;
+	memset(&media_info, 0, sizeof(media_info));
+	if (gst_discoverer_info_get_result(info) == GST_DISCOVERER_OK)
+		get_discoverer_media_info(info, &media_info);
+	else if (error != NULL)
+		printf("gstplay: Media probe failed: %s\n", error->message);
+	probe->callback(&media_info, probe->user_data);
+}
+
+static void media_probe_finished_cb(GstDiscoverer *discoverer, MediaProbe *probe) {
+	/* The discoverer can't be stopped from within its own signal handler. */
+	g_idle_add(media_probe_free_cb, probe);
+}
 
-	gst_element_set_state(GST_ELEMENT(playbin), GST_STATE_NULL);
-	gst_object_unref(GST_OBJECT(playbin));
-	g_source_remove(type_find_bus_watch_id);
-	g_main_loop_unref(loop);
+gboolean gstreamer_probe_media_async(const char *uri, MediaProbeCallback callback,
+gpointer user_data) {
+	GError *error = NULL;
+	GstDiscoverer *discoverer = gst_discoverer_new(5 * GST_SECOND, &error);
+	if (discoverer == NULL) {
+		printf("gstplay: Could not create media probe: %s\n", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	MediaProbe *probe = g_new(MediaProbe, 1);
+	probe->discoverer = discoverer;
+	probe->callback = callback;
+	probe->user_data = user_data;
+	g_signal_connect(discoverer, "discovered", G_CALLBACK(media_probe_discovered_cb), probe);
+	g_signal_connect(discoverer, "finished", G_CALLBACK(media_probe_finished_cb), probe);
+	gst_discoverer_start(discoverer);
+	if (!gst_discoverer_discover_uri_async(discoverer, uri)) {
+		media_probe_free_cb(probe);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Blocking variant of the media probe, for when the result is needed immediately. */
+
+gboolean gstreamer_probe_media_sync(const char *uri, MediaInfo *media_info) {
+	GError *error = NULL;
+	memset(media_info, 0, sizeof(MediaInfo));
+	GstDiscoverer *discoverer = gst_discoverer_new(5 * GST_SECOND, &error);
+	if (discoverer == NULL) {
+		printf("gstplay: Could not create media probe: %s\n", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	GstDiscovererInfo *info = gst_discoverer_discover_uri(discoverer, uri, &error);
+	gboolean ok = info != NULL && gst_discoverer_info_get_result(info) == GST_DISCOVERER_OK;
+	if (ok)
+		get_discoverer_media_info(info, media_info);
+	else if (error != NULL)
+		printf("gstplay: Media probe failed: %s\n", error->message);
+	if (error != NULL)
+		g_error_free(error);
+	if (info != NULL)
+		gst_discoverer_info_unref(info);
+	g_object_unref(discoverer);
+	return ok;
+}
+
+/* Check whether the caps described by the string caps are compatible with the template caps. */
+
+gboolean gstreamer_caps_string_match(const char *template_caps, const char *caps) {
+	if (caps == NULL || caps[0] == '\0')
+		return FALSE;
+	GstCaps *c1 = gst_caps_from_string(template_caps);
+	GstCaps *c2 = gst_caps_from_string(caps);
+	gboolean match = c1 != NULL && c2 != NULL && gst_caps_can_intersect(c1, c2);
+	if (c1 != NULL)
+		gst_caps_unref(c1);
+	if (c2 != NULL)
+		gst_caps_unref(c2);
+	return match;
+}
+
+gboolean gstreamer_check_pipeline_description(const char *s, char **error_message) {
+	GError *error = NULL;
+#if GST_CHECK_VERSION(1, 0, 0)
+	GstElement *p = gst_parse_launch_full(s, NULL, GST_PARSE_FLAG_FATAL_ERRORS, &error);
+#else
+	GstElement *p = gst_parse_launch(s, &error);
+#endif
+	if (p != NULL)
+		gst_object_unref(p);
+	if (error != NULL) {
+		*error_message = g_strdup(error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	return p != NULL;
+}
+
+gboolean gstreamer_element_available(const char *name) {
+	GstElementFactory *factory = gst_element_factory_find(name);
+	if (factory == NULL)
+		return FALSE;
+	gst_object_unref(factory);
+	return TRUE;
+}
+
+/*
+ * Decoder calibration support. The video decoders for a codec are looked up in
+ * the registry, best rank first.
+ */
+
+gchar **gstreamer_get_video_decoders(const char *caps_str) {
+	GPtrArray *names = g_ptr_array_new();
+	GstCaps *caps = gst_caps_from_string(caps_str);
+	if (caps != NULL) {
+		GList *factories = gst_element_factory_list_get_elements(
+			GST_ELEMENT_FACTORY_TYPE_DECODER | GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO,
+			GST_RANK_NONE);
+		GList *decoders = gst_element_factory_list_filter(factories, caps, GST_PAD_SINK,
+			FALSE);
+		decoders = g_list_sort(decoders, gst_plugin_feature_rank_compare_func);
+		for (GList *list = decoders; list != NULL; list = g_list_next(list))
+			g_ptr_array_add(names, g_strdup(gst_plugin_feature_get_name(
+				GST_PLUGIN_FEATURE(list->data))));
+		gst_plugin_feature_list_free(decoders);
+		gst_plugin_feature_list_free(factories);
+		gst_caps_unref(caps);
+	}
+	g_ptr_array_add(names, NULL);
+	return (gchar **)g_ptr_array_free(names, FALSE);
+}
+
+gboolean gstreamer_element_has_property(const char *name, const char *property) {
+	GstElement *element = gst_element_factory_make(name, NULL);
+	if (element == NULL)
+		return FALSE;
+	gboolean found = g_object_class_find_property(G_OBJECT_GET_CLASS(element),
+		property) != NULL;
+	gst_object_unref(element);
+	return found;
+}
+
+/*
+ * Make a decoder the preferred one for the codec, so that playbin picks it, by
+ * raising its rank above that of the other decoders for the codec.
+ */
+
+void gstreamer_set_preferred_decoder(const char *name, const char *caps_str) {
+	GstPluginFeature *feature = GST_PLUGIN_FEATURE(gst_element_factory_find(name));
+	if (feature == NULL)
+		return;
+	guint max_rank = 0;
+	gchar **decoders = gstreamer_get_video_decoders(caps_str);
+	for (int i = 0; decoders[i] != NULL; i++) {
+		if (strcmp(decoders[i], name) == 0)
+			continue;
+		GstElementFactory *factory = gst_element_factory_find(decoders[i]);
+		guint rank = gst_plugin_feature_get_rank(GST_PLUGIN_FEATURE(factory));
+		if (rank > max_rank)
+			max_rank = rank;
+		gst_object_unref(factory);
+	}
+	g_strfreev(decoders);
+	if (gst_plugin_feature_get_rank(feature) <= max_rank)
+		gst_plugin_feature_set_rank(feature, max_rank + 1);
+	gst_object_unref(feature);
+}
+
+static void count_frames_handoff_cb(GstElement *sink, GstBuffer *buffer, GstPad *pad,
+gpointer data) {
+	guint64 *frames = data;
+	(*frames)++;
+}
+
+/*
+ * Run a pipeline until the end of the stream without a main loop. When frames
+ * is not NULL, the buffers arriving at the element named "sink" (a fakesink)
+ * are counted.
+ */
+
+gboolean gstreamer_run_to_eos(const char *s, guint64 *frames, gint64 *wall_us) {
+	GError *error = NULL;
+	GstElement *p = gst_parse_launch(s, &error);
+	if (p == NULL) {
+		printf("gstplay: Could not create pipeline: %s\n", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	if (error != NULL)
+		g_error_free(error);
+	if (frames != NULL) {
+		*frames = 0;
+		GstElement *sink = gst_bin_get_by_name(GST_BIN(p), "sink");
+		if (sink != NULL) {
+			g_object_set(sink, "signal-handoffs", TRUE, NULL);
+			g_signal_connect(sink, "handoff", G_CALLBACK(count_frames_handoff_cb), frames);
+			gst_object_unref(sink);
+		}
+	}
+	GstBus *bus = gst_element_get_bus(p);
+	gint64 t = g_get_monotonic_time();
+	gst_element_set_state(p, GST_STATE_PLAYING);
+	GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+		GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+	if (wall_us != NULL)
+		*wall_us = g_get_monotonic_time() - t;
+	gboolean ok = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+	if (!ok) {
+		GError *err;
+		gst_message_parse_error(msg, &err, NULL);
+		printf("gstplay: Pipeline error: %s\n", err->message);
+		g_error_free(err);
+	}
+	gst_message_unref(msg);
+	gst_object_unref(bus);
+	gst_element_set_state(p, GST_STATE_NULL);
+	gst_object_unref(p);
+	return ok;
+}
+
+/*
+ * When playbin is used, the playback pipeline itself serves as the media probe:
+ * instead of identifying the stream with a separate pipeline, the media info
+ * is read from the playbin once it has prerolled.
+ */
+
+void gstreamer_probe_media_at_preroll(MediaProbeCallback callback, gpointer user_data) {
+	preroll_probe_callback = callback;
+	preroll_probe_user_data = user_data;
+}
+
+/*
+ * Find the first element in the (recursively iterated) pipeline whose klass
+ * contains the given string. Returns a new reference or NULL.
+ */
+
+static GstElement *find_element_by_klass(const char *klass_str) {
+	GstIterator *iterator = gst_bin_iterate_recurse(GST_BIN(pipeline));
+	GstElement *found = NULL;
+	gboolean done = FALSE;
+#if GST_CHECK_VERSION(1, 0, 0)
+	GValue item = G_VALUE_INIT;
+#else
+	gpointer item;
+#endif
+	while (!done) {
+		switch (gst_iterator_next(iterator, &item)) {
+		case GST_ITERATOR_OK : {
+#if GST_CHECK_VERSION(1, 0, 0)
+			GstElement *element = g_value_get_object(&item);
+			const char *klass = gst_element_class_get_metadata(
+				GST_ELEMENT_GET_CLASS(element), GST_ELEMENT_METADATA_KLASS);
+#else
+			GstElement *element = GST_ELEMENT(item);
+			const char *klass = GST_ELEMENT_GET_CLASS(element)->details.klass;
+#endif
+			if (klass != NULL && strstr(klass, klass_str) != NULL) {
+				found = gst_object_ref(element);
+				done = TRUE;
+			}
+#if GST_CHECK_VERSION(1, 0, 0)
+			g_value_reset(&item);
+#else
+			gst_object_unref(item);
+#endif
+			break;
+		}
+		case GST_ITERATOR_RESYNC :
+			gst_iterator_resync(iterator);
+			break;
+		case GST_ITERATOR_DONE:
+		case GST_ITERATOR_ERROR:
+		default:
+			done = TRUE;
+		}
+	}
+#if GST_CHECK_VERSION(1, 0, 0)
+	g_value_unset(&item);
+#endif
+	gst_iterator_free(iterator);
+	return found;
+}
+
+static void get_element_sink_caps_str(const char *klass_str, char *s, int size) {
+	s[0] = '\0';
+	GstElement *element = find_element_by_klass(klass_str);
+	if (element == NULL)
+		return;
+	GstPad *pad = gst_element_get_static_pad(element, "sink");
+	if (pad != NULL) {
+		GstCaps *caps = gst_pad_get_current_caps(pad);
+		caps_to_short_string(caps, s, size);
+		if (caps != NULL)
+			gst_caps_unref(caps);
+		gst_object_unref(pad);
+	}
+	gst_object_unref(element);
+}
+
+static void read_video_props(GstCaps *caps, const char **formatp, int *widthp, int *heightp,
+int *framerate_numeratorp, int *framerate_denomp, int *pixel_aspect_ratio_nump,
+int *pixel_aspect_ratio_denomp);
+
+static void get_playbin_media_info(MediaInfo *info) {
+	memset(info, 0, sizeof(MediaInfo));
+	GstPad *pad = NULL;
+	g_signal_emit_by_name(pipeline, "get-video-pad", 0, &pad, NULL);
+	if (pad != NULL) {
+		GstCaps *caps = gst_pad_get_current_caps(pad);
+		if (caps != NULL) {
+			const char *format = NULL;
+			read_video_props(caps, &format, &info->width, &info->height,
+				&info->framerate_num, &info->framerate_denom,
+				&info->par_num, &info->par_denom);
+			gst_caps_unref(caps);
+		}
+		gst_object_unref(pad);
+	}
+	info->duration = gstreamer_get_duration();
+	int nu_audio_streams = 0;
+	g_object_get(pipeline, "n-audio", &nu_audio_streams, NULL);
+	info->has_audio = nu_audio_streams > 0;
+	get_element_sink_caps_str("Demux", info->container, sizeof(info->container));
+	get_element_sink_caps_str("Decoder/Video", info->video_codec, sizeof(info->video_codec));
 }
 
 static void read_video_props(GstCaps *caps, const char **formatp, int *widthp, int *heightp,
@@ -379,7 +953,7 @@ extern void gstreamer_get_video_dimensions(int *widthp, int *heightp) {
 }
 
 const char *gstreamer_get_pipeline_description() {
-	return pipeline_description;
+	return pipeline_description != NULL ? pipeline_description : "";
 }
 
 static void new_pad_cb(GstElement *element, GstPad *pad, gpointer data) {
@@ -400,18 +974,717 @@ void for_each_pipeline_element(gpointer value_data, gpointer data) {
 	g_signal_connect(element, "pad-added", G_CALLBACK(new_pad_cb), NULL);
 }
 
-gboolean gstreamer_run_pipeline(GMainLoop *loop, const char *s, StartupState state) {
+/*
+ * Buffer probe on the sink pad of the video sink, used to time the arrival of
+ * the first buffer. When the video sink can't be determined directly (pipelines
+ * other than playbin), all sinks get a probe and the ones whose first buffer
+ * is not video just drop it.
+ */
+
+#if GST_CHECK_VERSION(1, 0, 0)
+
+static GstPadProbeReturn video_sink_buffer_probe_cb(GstPad *pad, GstPadProbeInfo *info,
+gpointer data) {
+	GstCaps *caps = gst_pad_get_current_caps(pad);
+	gboolean is_video = FALSE;
+	if (caps != NULL) {
+		if (gst_caps_get_size(caps) > 0)
+			is_video = g_str_has_prefix(gst_structure_get_name(
+				gst_caps_get_structure(caps, 0)), "video/");
+		gst_caps_unref(caps);
+	}
+	if (is_video)
+		bench_phase_end(BENCH_PHASE_FIRST_BUFFER);
+	return GST_PAD_PROBE_REMOVE;
+}
+
+static void add_video_sink_probe(GstElement *sink) {
+	GstPad *pad = gst_element_get_static_pad(sink, "sink");
+	if (pad == NULL)
+		return;
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, video_sink_buffer_probe_cb, NULL, NULL);
+	gst_object_unref(pad);
+}
+
+static void for_each_sink_element(const GValue *value, gpointer data) {
+	add_video_sink_probe(g_value_get_object(value));
+}
+
+static void install_video_sink_probe() {
+	if (using_playbin) {
+		GstElement *video_sink = NULL;
+		g_object_get(pipeline, "video-sink", &video_sink, NULL);
+		if (video_sink != NULL) {
+			add_video_sink_probe(video_sink);
+			gst_object_unref(video_sink);
+		}
+		return;
+	}
+	GstIterator *iterator = gst_bin_iterate_sinks(GST_BIN(pipeline));
+	gst_iterator_foreach(iterator, for_each_sink_element, NULL);
+	gst_iterator_free(iterator);
+}
+
+#else
+
+static void install_video_sink_probe() {
+}
+
+#endif
+
+/*
+ * Seek benchmark. A probe on the rendering video sink times the first buffer
+ * that arrives after the flush of the seek; buffers that were already on their
+ * way before the flush are ignored. The probe is removed from the main thread
+ * by gstreamer_bench_seek_end(), also when the seek never completes.
+ */
+
+#if GST_CHECK_VERSION(1, 0, 0)
+
+static gboolean seek_probe_flushed;
+static volatile gint seek_probe_fired;
+static GstPad *seek_probe_pad = NULL;
+static gulong seek_probe_id;
+
+static GstPadProbeReturn seek_bench_probe_cb(GstPad *pad, GstPadProbeInfo *info,
+gpointer data) {
+	if (g_atomic_int_get(&seek_probe_fired))
+		return GST_PAD_PROBE_OK;
+	if (info->type & GST_PAD_PROBE_TYPE_EVENT_FLUSH) {
+		if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_FLUSH_STOP)
+			seek_probe_flushed = TRUE;
+		return GST_PAD_PROBE_OK;
+	}
+	if (!seek_probe_flushed)
+		return GST_PAD_PROBE_OK;
+	bench_phase_end(BENCH_PHASE_FIRST_BUFFER);
+	g_atomic_int_set(&seek_probe_fired, TRUE);
+	return GST_PAD_PROBE_OK;
+}
+
+void gstreamer_bench_seek_end() {
+	if (seek_probe_pad == NULL)
+		return;
+	gst_pad_remove_probe(seek_probe_pad, seek_probe_id);
+	gst_object_unref(seek_probe_pad);
+	seek_probe_pad = NULL;
+}
+
+gboolean gstreamer_bench_seek(gint64 time_nanoseconds, SeekMode mode) {
+	gstreamer_bench_seek_end();
+	GstElement *sink = gstreamer_get_rendering_video_sink();
+	if (sink == NULL)
+		return FALSE;
+	GstPad *pad = gst_element_get_static_pad(sink, "sink");
+	gst_object_unref(sink);
+	if (pad == NULL)
+		return FALSE;
+	seek_probe_flushed = FALSE;
+	g_atomic_int_set(&seek_probe_fired, FALSE);
+	seek_probe_id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER |
+		GST_PAD_PROBE_TYPE_EVENT_FLUSH, seek_bench_probe_cb, NULL, NULL);
+	seek_probe_pad = pad;
+	gstreamer_set_seek_mode(mode);
+	bench_phase_begin(BENCH_PHASE_FIRST_BUFFER);
+	gstreamer_seek_to_time(time_nanoseconds);
+	gstreamer_set_seek_mode(SEEK_MODE_AUTO);
+	return TRUE;
+}
+
+#else
+
+void gstreamer_bench_seek_end() {
+}
+
+gboolean gstreamer_bench_seek(gint64 time_nanoseconds, SeekMode mode) {
+	return FALSE;
+}
+
+#endif
+
+/* Whether the seek has reached the video sink and the pipeline has prerolled again. */
+
+gboolean gstreamer_bench_seek_done() {
+	return bench_phase_ended(BENCH_PHASE_FIRST_BUFFER) && gst_element_get_state(pipeline,
+		NULL, NULL, 0) == GST_STATE_CHANGE_SUCCESS;
+}
+
+static void free_dynamic_link(gpointer data) {
+	DynamicLink *link = data;
+	g_free(link->src_element);
+	g_free(link->src_pad);
+	g_free(link->sink_element);
+	g_free(link->sink_pad);
+	g_free(link->media_class);
+	g_free(link);
+}
+
+static void free_cached_pipeline() {
+	if (cached_pipeline != NULL)
+		gst_object_unref(cached_pipeline);
+	cached_pipeline = NULL;
+	g_free(cached_pipeline_description);
+	cached_pipeline_description = NULL;
+	g_list_free_full(cached_dynamic_links, free_dynamic_link);
+	cached_dynamic_links = NULL;
+}
+
+/*
+ * The part of the media type of the caps of a pad before the '/', e.g. "video".
+ * Only the negotiated caps are used unless query is set. Returns NULL when
+ * unknown.
+ */
+
+static gchar *get_pad_media_class(GstPad *pad, gboolean query) {
+#if GST_CHECK_VERSION(1, 0, 0)
+	GstCaps *caps = gst_pad_get_current_caps(pad);
+	if (caps == NULL && query)
+		caps = gst_pad_query_caps(pad, NULL);
+#else
+	GstCaps *caps = gst_pad_get_negotiated_caps(pad);
+	if (caps == NULL && query)
+		caps = gst_pad_get_caps(pad);
+#endif
+	if (caps == NULL)
+		return NULL;
+	gchar *media_class = NULL;
+	if (!gst_caps_is_any(caps) && gst_caps_get_size(caps) > 0) {
+		const char *name = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+		media_class = g_strndup(name, strcspn(name, "/"));
+	}
+	gst_caps_unref(caps);
+	return media_class;
+}
+
+/*
+ * Relink a sometimes pad of a cached pipeline. The recorded link with the same
+ * pad name is tried first; since some elements number their pads differently
+ * on every run, any other unlinked recorded peer of the element is tried next.
+ * A pad is only linked into a branch of the same media type, since queues
+ * accept any caps.
+ */
+
+static gboolean relink_dynamic_pad(GstBin *bin, GstPad *pad, DynamicLink *link) {
+	if (link->media_class != NULL) {
+		gchar *media_class = get_pad_media_class(pad, TRUE);
+		gboolean match = media_class == NULL || strcmp(media_class, link->media_class) == 0;
+		g_free(media_class);
+		if (!match)
+			return FALSE;
+	}
+	GstElement *sink = gst_bin_get_by_name(bin, link->sink_element);
+	if (sink == NULL)
+		return FALSE;
+	gboolean linked = FALSE;
+	GstPad *sink_pad = gst_element_get_static_pad(sink, link->sink_pad);
+	if (sink_pad != NULL) {
+		if (!gst_pad_is_linked(sink_pad))
+			linked = !GST_PAD_LINK_FAILED(gst_pad_link(pad, sink_pad));
+		gst_object_unref(sink_pad);
+	}
+	gst_object_unref(sink);
+	return linked;
+}
+
+static void cached_pipeline_pad_added_cb(GstElement *element, GstPad *pad, gpointer data) {
+	GstBin *bin = data;
+	gchar *element_name = gst_element_get_name(element);
+	gchar *pad_name = gst_pad_get_name(pad);
+	gboolean linked = FALSE;
+	for (int pass = 0; pass < 2 && !linked; pass++)
+		for (GList *list = cached_dynamic_links; list != NULL && !linked;
+		list = g_list_next(list)) {
+			DynamicLink *link = list->data;
+			if (strcmp(link->src_element, element_name) != 0 ||
+			(strcmp(link->src_pad, pad_name) == 0) != (pass == 0))
+				continue;
+			linked = relink_dynamic_pad(bin, pad, link);
+		}
+	g_free(pad_name);
+	g_free(element_name);
+}
+
+/* Record the links of the sometimes pads of a top-level element. */
+
+static void record_dynamic_links(GstElement *element) {
+	gboolean connected = FALSE;
+	/* The handler may remain from an earlier time the pipeline was cached. */
+	g_signal_handlers_disconnect_by_func(element, cached_pipeline_pad_added_cb, pipeline);
+	GST_OBJECT_LOCK(element);
+	for (GList *list = GST_ELEMENT(element)->srcpads; list != NULL; list = g_list_next(list)) {
+		GstPad *pad = list->data;
+		GstPadTemplate *templ = GST_PAD_PAD_TEMPLATE(pad);
+		if (templ == NULL || GST_PAD_TEMPLATE_PRESENCE(templ) != GST_PAD_SOMETIMES)
+			continue;
+		GstPad *peer = gst_pad_get_peer(pad);
+		if (peer == NULL)
+			continue;
+		GstElement *peer_element = gst_pad_get_parent_element(peer);
+		if (peer_element != NULL) {
+			DynamicLink *link = g_new(DynamicLink, 1);
+			link->src_element = g_strdup(GST_ELEMENT_NAME(element));
+			link->src_pad = gst_pad_get_name(pad);
+			link->sink_element = gst_element_get_name(peer_element);
+			link->sink_pad = gst_pad_get_name(peer);
+			link->media_class = get_pad_media_class(pad, FALSE);
+			cached_dynamic_links = g_list_append(cached_dynamic_links, link);
+			gst_object_unref(peer_element);
+			if (!connected)
+				g_signal_connect(element, "pad-added",
+					G_CALLBACK(cached_pipeline_pad_added_cb), pipeline);
+			connected = TRUE;
+		}
+		gst_object_unref(peer);
+	}
+	GST_OBJECT_UNLOCK(element);
+}
+
+#if GST_CHECK_VERSION(1, 0, 0)
+static void for_each_element_record_dynamic_links(const GValue *value, gpointer data) {
+	record_dynamic_links(g_value_get_object(value));
+}
+#else
+static void for_each_element_record_dynamic_links(gpointer value_data, gpointer data) {
+	record_dynamic_links(value_data);
+	gst_object_unref(value_data);
+}
+#endif
+
+/* Move the (still running) pipeline into the cache. */
+
+static void cache_pipeline() {
+	free_cached_pipeline();
+	/* Built pipelines relink their sometimes pads themselves. */
+	if (!pipeline_built) {
+		GstIterator *iterator = gst_bin_iterate_elements(GST_BIN(pipeline));
+		gst_iterator_foreach(iterator, for_each_element_record_dynamic_links, NULL);
+		gst_iterator_free(iterator);
+	}
+	cached_pipeline = pipeline;
+	cached_pipeline_description = g_strdup(pipeline_description);
+	cached_elements = elements;
+	cached_pipeline_built = pipeline_built;
+}
+
+/*
+ * Pipeline builder. Elements are created with gst_element_factory_make and
+ * linked explicitly, so that no description has to be parsed and file names
+ * don't need escaping. The sometimes pads of the demuxer (or decodebin) are
+ * linked by a pad-added handler that stays connected, so a built pipeline can
+ * be brought up again from the NULL state as is.
+ */
+
+/*
+ * Create an element from a name optionally followed by property=value pairs.
+ * Descriptions with links or quoted values, such as user-supplied video sinks,
+ * are parsed into a bin with ghost pads instead.
+ */
+
+static GstElement *make_element_from_description(const char *description, const char *name,
+GError **error) {
+	if (strpbrk(description, "!\"'") != NULL) {
+		GstElement *bin = gst_parse_bin_from_description(description, TRUE, error);
+		if (bin != NULL && name != NULL)
+			gst_object_set_name(GST_OBJECT(bin), name);
+		return bin;
+	}
+	gchar **tokens = g_strsplit_set(description, " \t", - 1);
+	GstElement *element = NULL;
+	int i = 0;
+	while (tokens[i] != NULL && tokens[i][0] == '\0')
+		i++;
+	if (tokens[i] != NULL)
+		element = gst_element_factory_make(tokens[i], name);
+	if (element == NULL)
+		g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN,
+			"No element \"%s\"", tokens[i] != NULL ? tokens[i] : "");
+	else
+		for (i++; tokens[i] != NULL; i++) {
+			if (tokens[i][0] == '\0')
+				continue;
+			char *value = strchr(tokens[i], '=');
+			if (value != NULL)
+				*value++ = '\0';
+			if (value == NULL || g_object_class_find_property(
+			G_OBJECT_GET_CLASS(element), tokens[i]) == NULL) {
+				g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED,
+					"Invalid property \"%s\" in \"%s\"", tokens[i], description);
+				gst_object_unref(element);
+				element = NULL;
+				break;
+			}
+			gst_util_set_object_arg(G_OBJECT(element), tokens[i], value);
+		}
+	g_strfreev(tokens);
+	return element;
+}
+
+static gboolean add_element(GstElement *bin, GstElement **handle, const char *description,
+const char *name, GError **error) {
+	*handle = make_element_from_description(description, name, error);
+	if (*handle == NULL)
+		return FALSE;
+	gst_bin_add(GST_BIN(bin), *handle);
+	return TRUE;
+}
+
+/* Link a chain of n elements, skipping the NULL entries. */
+
+static gboolean link_chain(GError **error, int n, ...) {
+	va_list args;
+	va_start(args, n);
+	GstElement *src = NULL;
+	gboolean ok = TRUE;
+	for (int i = 0; i < n && ok; i++) {
+		GstElement *element = va_arg(args, GstElement *);
+		if (element == NULL)
+			continue;
+		if (src != NULL && !gst_element_link(src, element)) {
+			g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION,
+				"Could not link %s to %s", GST_ELEMENT_NAME(src),
+				GST_ELEMENT_NAME(element));
+			ok = FALSE;
+		}
+		src = element;
+	}
+	va_end(args);
+	return ok;
+}
+
+/* Returns "video" or "audio" for the sometimes pads that are linked, NULL otherwise. */
+
+static const char *get_pad_media_type(GstPad *pad) {
+	const char *type = NULL;
+	GstCaps *caps = gst_pad_get_current_caps(pad);
+	if (caps == NULL)
+		caps = gst_pad_query_caps(pad, NULL);
+	if (caps != NULL && gst_caps_get_size(caps) > 0) {
+		const char *name = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+		if (g_str_has_prefix(name, "video/"))
+			type = "video";
+		else if (g_str_has_prefix(name, "audio/"))
+			type = "audio";
+	}
+	if (caps != NULL)
+		gst_caps_unref(caps);
+	if (type == NULL) {
+		/* Fall back to the naming convention of demuxers. */
+		gchar *pad_name = gst_pad_get_name(pad);
+		if (g_str_has_prefix(pad_name, "video"))
+			type = "video";
+		else if (g_str_has_prefix(pad_name, "audio"))
+			type = "audio";
+		g_free(pad_name);
+	}
+	return type;
+}
+
+/*
+ * Link a new demuxer pad to the queue at the head of the video or audio branch.
+ * The branches are looked up by name so that the handler keeps working for a
+ * cached pipeline. Additional streams of the same type are left unlinked.
+ */
+
+static void demuxer_pad_added_cb(GstElement *demuxer, GstPad *pad, gpointer data) {
+	GstBin *bin = data;
+	const char *type = get_pad_media_type(pad);
+	if (type == NULL)
+		return;
+	char *queue_name = g_strdup_printf("%s-queue", type);
+	GstElement *queue = gst_bin_get_by_name(bin, queue_name);
+	g_free(queue_name);
+	if (queue == NULL)
+		return;
+	GstPad *sink_pad = gst_element_get_static_pad(queue, "sink");
+	if (!gst_pad_is_linked(sink_pad) && GST_PAD_LINK_FAILED(gst_pad_link(pad, sink_pad)))
+		printf("gstplay: Could not link the %s stream of the demuxer.\n", type);
+	gst_object_unref(sink_pad);
+	gst_object_unref(queue);
+}
+
+static GstElement *make_source(const PipelineSpec *spec, GError **error) {
+	GstElement *source;
+	if (spec->location != NULL) {
+		source = gst_element_factory_make(gstreamer_get_file_source_element(), "source");
+		if (source != NULL)
+			/* No escaping is needed when the property is set directly. */
+			g_object_set(source, "location", spec->location, NULL);
+	}
+	else {
+#if GST_CHECK_VERSION(1, 0, 0)
+		source = gst_element_make_from_uri(GST_URI_SRC, spec->uri, "source", error);
+		if (source != NULL || (error != NULL && *error != NULL))
+			return source;
+#else
+		source = gst_element_make_from_uri(GST_URI_SRC, spec->uri, "source");
+#endif
+	}
+	if (source == NULL)
+		g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN,
+			"No source element for %s", spec->uri);
+	return source;
+}
+
+static GstElement *build_playbin(const PipelineSpec *spec, GError **error) {
+	GstElement *playbin = gst_element_factory_make(PLAYBIN_STR, "playbin");
+	if (playbin == NULL) {
+		g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_MISSING_PLUGIN,
+			"No element \"" PLAYBIN_STR "\"");
+		return NULL;
+	}
+	elements.video_sink = make_element_from_description(spec->video_sink, NULL, error);
+	if (elements.video_sink != NULL)
+		elements.audio_sink = make_element_from_description(spec->audio_sink, NULL, error);
+	if (elements.audio_sink == NULL) {
+		if (elements.video_sink != NULL)
+			gst_object_unref(elements.video_sink);
+		gst_object_unref(playbin);
+		return NULL;
+	}
+	/* Playbin takes ownership of the sinks. */
+	g_object_set(playbin, "uri", spec->uri, "flags", spec->playbin_flags,
+		"video-sink", elements.video_sink, "audio-sink", elements.audio_sink, NULL);
+	return playbin;
+}
+
+static GstElement *build_pipeline(const PipelineSpec *spec, GError **error) {
+	memset(&elements, 0, sizeof(elements));
+	if (spec->type == PIPELINE_PLAYBIN)
+		return build_playbin(spec, error);
+	GstElement *bin = gst_pipeline_new("pipeline");
+	elements.source = make_source(spec, error);
+	if (elements.source == NULL)
+		goto error;
+	gst_bin_add(GST_BIN(bin), elements.source);
+	if (!add_element(bin, &elements.demuxer, spec->demuxer, "demuxer", error) ||
+	!add_element(bin, &elements.video_queue, "queue", "video-queue", error) ||
+	(spec->parser != NULL &&
+	!add_element(bin, &elements.parser, spec->parser, "parser", error)) ||
+	(spec->decoder != NULL &&
+	!add_element(bin, &elements.decoder, spec->decoder, "decoder", error)) ||
+	(spec->queue_after_decoder &&
+	!add_element(bin, &elements.decoder_queue, "queue", "decoder-queue", error)) ||
+	!add_element(bin, &elements.video_sink, spec->video_sink, "videosink", error))
+		goto error;
+	if (!link_chain(error, 2, elements.source, elements.demuxer) ||
+	!link_chain(error, 5, elements.video_queue, elements.parser, elements.decoder,
+	elements.decoder_queue, elements.video_sink))
+		goto error;
+	if (spec->audio_sink != NULL) {
+		if (!add_element(bin, &elements.audio_queue, "queue", "audio-queue", error) ||
+		!add_element(bin, &elements.audio_convert, "audioconvert", "audioconvert", error) ||
+		!add_element(bin, &elements.audio_resample, "audioresample", "audioresample",
+		error) ||
+		!add_element(bin, &elements.audio_sink, spec->audio_sink, "audiosink", error))
+			goto error;
+		if (!link_chain(error, 4, elements.audio_queue, elements.audio_convert,
+		elements.audio_resample, elements.audio_sink))
+			goto error;
+	}
+	g_signal_connect(elements.demuxer, "pad-added", G_CALLBACK(demuxer_pad_added_cb), bin);
+	return bin;
+
+error :
+	gst_object_unref(bin);
+	memset(&elements, 0, sizeof(elements));
+	return NULL;
+}
+
+/*
+ * Decoder threading. The setting of the pipeline spec is applied to every
+ * video decoder with a max-threads or thread-type property, including those
+ * that playbin and decodebin plug in while the stream is being set up, unless
+ * the decoder description sets the property itself.
+ */
+
+#define MAX_THREADS_SET_KEY "gstplay-max-threads-set"
+#define THREAD_TYPE_SET_KEY "gstplay-thread-type-set"
+
+static int decoder_max_threads;
+static DecoderThreadType decoder_thread_type;
+/* Description of the threading of the last configured decoder. */
+static gchar *decoder_threading_str = NULL;
+G_LOCK_DEFINE_STATIC(decoder_threading);
+
+/* A property may be set when it is at its default or was set by us before. */
+
+static gboolean property_may_be_set(GObject *object, GParamSpec *pspec, const char *key) {
+	if (g_object_get_data(object, key) != NULL)
+		return TRUE;
+	GValue value = G_VALUE_INIT;
+	g_value_init(&value, G_PARAM_SPEC_VALUE_TYPE(pspec));
+	g_object_get_property(object, pspec->name, &value);
+	gboolean is_default = g_param_value_defaults(pspec, &value);
+	g_value_unset(&value);
+	return is_default;
+}
+
+static void apply_decoder_threading(GstElement *element) {
+#if GST_CHECK_VERSION(1, 0, 0)
+	const char *klass = gst_element_class_get_metadata(GST_ELEMENT_GET_CLASS(element),
+		GST_ELEMENT_METADATA_KLASS);
+#else
+	const char *klass = GST_ELEMENT_GET_CLASS(element)->details.klass;
+#endif
+	if (klass == NULL || strstr(klass, "Decoder/Video") == NULL)
+		return;
+	GObject *object = G_OBJECT(element);
+	GParamSpec *max_threads = g_object_class_find_property(G_OBJECT_GET_CLASS(object),
+		"max-threads");
+	GParamSpec *thread_type = g_object_class_find_property(G_OBJECT_GET_CLASS(object),
+		"thread-type");
+	if (max_threads != NULL && G_PARAM_SPEC_VALUE_TYPE(max_threads) != G_TYPE_INT)
+		max_threads = NULL;
+	if (thread_type != NULL && !G_IS_PARAM_SPEC_FLAGS(thread_type))
+		thread_type = NULL;
+	if (max_threads == NULL && thread_type == NULL)
+		return;
+	if (max_threads != NULL && property_may_be_set(object, max_threads, MAX_THREADS_SET_KEY)) {
+		g_object_set(object, "max-threads", decoder_max_threads, NULL);
+		g_object_set_data(object, MAX_THREADS_SET_KEY, GINT_TO_POINTER(1));
+	}
+	if (thread_type != NULL && property_may_be_set(object, thread_type, THREAD_TYPE_SET_KEY)) {
+		/* The libav flags: 0 is automatic, 1 frame and 2 slice threading. */
+		g_object_set(object, "thread-type", (guint)decoder_thread_type, NULL);
+		g_object_set_data(object, THREAD_TYPE_SET_KEY, GINT_TO_POINTER(1));
+	}
+
+	/* Describe the resulting setting. */
+	int threads = 0;
+	guint type = 0;
+	if (max_threads != NULL)
+		g_object_get(object, "max-threads", &threads, NULL);
+	if (thread_type != NULL)
+		g_object_get(object, "thread-type", &type, NULL);
+	char threads_str[16];
+	if (max_threads == NULL)
+		strcpy(threads_str, "n/a");
+	else if (threads == 0)
+		strcpy(threads_str, "auto");
+	else
+		sprintf(threads_str, "%d", threads);
+	const char *type_str = thread_type == NULL ? "n/a" : (type == 0 ? "auto" :
+		(type == 1 ? "frame" : (type == 2 ? "slice" : "frame+slice")));
+	gchar *s = g_strdup_printf("%s, max-threads %s, thread-type %s",
+		GST_ELEMENT_NAME(element), threads_str, type_str);
+	G_LOCK(decoder_threading);
+	g_free(decoder_threading_str);
+	decoder_threading_str = s;
+	G_UNLOCK(decoder_threading);
+}
+
+#if GST_CHECK_VERSION(1, 0, 0)
+static void for_each_element_apply_decoder_threading(const GValue *value, gpointer data) {
+	apply_decoder_threading(g_value_get_object(value));
+}
+#else
+static void for_each_element_apply_decoder_threading(gpointer value_data, gpointer data) {
+	apply_decoder_threading(value_data);
+	gst_object_unref(value_data);
+}
+#endif
+
+#if GST_CHECK_VERSION(1, 10, 0)
+/* Called from a streaming thread when playbin or decodebin plugs in an element. */
+
+static void deep_element_added_cb(GstBin *bin, GstBin *sub_bin, GstElement *element,
+gpointer data) {
+	apply_decoder_threading(element);
+}
+#endif
+
+static void setup_decoder_threading(const PipelineSpec *spec, gboolean reused) {
+	decoder_max_threads = spec->decoder_max_threads;
+	decoder_thread_type = spec->decoder_thread_type;
+	G_LOCK(decoder_threading);
+	g_free(decoder_threading_str);
+	decoder_threading_str = NULL;
+	G_UNLOCK(decoder_threading);
+	GstIterator *iterator = gst_bin_iterate_recurse(GST_BIN(pipeline));
+	gst_iterator_foreach(iterator, for_each_element_apply_decoder_threading, NULL);
+	gst_iterator_free(iterator);
+#if GST_CHECK_VERSION(1, 10, 0)
+	if (!reused)
+		g_signal_connect(pipeline, "deep-element-added",
+			G_CALLBACK(deep_element_added_cb), NULL);
+#endif
+}
+
+gchar *gstreamer_get_decoder_threading_str() {
+	if (gstreamer_no_pipeline())
+		return NULL;
+	char threads_str[16];
+	if (decoder_max_threads == 0)
+		strcpy(threads_str, "auto");
+	else
+		sprintf(threads_str, "%d", decoder_max_threads);
+	G_LOCK(decoder_threading);
+	gchar *s = g_strdup_printf(
+		"Decoder threading setting:      max-threads %s, thread-type %s\n"
+		"Active decoder threading:       %s",
+		threads_str, decode_path_get_thread_type_name(decoder_thread_type),
+		decoder_threading_str != NULL ? decoder_threading_str : "no threaded decoder");
+	G_UNLOCK(decoder_threading);
+	return s;
+}
+
+/*
+ * Keep the pitch of the audio at playback rates other than 1.0 with a
+ * scaletempo filter in playbin; it is only needed in the interactive player.
+ */
+
+static void setup_audio_tempo() {
+	have_scaletempo = FALSE;
+#if GST_CHECK_VERSION(1, 0, 0)
+	if (!using_playbin || !main_have_gui())
+		return;
+	GstElement *scaletempo = gst_element_factory_make("scaletempo", NULL);
+	if (scaletempo == NULL)
+		return;
+	g_object_set(pipeline, "audio-filter", scaletempo, NULL);
+	have_scaletempo = TRUE;
+#endif
+}
+
+static char *get_playbin_setup(const PipelineSpec *spec) {
+	return g_strdup_printf("%s|%s|%d", spec->video_sink, spec->audio_sink,
+		spec->playbin_flags);
+}
+
+gboolean gstreamer_run_pipeline(GMainLoop *loop, const PipelineSpec *spec,
+StartupState state) {
 	main_set_real_time_scheduling_policy();
 
 	GError *error = NULL;
-	pipeline = gst_parse_launch(s, &error);
+	gboolean reused = FALSE;
+	bench_phase_begin(BENCH_PHASE_PARSE_LAUNCH);
+	if (cached_pipeline != NULL && strcmp(spec->description, cached_pipeline_description) == 0) {
+		/* Restart of a suspended pipeline; reuse its elements. */
+		pipeline = cached_pipeline;
+		cached_pipeline = NULL;
+		elements = cached_elements;
+		pipeline_built = cached_pipeline_built;
+		reused = TRUE;
+	}
+	else {
+		free_cached_pipeline();
+		pipeline_built = spec->type != PIPELINE_DESCRIPTION;
+		if (pipeline_built)
+			pipeline = build_pipeline(spec, &error);
+		else {
+			memset(&elements, 0, sizeof(elements));
+			pipeline = gst_parse_launch(spec->description, &error);
+		}
+	}
+	bench_phase_end(BENCH_PHASE_PARSE_LAUNCH);
 	if (!pipeline) {
 		printf("Error: Could not create gstreamer pipeline.\n");
-		printf("Parse error: %s\n", error->message);
+		printf("Error: %s\n", error != NULL ? error->message : "unknown");
+		if (error != NULL)
+			g_error_free(error);
 		return FALSE;
 	}
 
-	bus_quit_on_playing = FALSE;
 	GstBus *bus;
 	bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
 	bus_watch_id = gst_bus_add_watch(bus, bus_callback, loop);
@@ -429,23 +1702,44 @@ gboolean gstreamer_run_pipeline(GMainLoop *loop, const char *s, StartupState sta
 		g_list_free(created_pads_list);
 		created_pads_list = NULL;
 	}
-	GstIterator *iterator = gst_bin_iterate_elements(GST_BIN(pipeline));
-	gst_iterator_foreach(iterator, for_each_pipeline_element, NULL);
-	gst_iterator_free(iterator);
+	if (!reused) {
+		GstIterator *iterator = gst_bin_iterate_elements(GST_BIN(pipeline));
+		gst_iterator_foreach(iterator, for_each_pipeline_element, NULL);
+		gst_iterator_free(iterator);
+	}
+
+	setup_decoder_threading(spec, reused);
+	if (!reused)
+		setup_audio_tempo();
+	muted_for_speed = FALSE;
+	displayed_fps = - 1.0;
+	last_rendered_frames_time = 0;
 
 	stats_reset();
+	governor_start(pipeline);
+
+	install_video_sink_probe();
 
+	bench_phase_begin(BENCH_PHASE_READY);
 	gst_element_set_state(pipeline, GST_STATE_READY);
+	bench_phase_end(BENCH_PHASE_READY);
 
 	state_change_to_playing_already_occurred = FALSE;
+	first_preroll_already_occurred = FALSE;
 
+	bench_phase_begin(BENCH_PHASE_PREROLL);
 	if (state == STARTUP_PLAYING)
 		gst_element_set_state(pipeline, GST_STATE_PLAYING);
 	else
 		gst_element_set_state(pipeline, GST_STATE_PAUSED);
 
-	pipeline_description = s;
+	g_free(pipeline_description);
+	pipeline_description = g_strdup(spec->description);
+	g_free(playbin_setup);
+	playbin_setup = spec->type == PIPELINE_PLAYBIN ? get_playbin_setup(spec) : NULL;
 	end_of_stream = FALSE;
+	key_units_only = FALSE;
+	uri_switched = FALSE;
 
 	inform_pipeline_destroyed_cb_list = NULL;
 	return TRUE;
@@ -453,6 +1747,14 @@ gboolean gstreamer_run_pipeline(GMainLoop *loop, const char *s, StartupState sta
 
 void gstreamer_destroy_pipeline() {
 	main_set_normal_scheduling_policy();
+	governor_stop();
+	reverse_playback_stop();
+	frame_ring_detach();
+	detach_position_probe();
+	cached_duration = - 1;
+	seek_when_prerolled = FALSE;
+	scrubbing = FALSE;
+	step_back_target = - 1;
 
 	GstState state, pending;
 	gst_element_set_state (pipeline, GST_STATE_PAUSED);
@@ -461,14 +1763,35 @@ void gstreamer_destroy_pipeline() {
 	/* Iterate main loop to process pending stuff. */
 	while (g_main_context_iteration (NULL, FALSE));
 
+	if (cache_pipeline_on_destroy)
+		/* The dynamic links must be recorded while the sometimes pads still exist. */
+		cache_pipeline();
+
 	gst_element_set_state (pipeline, GST_STATE_READY);
 	gst_element_get_state (pipeline, &state, &pending, GST_CLOCK_TIME_NONE);
 
 	gst_element_set_state(pipeline, GST_STATE_NULL);
 
 	g_source_remove(bus_watch_id);
-	gst_object_unref(GST_OBJECT(pipeline));
-	pipeline_description = "";
+	if (cache_pipeline_on_destroy) {
+		GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+#if GST_CHECK_VERSION(1, 0, 0)
+		gst_bus_set_sync_handler(bus, NULL, NULL, NULL);
+#else
+		gst_bus_set_sync_handler(bus, NULL, NULL);
+#endif
+		gst_object_unref(bus);
+		cache_pipeline_on_destroy = FALSE;
+	}
+	else {
+		gst_object_unref(GST_OBJECT(pipeline));
+		free_cached_pipeline();
+	}
+	g_free(pipeline_description);
+	pipeline_description = NULL;
+	g_free(playbin_setup);
+	playbin_setup = NULL;
+	memset(&elements, 0, sizeof(elements));
 
 	GList *list = g_list_first(inform_pipeline_destroyed_cb_list);
 	GValue value = G_VALUE_INIT;
@@ -483,9 +1806,66 @@ void gstreamer_destroy_pipeline() {
 	g_value_unset(&value);
 	g_list_free(inform_pipeline_destroyed_cb_list);
 
-	stats_reset();
+	stats_reset();
+
+	gui_set_window_title("gstplay");
+}
+
+/*
+ * Switch a running playbin to the uri of the spec. The playbin only drops to
+ * READY, so the sinks, the window binding of the video sink, the color
+ * balance and the statistics are kept. Returns FALSE when the spec needs a
+ * different pipeline (not playbin, or other sinks or flags); the caller then
+ * destroys the pipeline and runs a new one.
+ */
+
+gboolean gstreamer_switch_uri(const PipelineSpec *spec, StartupState state) {
+	if (gstreamer_no_pipeline() || playbin_setup == NULL || spec->type != PIPELINE_PLAYBIN)
+		return FALSE;
+	char *setup = get_playbin_setup(spec);
+	gboolean same_setup = strcmp(setup, playbin_setup) == 0;
+	g_free(setup);
+	if (!same_setup)
+		return FALSE;
 
-	gui_set_window_title("gstplay");
+	reverse_playback_stop();
+	frame_ring_detach();
+	detach_position_probe();
+	cached_duration = - 1;
+	step_back_target = - 1;
+	/* A pending seek back or scrub belongs to the previous stream. */
+	seek_when_prerolled = FALSE;
+	scrubbing = FALSE;
+	scrub_seek_in_flight = FALSE;
+	scrub_pending_target = - 1;
+	reverse_after_scrub = FALSE;
+	bench_phase_begin(BENCH_PHASE_READY);
+	gst_element_set_state(pipeline, GST_STATE_READY);
+	bench_phase_end(BENCH_PHASE_READY);
+	g_object_set(pipeline, "uri", spec->uri, NULL);
+
+	/* The pads of the previous stream are gone. */
+	g_list_free(created_pads_list);
+	created_pads_list = NULL;
+	g_free(pipeline_description);
+	pipeline_description = g_strdup(spec->description);
+	end_of_stream = FALSE;
+	key_units_only = FALSE;
+	playback_rate = 1.0;
+	set_speed_mute(FALSE);
+	first_preroll_already_occurred = FALSE;
+	/* Let the GUI reset the status bar when the new stream starts playing. */
+	state_change_to_playing_already_occurred = FALSE;
+	uri_switched = TRUE;
+	governor_start(pipeline);
+	install_video_sink_probe();
+
+	bench_phase_begin(BENCH_PHASE_PREROLL);
+	if (state == STARTUP_PLAYING)
+		gst_element_set_state(pipeline, GST_STATE_PLAYING);
+	else
+		gst_element_set_state(pipeline, GST_STATE_PAUSED);
+	return TRUE;
 }
 
 void gstreamer_add_pipeline_destroyed_cb(GCallback cb_func, gpointer user_data) {
@@ -497,11 +1877,30 @@ void gstreamer_add_pipeline_destroyed_cb(GCallback cb_func, gpointer user_data)
 
 gboolean gstreamer_play() {
 	main_set_real_time_scheduling_policy();
+	if (reverse_playback_active()) {
+		reverse_paused = FALSE;
+		reverse_playback_set_paused(FALSE);
+		return TRUE;
+	}
+	/* Continue from an older frame shown from the frame ring. */
+	gint64 offset = frame_ring_get_displayed_offset();
+	if (offset > 0) {
+		gboolean error;
+		gint64 pos = gstreamer_get_position(&error);
+		if (!error)
+			gst_element_seek_simple(pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH |
+				GST_SEEK_FLAG_ACCURATE, MAX(pos - offset, 0));
+	}
 	return gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_ASYNC;
 }
 
 gboolean gstreamer_pause() {
 	main_set_normal_scheduling_policy();
+	if (reverse_playback_active()) {
+		reverse_paused = TRUE;
+		reverse_playback_set_paused(TRUE);
+		return TRUE;
+	}
 	return gst_element_set_state(pipeline, GST_STATE_PAUSED) != GST_STATE_CHANGE_ASYNC;
 }
 
@@ -517,37 +1916,37 @@ gboolean gstreamer_state_is_playing() {
 }
 
 gint64 gstreamer_get_position(gboolean *error) {
-	gint64 pos, len;
+	gint64 pos;
 
+	if (reverse_playback_active()) {
+		if (error != NULL)
+			*error = FALSE;
+		return reverse_playback_get_position();
+	}
 	if (end_of_stream) {
-#if GST_CHECK_VERSION(1, 0, 0)
-		if (gst_element_query_duration(pipeline, GST_FORMAT_TIME, &len)) {
-#else
-		GstFormat format = GST_FORMAT_TIME;
-		if (gst_element_query_duration(pipeline, &format, &len)) {
-#endif
-			if (error != NULL)
-				*error = FALSE;
-			return len;
-		}
+		gint64 duration = gstreamer_get_duration();
 		if (error != NULL)
-			*error = TRUE;
-		return 0;
+			*error = duration == 0;
+		return duration;
+	}
+
+	/* The timestamp seen at the video sink avoids a query through the pipeline. */
+	pos = __atomic_load_n(&sink_position, __ATOMIC_RELAXED);
+	if (pos >= 0) {
+		if (error != NULL)
+			*error = FALSE;
+		return pos;
 	}
 
 #if GST_CHECK_VERSION(1, 0, 0)
 	if (gst_element_query_position(pipeline, GST_FORMAT_TIME, &pos)) {
-		if (gst_element_query_duration (pipeline, GST_FORMAT_TIME, &len)) {
 #else
 	GstFormat format = GST_FORMAT_TIME;
 	if (gst_element_query_position(pipeline, &format, &pos)) {
-		GstFormat format2 = GST_FORMAT_TIME;
-		if (gst_element_query_duration(pipeline, &format2, &len)) {
 #endif
-			if (error != NULL)
-				*error = FALSE;
-			return pos;
-		}
+		if (error != NULL)
+			*error = FALSE;
+		return pos;
 	}
 //	printf("gstplay: Could not succesfully query current position.\n");
 	if (error != NULL)
@@ -555,7 +1954,7 @@ gint64 gstreamer_get_position(gboolean *error) {
 	return 0;
 }
 
-gint64 gstreamer_get_duration() {
+static void update_cached_duration() {
 	GstQuery *query;
 	gboolean res;
 	query = gst_query_new_duration (GST_FORMAT_TIME);
@@ -563,30 +1962,72 @@ gint64 gstreamer_get_duration() {
 	gint64 duration;
 	if (res) {
 		gst_query_parse_duration(query, NULL, &duration);
+		cached_duration = duration > 0 ? duration : - 1;
 	}
-	else
-		duration = 0;
 	gst_query_unref (query);
-	return duration;
 }
 
+/* The duration is queried once and then cached until the pipeline reports a change. */
+
+gint64 gstreamer_get_duration() {
+	if (cached_duration < 0)
+		update_cached_duration();
+	return cached_duration < 0 ? 0 : cached_duration;
+}
+
+/* Returns a static string that is valid until the next call. */
+
 const gchar *gstreamer_get_duration_str() {
+	static char s[32];
 	gint64 duration = gstreamer_get_duration();
-	char s[80];
 	sprintf(s, "%u:%02u:%02u", GST_TIME_ARGS(duration));
-	return strdup(s);
+	return s;
 }
 
-static gboolean seek_to_time_cb(gpointer data) {
-	gstreamer_seek_to_time(requested_position);
-	gstreamer_set_volume(suspended_audio_volume);
-	return FALSE;
+/* Extra seek flags for the trick mode that is in effect. */
+
+static GstSeekFlags get_trick_mode_seek_flags() {
+#if GST_CHECK_VERSION(1, 6, 0)
+	if (key_units_only)
+		return GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS;
+#endif
+	return 0;
+}
+
+/*
+ * With a keyframe index, seek accurately when few frames have to be decoded
+ * from the preceding keyframe, otherwise seek to the nearest keyframe rather
+ * than the preceding one.
+ */
+
+#define MAX_ACCURATE_SEEK_FRAMES 30
+
+static SeekMode seek_mode = SEEK_MODE_AUTO;
+
+void gstreamer_set_seek_mode(SeekMode mode) {
+	seek_mode = mode;
 }
 
 void gstreamer_seek_to_time(gint64 time_nanoseconds) {
 	end_of_stream = FALSE;
+	if (reverse_playback_active()) {
+		reverse_playback_stop();
+		if (start_reverse_playback(time_nanoseconds))
+			return;
+	}
+	GstSeekFlags flags = GST_SEEK_FLAG_FLUSH | (seek_mode == SEEK_MODE_ACCURATE ?
+		GST_SEEK_FLAG_ACCURATE : GST_SEEK_FLAG_KEY_UNIT);
+	double framerate;
+	if (seek_mode == SEEK_MODE_AUTO && !key_units_only && playback_rate == 1.0 &&
+	keyframe_index_ready() && get_framerate(&framerate)) {
+		int cost = keyframe_index_estimate_accurate_seek_cost(time_nanoseconds, framerate);
+		if (cost >= 0 && cost <= MAX_ACCURATE_SEEK_FRAMES)
+			flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE;
+		else
+			time_nanoseconds = keyframe_index_snap(time_nanoseconds);
+	}
 	if (!gst_element_seek_simple(pipeline, GST_FORMAT_TIME,
-	GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, time_nanoseconds)) {
+	flags | get_trick_mode_seek_flags(), time_nanoseconds)) {
 		printf("gstplay: Seek failed!.n");
 	}
 }
@@ -596,7 +2037,7 @@ gboolean gstreamer_end_of_stream() {
 }
 
 gboolean gstreamer_no_pipeline() {
-	return strlen(pipeline_description) == 0;
+	return pipeline_description == NULL;
 }
 
 gboolean gstreamer_no_video() {
@@ -621,6 +2062,7 @@ void gstreamer_suspend_pipeline() {
 	suspended_state = gstreamer_get_state();
 	suspended_audio_volume = gstreamer_get_volume();
 	gstreamer_pause();
+	cache_pipeline_on_destroy = TRUE;
 	gstreamer_destroy_pipeline();
 }
 
@@ -634,15 +2076,106 @@ void gstreamer_restart_pipeline() {
 	const char *uri;
 	const char *video_title_filename;
 	main_get_current_uri(&uri, &video_title_filename);
-	const char *pipeline_str = main_create_pipeline(uri, video_title_filename);
-	StartupState startup;
-	if (suspended_state == GST_STATE_PLAYING)
-		startup = STARTUP_PLAYING;
-	else
-		startup = STARTUP_PAUSED;
-	gstreamer_run_pipeline(main_get_main_loop(), pipeline_str, startup);
+	const PipelineSpec *spec = main_create_pipeline(uri, video_title_filename);
+	/* Start paused so that playback resumes at the saved position. */
+	if (!gstreamer_run_pipeline(main_get_main_loop(), spec, STARTUP_PAUSED))
+		return;
 	requested_position = suspended_pos;
-	g_timeout_add_seconds(1, seek_to_time_cb, NULL);
+	state_after_seek = suspended_state;
+	seek_when_prerolled = TRUE;
+}
+
+/*
+ * Called when the pipeline has prerolled after a restart or reconfiguration:
+ * seek accurately to the saved position and resume playback.
+ */
+
+static void restore_position() {
+	seek_when_prerolled = FALSE;
+	end_of_stream = FALSE;
+	// The playback speed and the trick mode carry over to the new pipeline.
+	gdouble rate = playback_rate > 0 ? playback_rate : 1.0;
+	GstSeekFlags flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE |
+		get_trick_mode_seek_flags();
+	if (playback_rate > 0)
+		flags |= get_speed_seek_flags();
+	if (!gst_element_seek(pipeline, rate, GST_FORMAT_TIME, flags,
+	GST_SEEK_TYPE_SET, requested_position, GST_SEEK_TYPE_NONE, 0))
+		printf("gstplay: Seek failed!.n");
+	if (using_playbin)
+		gstreamer_set_volume(suspended_audio_volume);
+	set_speed_mute(playback_rate > MAX_FULL_DECODE_RATE);
+	if (playback_rate < 0) {
+		reverse_paused = state_after_seek != GST_STATE_PLAYING;
+		if (start_reverse_playback(requested_position))
+			return;
+		playback_rate = 1.0;
+	}
+	if (state_after_seek == GST_STATE_PLAYING)
+		gstreamer_play();
+}
+
+/*
+ * Apply changed settings to a running playbin without recreating it. The
+ * playbin drops to READY, gets the new sinks and flags, and is brought up
+ * again; when it has prerolled, it seeks back to the position it was at.
+ * Returns FALSE when the pipeline is not a playbin, in which case the caller
+ * suspends and restarts the pipeline.
+ */
+
+gboolean gstreamer_reconfigure_pipeline(const PipelineSpec *spec) {
+	/* The settings are in the configuration; the next pipeline is built with them. */
+	if (gstreamer_no_pipeline())
+		return TRUE;
+	if (playbin_setup == NULL || spec->type != PIPELINE_PLAYBIN)
+		return FALSE;
+	GError *error = NULL;
+	GstElement *video_sink = make_element_from_description(spec->video_sink, NULL, &error);
+	GstElement *audio_sink = NULL;
+	if (video_sink != NULL)
+		audio_sink = make_element_from_description(spec->audio_sink, NULL, &error);
+	if (audio_sink == NULL) {
+		printf("gstplay: Could not create sink: %s\n",
+			error != NULL ? error->message : "unknown");
+		if (error != NULL)
+			g_error_free(error);
+		if (video_sink != NULL)
+			gst_object_unref(video_sink);
+		return FALSE;
+	}
+
+	gboolean error_pos;
+	requested_position = gstreamer_get_position(&error_pos);
+	if (error_pos)
+		requested_position = 0;
+	state_after_seek = gstreamer_get_state();
+	suspended_audio_volume = gstreamer_get_volume();
+
+	if (reverse_playback_active())
+		requested_position = reverse_playback_stop();
+	frame_ring_detach();
+	detach_position_probe();
+	step_back_target = - 1;
+	gst_element_set_state(pipeline, GST_STATE_READY);
+	/* The old video sink goes away; the new one reports its own overlay. */
+	video_window_overlay = NULL;
+	g_object_set(pipeline, "flags", spec->playbin_flags, "video-sink", video_sink,
+		"audio-sink", audio_sink, NULL);
+	elements.video_sink = video_sink;
+	elements.audio_sink = audio_sink;
+	g_free(playbin_setup);
+	playbin_setup = get_playbin_setup(spec);
+	g_free(pipeline_description);
+	pipeline_description = g_strdup(spec->description);
+	/* The decoders are plugged in again and get the new threading setting. */
+	setup_decoder_threading(spec, TRUE);
+	g_list_free(created_pads_list);
+	created_pads_list = NULL;
+	/* Apply the color balance defaults to the new sink when it starts playing. */
+	state_change_to_playing_already_occurred = FALSE;
+	seek_when_prerolled = TRUE;
+	gst_element_set_state(pipeline, GST_STATE_PAUSED);
+	return TRUE;
 }
 
 void gstreamer_inform_playbin_used(gboolean status) {
@@ -918,16 +2451,128 @@ void gstreamer_refresh_frame() {
 
 // Trick mode functions.
 
-static gdouble playback_rate = 1.0;
-
-// Look up the video-sink property from playbin.
+// Look up the video sink, from the video-sink property for playbin.
 
 static GstElement *get_video_sink() {
-	GstElement *video_sink;
+	GstElement *video_sink = NULL;
+	if (!using_playbin) {
+		/* Built pipelines keep a handle to it. */
+		if (elements.video_sink != NULL)
+			video_sink = gst_object_ref(elements.video_sink);
+		return video_sink;
+	}
 	g_object_get(pipeline, "video-sink", &video_sink, NULL);
 	return video_sink;
 }
 
+/*
+ * Start the GOP-cached reverse playback engine (reverse.c) at the position.
+ * It shows its frames on the video sink of the paused pipeline.
+ */
+
+static gboolean start_reverse_playback(gint64 pos) {
+	const char *uri;
+	const char *video_title_filename;
+	double framerate;
+	main_get_current_uri(&uri, &video_title_filename);
+	if (uri == NULL || !get_framerate(&framerate))
+		return FALSE;
+	GstElement *sink = gstreamer_get_rendering_video_sink();
+	if (sink == NULL)
+		return FALSE;
+	gst_element_set_state(pipeline, GST_STATE_PAUSED);
+	gst_element_get_state(pipeline, NULL, NULL, GST_SECOND);
+	gboolean ok = reverse_playback_start(uri, sink, pos, - playback_rate, framerate);
+	gst_object_unref(sink);
+	if (ok && reverse_paused)
+		reverse_playback_set_paused(TRUE);
+	return ok;
+}
+
+/*
+ * Playback speed strategies. Up to MAX_FULL_DECODE_RATE every frame is
+ * decoded and scaletempo keeps the audio pitch. Faster, only keyframes are
+ * decoded and the audio is dropped and muted, so that the CPU load stays
+ * bounded instead of the sink dropping most of the decoded frames.
+ */
+
+static GstSeekFlags get_speed_seek_flags() {
+#if GST_CHECK_VERSION(1, 6, 0)
+	if (playback_rate > MAX_FULL_DECODE_RATE)
+		return GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS |
+			GST_SEEK_FLAG_TRICKMODE_NO_AUDIO;
+#endif
+	return 0;
+}
+
+// Mute playbin for fast playback, without unmuting audio that the user muted.
+
+static void set_speed_mute(gboolean status) {
+	if (!using_playbin || status == muted_for_speed)
+		return;
+	if (status) {
+		gboolean muted;
+		g_object_get(pipeline, "mute", &muted, NULL);
+		if (muted)
+			return;
+	}
+	g_object_set(pipeline, "mute", status, NULL);
+	muted_for_speed = status;
+}
+
+static const char *get_speed_strategy_str() {
+	if (reverse_playback_active())
+		return "reverse, GOP cache";
+	if (playback_rate > MAX_FULL_DECODE_RATE && get_speed_seek_flags() != 0)
+		return "keyframes only, audio muted";
+	if (key_units_only)
+		return "keyframes only (decode quality governor)";
+	if (playback_rate != 1.0 && have_scaletempo)
+		return "full decode, scaletempo";
+	return "full decode";
+}
+
+/*
+ * Playback speed statistics. The displayed frame rate is derived from the
+ * rendered frame count of the video sink, sampled at most once a second.
+ */
+
+gchar *gstreamer_get_playback_speed_str() {
+	if (gstreamer_no_pipeline())
+		return NULL;
+#if GST_CHECK_VERSION(1, 2, 0)
+	GstElement *sink = gstreamer_get_rendering_video_sink();
+	if (sink != NULL) {
+		GstStructure *stats = NULL;
+		guint64 rendered;
+		g_object_get(sink, "stats", &stats, NULL);
+		if (stats != NULL && gst_structure_get_uint64(stats, "rendered", &rendered)) {
+			gint64 t = g_get_monotonic_time();
+			if (last_rendered_frames_time != 0 && rendered >= last_rendered_frames &&
+			t - last_rendered_frames_time >= 1000000)
+				displayed_fps = (rendered - last_rendered_frames) * 1000000.0 /
+					(t - last_rendered_frames_time);
+			if (last_rendered_frames_time == 0 || t - last_rendered_frames_time >= 1000000) {
+				last_rendered_frames = rendered;
+				last_rendered_frames_time = t;
+			}
+		}
+		if (stats != NULL)
+			gst_structure_free(stats);
+		gst_object_unref(sink);
+	}
+#endif
+	GString *s = g_string_new("");
+	g_string_append_printf(s,
+		"Playback rate:                  %.2lfx\n"
+		"Speed strategy:                 %s",
+		playback_rate, get_speed_strategy_str());
+	if (displayed_fps >= 0)
+		g_string_append_printf(s,
+			"\nDisplayed frame rate:           %.1lf fps", displayed_fps);
+	return g_string_free(s, FALSE);
+}
+
 // Update the playback speed with a seek event.
 
 static void update_playback_speed() {
@@ -935,17 +2580,33 @@ static void update_playback_speed() {
 	gint64 pos = gstreamer_get_position(&error);
 	if (error)
 		return;
+	// Negative rates use the reverse playback engine where possible.
+	if (reverse_playback_active()) {
+		if (playback_rate < 0) {
+			reverse_playback_set_rate(- playback_rate);
+			return;
+		}
+		pos = reverse_playback_stop();
+		if (!reverse_paused)
+			gst_element_set_state(pipeline, GST_STATE_PLAYING);
+	}
+	else if (playback_rate < 0) {
+		reverse_paused = !gstreamer_state_is_playing();
+		if (start_reverse_playback(pos))
+			return;
+	}
 	GstElement *video_sink = get_video_sink();
 	if (!video_sink)
 		return;
+	set_speed_mute(playback_rate > MAX_FULL_DECODE_RATE);
 	GstEvent *seek_event;
+	GstSeekFlags flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE |
+		get_trick_mode_seek_flags() | get_speed_seek_flags();
 	if (playback_rate > 0)
-		seek_event = gst_event_new_seek(playback_rate, GST_FORMAT_TIME,
-			GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+		seek_event = gst_event_new_seek(playback_rate, GST_FORMAT_TIME, flags,
 			GST_SEEK_TYPE_SET, pos, GST_SEEK_TYPE_NONE, 0);
 	else
-		seek_event = gst_event_new_seek (playback_rate, GST_FORMAT_TIME,
-			GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+		seek_event = gst_event_new_seek (playback_rate, GST_FORMAT_TIME, flags,
 			GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_SET, pos);
 	gst_element_send_event (video_sink, seek_event);
 }
@@ -953,6 +2614,8 @@ static void update_playback_speed() {
 // Skip to the next frame when in PAUSED mode.
 
 void gstreamer_next_frame() {
+	if (frame_ring_step_forward())
+		return;
 	GstElement *video_sink = get_video_sink();
 	if (!video_sink)
 		return;
@@ -986,31 +2649,206 @@ static gboolean get_framerate(double *frameratep) {
 }
 
 
+#if GST_CHECK_VERSION(1, 0, 0)
+
+/*
+ * Return the element that actually renders the video, descending into sink
+ * bins such as autovideosink, or NULL. The caller owns the reference.
+ */
+
+gpointer gstreamer_get_rendering_video_sink() {
+	GstElement *element = get_video_sink();
+	while (element != NULL && GST_IS_BIN(element)) {
+		GstIterator *iterator = gst_bin_iterate_sinks(GST_BIN(element));
+		GValue value = G_VALUE_INIT;
+		GstElement *child = NULL;
+		if (gst_iterator_next(iterator, &value) == GST_ITERATOR_OK) {
+			child = g_value_dup_object(&value);
+			g_value_unset(&value);
+		}
+		gst_iterator_free(iterator);
+		gst_object_unref(element);
+		element = child;
+	}
+	if (element != NULL && !GST_IS_BASE_SINK(element)) {
+		gst_object_unref(element);
+		element = NULL;
+	}
+	return element;
+}
+
+/*
+ * Show a frame on a paused rendering sink without passing it through the
+ * pipeline. The preroll lock keeps the streaming thread out of the sink.
+ */
+
+void gstreamer_render_video_frame(gpointer sink, gpointer buffer) {
+	GstBaseSinkClass *klass = GST_BASE_SINK_GET_CLASS(sink);
+	GST_BASE_SINK_PREROLL_LOCK(sink);
+	if (klass->render != NULL)
+		klass->render(GST_BASE_SINK(sink), buffer);
+	GST_BASE_SINK_PREROLL_UNLOCK(sink);
+}
+
+/*
+ * Whether a buffer pool has a maximum number of buffers. Holding on to many
+ * buffers of such a pool starves the element that allocates from it.
+ */
+
+gboolean gstreamer_buffer_pool_is_bounded(gpointer pool) {
+	GstStructure *config = gst_buffer_pool_get_config(pool);
+	guint min_buffers, max_buffers;
+	gboolean bounded = gst_buffer_pool_config_get_params(config, NULL, NULL, &min_buffers,
+		&max_buffers) && max_buffers != 0;
+	gst_structure_free(config);
+	return bounded;
+}
+
+#else
+
+gpointer gstreamer_get_rendering_video_sink() {
+	return NULL;
+}
+
+void gstreamer_render_video_frame(gpointer sink, gpointer buffer) {
+}
+
+gboolean gstreamer_buffer_pool_is_bounded(gpointer pool) {
+	return FALSE;
+}
+
+#endif
+
+#if GST_CHECK_VERSION(1, 0, 0)
+
+/*
+ * Position probe on the rendering video sink. The stream time of every
+ * buffer is stored, so that the status bar can follow the position at a high
+ * rate without pipeline queries. Only the streaming thread uses the segment.
+ */
+
+static GstSegment position_segment;
+
+static GstPadProbeReturn position_probe_cb(GstPad *pad, GstPadProbeInfo *info,
+gpointer data) {
+	if (info->type & GST_PAD_PROBE_TYPE_EVENT_BOTH) {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+		if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT)
+			gst_event_copy_segment(event, &position_segment);
+		else if (GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP)
+			/* Fall back to queries until the first frame after a seek. */
+			__atomic_store_n(&sink_position, - 1, __ATOMIC_RELAXED);
+		return GST_PAD_PROBE_OK;
+	}
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	if (GST_BUFFER_PTS_IS_VALID(buffer) && position_segment.format == GST_FORMAT_TIME) {
+		guint64 pos = gst_segment_to_stream_time(&position_segment, GST_FORMAT_TIME,
+			GST_BUFFER_PTS(buffer));
+		if (pos != GST_CLOCK_TIME_NONE)
+			__atomic_store_n(&sink_position, (gint64)pos, __ATOMIC_RELAXED);
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+static void attach_position_probe(GstElement *sink) {
+	GstPad *pad = gst_element_get_static_pad(sink, "sink");
+	if (pad == position_pad) {
+		if (pad != NULL)
+			gst_object_unref(pad);
+		return;
+	}
+	detach_position_probe();
+	if (pad == NULL)
+		return;
+	position_pad = pad;
+	gst_segment_init(&position_segment, GST_FORMAT_UNDEFINED);
+	/* Pick up the segment of the stream that is already running. */
+	GstEvent *event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+	if (event != NULL) {
+		gst_event_copy_segment(event, &position_segment);
+		gst_event_unref(event);
+	}
+	position_probe_id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER |
+		GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH, position_probe_cb, NULL, NULL);
+}
+
+static void detach_position_probe() {
+	if (position_pad != NULL) {
+		gst_pad_remove_probe(position_pad, position_probe_id);
+		gst_object_unref(position_pad);
+		position_pad = NULL;
+	}
+	__atomic_store_n(&sink_position, - 1, __ATOMIC_RELAXED);
+}
+
+#else
+
+static void attach_position_probe(GstElement *sink) {
+}
+
+static void detach_position_probe() {
+}
+
+#endif
+
+/* Attach the frame ring and the position probe to the rendering video sink. */
+
+static void attach_frame_ring() {
+	GstElement *sink = gstreamer_get_rendering_video_sink();
+	if (sink == NULL)
+		return;
+	frame_ring_attach(sink);
+	attach_position_probe(sink);
+	gst_object_unref(sink);
+}
+
+/*
+ * Step back one frame. Frames still in the frame ring are shown directly.
+ * Otherwise seek to the keyframe before the target and, once prerolled, step
+ * forward to the target; the frames passed on the way fill the ring again.
+ */
+
 void gstreamer_previous_frame() {
+	if (gstreamer_state_is_playing())
+		gstreamer_pause();
+	if (frame_ring_step_back())
+		return;
 	gboolean error;
 	gint64 pos = gstreamer_get_position(&error);
-	if (!error) {
-		double rate;
-		if (!get_framerate(&rate))
-			return;
-		printf("Position = %ld, Rate = %lf\n", pos, rate);
-		pos -= ((gint64)GST_SECOND / rate) * 5;
-		if (pos < 0)
-			pos = 0;
-		printf("Position = %ld\n", pos);
-		if (gst_element_seek_simple(pipeline, GST_FORMAT_TIME,
-		GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
-		pos)) {
-			printf("gstplay: Seek succeeded\n");
-			pause_on_state_change_to_playing = TRUE;
-			gstreamer_play();
-		}
-		else {
-			printf("gstplay: Seek failed!.n");
-		}
+	double rate;
+	if (error || !get_framerate(&rate))
+		return;
+	pos -= frame_ring_get_displayed_offset() + (gint64)(GST_SECOND / rate);
+	if (pos < 0)
+		return;
+	end_of_stream = FALSE;
+	step_back_target = pos;
+	if (!gst_element_seek_simple(pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH |
+	GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE, pos)) {
+		printf("gstplay: Seek failed!.n");
+		step_back_target = - 1;
 	}
 }
 
+static void step_to_target() {
+	gint64 target = step_back_target;
+	step_back_target = - 1;
+	gboolean error;
+	gint64 pos = gstreamer_get_position(&error);
+	double rate;
+	if (error || !get_framerate(&rate))
+		return;
+	int nu_frames = (target - pos) * rate / GST_SECOND + 0.5;
+	if (nu_frames <= 0)
+		return;
+	GstElement *video_sink = get_video_sink();
+	if (video_sink == NULL)
+		return;
+	gst_element_send_event(video_sink,
+		gst_event_new_step(GST_FORMAT_BUFFERS, nu_frames, 1.0, TRUE, FALSE));
+	gst_object_unref(video_sink);
+}
+
 void gstreamer_increase_playback_speed() {
 	playback_rate *= 2.0;
 	update_playback_speed();
@@ -1021,8 +2859,7 @@ void gstreamer_decrease_playback_speed() {
 	update_playback_speed();
 }
 
-// This function is currently not used, reverse playback doesn't work well
-// with other parts of the interface.
+// Reverse playback goes through the reverse playback engine, see update_playback_speed.
 
 void gstreamer_set_playback_speed_reverse(gboolean enabled) {
 	if (enabled) {
@@ -1040,3 +2877,106 @@ void gstreamer_reset_playback_speed() {
 	playback_rate = 1.0;
 	update_playback_speed();
 }
+
+/*
+ * Switch the key units trick mode on or off with a seek to the current
+ * position; the decoders then skip everything but the keyframes.
+ */
+
+void gstreamer_set_key_units_only(gboolean status) {
+	if (status == key_units_only)
+		return;
+	key_units_only = status;
+	update_playback_speed();
+}
+
+/*
+ * Keyframe scrubbing for the position slider. While the slider is dragged the
+ * pipeline stays paused and every target gets a flushing key unit seek that
+ * snaps to the nearest keyframe; the sink prerolls and shows that keyframe.
+ * With GStreamer 1.6 or newer the seek also asks the decoders to skip delta
+ * frames and the demuxers to drop audio. A new seek is only issued when the
+ * previous one has prerolled (ASYNC_DONE); targets arriving in between replace
+ * each other. Releasing the slider does one accurate seek.
+ */
+
+static void scrub_seek(gint64 time_nanoseconds) {
+	GstSeekFlags flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT;
+#if GST_CHECK_VERSION(1, 0, 0)
+	flags |= GST_SEEK_FLAG_SNAP_NEAREST;
+#endif
+#if GST_CHECK_VERSION(1, 6, 0)
+	flags |= GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS |
+		GST_SEEK_FLAG_TRICKMODE_NO_AUDIO;
+#endif
+	scrub_seek_in_flight = gst_element_seek_simple(pipeline, GST_FORMAT_TIME, flags,
+		time_nanoseconds);
+}
+
+static void scrub_seek_done() {
+	if (!scrub_seek_in_flight)
+		return;
+	scrub_nu_frames++;
+	scrub_seek_in_flight = FALSE;
+	if (scrub_pending_target >= 0) {
+		scrub_seek(scrub_pending_target);
+		scrub_pending_target = - 1;
+	}
+}
+
+void gstreamer_scrub_begin() {
+	if (gstreamer_no_pipeline())
+		return;
+	/* The scrub seeks need the video sink; reverse playback resumes on release. */
+	reverse_after_scrub = reverse_playback_active();
+	if (reverse_after_scrub) {
+		gint64 pos = reverse_playback_stop();
+		gst_element_seek_simple(pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH |
+			GST_SEEK_FLAG_ACCURATE, pos);
+	}
+	gstreamer_pause();
+	scrubbing = TRUE;
+	scrub_seek_in_flight = FALSE;
+	scrub_pending_target = - 1;
+	scrub_nu_frames = 0;
+	scrub_start_time = g_get_monotonic_time();
+}
+
+void gstreamer_scrub_to_time(gint64 time_nanoseconds) {
+	if (!scrubbing)
+		return;
+	end_of_stream = FALSE;
+	if (scrub_seek_in_flight)
+		scrub_pending_target = time_nanoseconds;
+	else
+		scrub_seek(time_nanoseconds);
+}
+
+void gstreamer_scrub_end(gint64 time_nanoseconds) {
+	if (!scrubbing)
+		return;
+	scrubbing = FALSE;
+	gint64 duration = g_get_monotonic_time() - scrub_start_time;
+	if (duration > 0 && scrub_nu_frames > 0) {
+		last_scrub_frame_rate = scrub_nu_frames * 1000000.0 / duration;
+		printf("gstplay: Scrubbing presented %d frames in %.2lf s (%.1lf frames/s).\n",
+			scrub_nu_frames, duration * 0.000001, last_scrub_frame_rate);
+	}
+	end_of_stream = FALSE;
+	/* Leaves the scrub trick mode; the governor's key units mode is kept. */
+	if (!gst_element_seek_simple(pipeline, GST_FORMAT_TIME,
+	GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE | get_trick_mode_seek_flags(),
+	time_nanoseconds)) {
+		printf("gstplay: Seek failed!.n");
+	}
+	if (reverse_after_scrub)
+		start_reverse_playback(time_nanoseconds);
+}
+
+gchar *gstreamer_get_scrub_stats_str() {
+	if (last_scrub_frame_rate < 0)
+		return NULL;
+	return g_strdup_printf(
+		"Scrubbing responsiveness:       %.1lf frames/s (last drag)",
+		last_scrub_frame_rate);
+}
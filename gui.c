@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms-compat.h>
 #ifdef GDK_WINDOWING_X11
@@ -29,13 +30,22 @@
 #include <glib.h>
 #include "gstplay.h"
 
+/* Interval in milliseconds between updates of the position slider. */
+#define STATUS_BAR_UPDATE_INTERVAL 100
+
 static GtkWidget *window, *video_window;
 static guintptr video_window_handle = 0;
 static gboolean full_screen = FALSE;
 static GtkWidget *menu_bar, *status_bar, *status_bar_duration_label;
 static GtkWidget *position_slider;
-GtkWidget *open_file_dialog;
-guint update_status_bar_cb_id;
+/* Dialogs are created on first use, see get_*_dialog(). */
+static GtkWidget *open_file_dialog = NULL;
+static GtkWidget *preferences_dialog = NULL;
+#if GTK_CHECK_VERSION(3, 0, 0)
+static GtkWidget *color_balance_dialog = NULL;
+#endif
+static GtkWidget *stats_dialog = NULL;
+guint update_status_bar_cb_id = 0;
 
 static void gui_reset_status_bar();
 static gboolean gui_update_status_bar_cb(gpointer data);
@@ -153,16 +163,23 @@ guintptr gui_get_video_window_handle() {
 void gui_status_bar_pipeline_destroyed_cb(gpointer data, GtkWidget *widget) {
 	/* Remove the periodic time-out to update the position slider. */
 	g_source_remove(update_status_bar_cb_id);
+	update_status_bar_cb_id = 0;
 }
 
 void gui_play_start_cb() {
 	gui_reset_status_bar();
+	/* A pipeline that was switched to a new file already has the time-out. */
+	if (update_status_bar_cb_id != 0)
+		return;
 	/* Add a periodic time-out to update the position slider. */
-	update_status_bar_cb_id = g_timeout_add_seconds(1, gui_update_status_bar_cb, NULL);
+	update_status_bar_cb_id = g_timeout_add(STATUS_BAR_UPDATE_INTERVAL,
+		gui_update_status_bar_cb, NULL);
 	gstreamer_add_pipeline_destroyed_cb(gui_status_bar_pipeline_destroyed_cb, status_bar);
 }
 
 void gui_set_window_title(const char *title) {
+	if (window == NULL)
+		return;
 	gtk_window_set_title(GTK_WINDOW(window), title);
 }
 
@@ -204,6 +221,12 @@ static void menu_item_play_activate_cb(GtkMenuItem *menu_item, gpointer data);
 static void menu_item_pause_activate_cb(GtkMenuItem *menu_item, gpointer data);
 static void menu_item_next_frame_activate_cb(GtkMenuItem *menu_item, gpointer data);
 static void menu_item_previous_frame_activate_cb(GtkMenuItem *menu_item, gpointer data);
+static GtkWidget *get_open_file_dialog();
+static GtkWidget *get_preferences_dialog();
+#if GTK_CHECK_VERSION(3, 0, 0)
+static GtkWidget *get_color_balance_dialog();
+#endif
+static GtkWidget *get_stats_dialog();
 
 static gboolean key_press_cb(GtkWidget * widget, GdkEventKey * event, gpointer data) {
         switch (event->keyval) {
@@ -360,28 +383,36 @@ skip_stream_info: ;
 }
 
 static void menu_item_open_file_activate_cb(GtkMenuItem *menu_item, gpointer data) {
-	int r = gtk_dialog_run(GTK_DIALOG(open_file_dialog));
+	GtkWidget *dialog = get_open_file_dialog();
+	int r = gtk_dialog_run(GTK_DIALOG(dialog));
 	if (r == GTK_RESPONSE_ACCEPT) {
 		char *filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(
-			open_file_dialog));
-		if (!gstreamer_no_pipeline()) {
-			gstreamer_pause();
-			gstreamer_destroy_pipeline();
-		}
+			dialog));
 		char *uri;
 		char *video_title_filename;
 		main_create_uri(filename, &uri, &video_title_filename);
 		g_free(filename);
-		const char *pipeline_str = main_create_pipeline(uri, video_title_filename);
-		gtk_widget_hide(open_file_dialog);
-		if (!gstreamer_run_pipeline(main_get_main_loop(), pipeline_str,
+		const PipelineSpec *spec = main_create_pipeline(uri, video_title_filename);
+		gtk_widget_hide(dialog);
+		/* A running playbin with the same sinks just switches to the new file. */
+		if (gstreamer_switch_uri(spec, config_get_startup_preference())) {
+			gui_reset_status_bar();
+			return;
+		}
+		if (!gstreamer_no_pipeline()) {
+			gstreamer_pause();
+			gstreamer_destroy_pipeline();
+			/* Destroying the pipeline resets the window title. */
+			spec = main_create_pipeline(uri, video_title_filename);
+		}
+		if (!gstreamer_run_pipeline(main_get_main_loop(), spec,
 		config_get_startup_preference())) {
 			gui_show_error_message("Pipeline parse problem.", "");
 		}
 		gui_reset_status_bar();
 		return;
 	}
-	gtk_widget_hide(open_file_dialog);
+	gtk_widget_hide(dialog);
 }
 
 static gint64 requested_position;
@@ -396,12 +427,14 @@ static GtkWidget **audio_output_radio_button;
 static GtkWidget *video_only_check_button;
 static GtkWidget *software_volume_check_button;
 static GtkWidget *software_color_balance_check_button;
+static GtkWidget *decoder_threads_spin_button;
+static GtkWidget *decoder_thread_type_radio_button[3];
 
-static void menu_item_preferences_activate_cb(GtkMenuItem *menu_item, GtkWidget *dialog) {
+static void menu_item_preferences_activate_cb(GtkMenuItem *menu_item, gpointer data) {
+	GtkWidget *dialog = get_preferences_dialog();
 	gtk_widget_show_all(dialog);
 	int r = gtk_dialog_run(GTK_DIALOG(dialog));
 	if (r == GTK_RESPONSE_APPLY || r == GTK_RESPONSE_ACCEPT) {
-		gstreamer_suspend_pipeline();
 		/* Process the settings changes. */
 		int video_sink_index;
 		int n = config_get_number_of_video_sinks();
@@ -424,7 +457,26 @@ static void menu_item_preferences_activate_cb(GtkMenuItem *menu_item, GtkWidget
 		if (gstreamer_have_software_color_balance())
 			config_set_software_color_balance(gtk_toggle_button_get_active(
 				GTK_TOGGLE_BUTTON(software_color_balance_check_button)));
-		gstreamer_restart_pipeline();
+		config_set_decoder_max_threads(gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(
+			decoder_threads_spin_button)));
+		for (int i = 0; i < 3; i++)
+			if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(
+			decoder_thread_type_radio_button[i])))
+				config_set_decoder_thread_type(i);
+		/*
+		 * A playbin takes the new settings while running; other pipelines are
+		 * suspended and restarted.
+		 */
+		if (!gstreamer_no_pipeline()) {
+			const char *uri;
+			const char *video_title_filename;
+			main_get_current_uri(&uri, &video_title_filename);
+			const PipelineSpec *spec = main_create_pipeline(uri, video_title_filename);
+			if (!gstreamer_reconfigure_pipeline(spec)) {
+				gstreamer_suspend_pipeline();
+				gstreamer_restart_pipeline();
+			}
+		}
 	}
 	gtk_widget_hide(GTK_WIDGET(dialog));
 }
@@ -595,6 +647,12 @@ static void resize_video_window(int width, int height, gboolean draw) {
 		gtk_widget_queue_draw(video_window);
 }
 
+void gui_set_video_window_size(int width, int height) {
+	if (full_screen)
+		return;
+	resize_video_window(width, height, TRUE);
+}
+
 static void menu_item_one_to_one_activate_cb(GtkMenuItem *menu_item, gpointer data) {
 	if (gstreamer_no_pipeline())
 		return;
@@ -650,7 +708,7 @@ void color_balance_pipeline_destroyed_cb(gpointer data, GtkDialog *dialog) {
 	color_controls_active = FALSE;
 }
 
-static void menu_item_color_controls_activate_cb(GtkMenuItem *menu_item, GtkDialog *dialog) {
+static void menu_item_color_controls_activate_cb(GtkMenuItem *menu_item, gpointer data) {
 	if (color_controls_active)
 		return;
 	int r = 0;
@@ -671,6 +729,7 @@ static void menu_item_color_controls_activate_cb(GtkMenuItem *menu_item, GtkDial
 		gtk_widget_destroy(message_dialog);
 		return;
 	}
+	GtkWidget *dialog = get_color_balance_dialog();
 	for (int i = 0; i < 4; i++) {
 		gboolean status;
 		if (r & (1 << i))
@@ -815,8 +874,17 @@ static void menu_item_about_activate_cb(GtkMenuItem *menu_item, gpointer data) {
 
 GtkWidget *cpu_utilization_text_view;
 GtkWidget *dropped_frames_text_view;
+GtkWidget *playback_info_text_view;
+GtkWidget *thread_sparklines;
 guint stats_dialog_update_cb_id;
 
+#define SPARKLINE_ROW_HEIGHT 16
+#define SPARKLINE_LABEL_WIDTH 320
+#define SPARKLINE_MIN_WIDTH (SPARKLINE_LABEL_WIDTH + 200)
+
+static StatsThreadHistory thread_history[STATS_MAX_THREADS];
+static int nu_thread_history = 0;
+
 /* Replace the text of a text view, and apply an existing tag to all text. */
 
 static void replace_text_view_text(GtkWidget *text_view, const char *tag_name,
@@ -841,11 +909,93 @@ static gboolean stats_dialog_update_cb(gpointer data) {
 	s = stats_get_dropped_frames_str();
 	replace_text_view_text(dropped_frames_text_view, "my_font", s);
 	g_free(s);
+	s = stats_get_playback_info_str();
+	replace_text_view_text(playback_info_text_view, "my_font", s);
+	g_free(s);
+	int n = stats_get_thread_history(thread_history, STATS_MAX_THREADS);
+	if (n != nu_thread_history)
+		gtk_widget_set_size_request(thread_sparklines, SPARKLINE_MIN_WIDTH,
+			n * SPARKLINE_ROW_HEIGHT);
+	nu_thread_history = n;
+	gtk_widget_queue_draw(thread_sparklines);
 	return TRUE;
 }
 
-static void menu_item_stats_activate_cb(GtkMenuItem *menu_item, GtkDialog *dialog) {
-	gtk_widget_show_all(GTK_WIDGET(dialog));
+/*
+ * Draw one row per thread: the thread id, name and latest CPU usage, and a
+ * sparkline of its recent CPU usage. The vertical scale is one full core.
+ */
+
+static void draw_thread_sparklines(GtkWidget *widget, cairo_t *cr) {
+	GtkAllocation allocation;
+	gtk_widget_get_allocation(widget, &allocation);
+	double core_percent = 100.0 / MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+	double x0 = SPARKLINE_LABEL_WIDTH;
+	double w = allocation.width - x0 - 4;
+	double dx = w / (STATS_SPARKLINE_POINTS - 1);
+	cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL,
+		CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, SPARKLINE_ROW_HEIGHT - 4);
+	cairo_set_line_width(cr, 1.0);
+	for (int i = 0; i < nu_thread_history; i++) {
+		StatsThreadHistory *t = &thread_history[i];
+		double y0 = (i + 1) * SPARKLINE_ROW_HEIGHT - 2;
+		double h = SPARKLINE_ROW_HEIGHT - 4;
+		float latest = t->cpu_percent[STATS_SPARKLINE_POINTS - 1];
+		char label[64];
+		if (latest >= 0)
+			snprintf(label, sizeof(label), "Thread %6d %-16s %5.1f%%", t->tid, t->name,
+				latest);
+		else
+			snprintf(label, sizeof(label), "Thread %6d %-16s", t->tid, t->name);
+		cairo_set_source_rgb(cr, 0, 0, 0);
+		cairo_move_to(cr, 2, y0 - 1);
+		cairo_show_text(cr, label);
+		if (w <= 0)
+			continue;
+		cairo_set_source_rgb(cr, 0.85, 0.85, 0.85);
+		cairo_move_to(cr, x0, y0 + 0.5);
+		cairo_line_to(cr, x0 + w, y0 + 0.5);
+		cairo_stroke(cr);
+		cairo_set_source_rgb(cr, 0.1, 0.4, 0.8);
+		gboolean drawing = FALSE;
+		for (int k = 0; k < STATS_SPARKLINE_POINTS; k++) {
+			if (t->cpu_percent[k] < 0) {
+				drawing = FALSE;
+				continue;
+			}
+			double y = y0 - MIN(t->cpu_percent[k] / core_percent, 1.0) * h;
+			if (drawing)
+				cairo_line_to(cr, x0 + k * dx, y);
+			else
+				cairo_move_to(cr, x0 + k * dx, y);
+			drawing = TRUE;
+		}
+		cairo_stroke(cr);
+	}
+}
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+
+static gboolean thread_sparklines_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer data) {
+	draw_thread_sparklines(widget, cr);
+	return FALSE;
+}
+
+#else
+
+static gboolean thread_sparklines_expose_event_cb(GtkWidget *widget, GdkEventExpose *event,
+gpointer data) {
+	cairo_t *cr = gdk_cairo_create(gtk_widget_get_window(widget));
+	draw_thread_sparklines(widget, cr);
+	cairo_destroy(cr);
+	return FALSE;
+}
+
+#endif
+
+static void menu_item_stats_activate_cb(GtkMenuItem *menu_item, gpointer data) {
+	gtk_widget_show_all(get_stats_dialog());
 	stats_dialog_update_cb_id = g_timeout_add(200, stats_dialog_update_cb, NULL);
 	stats_reset();
 	stats_set_enabled(TRUE);
@@ -870,17 +1020,14 @@ static void stats_thread_info_check_button_toggled_cb(GtkToggleButton *button, g
 
 // Status bar.
 
-// Number of milliseconds to play for after a scrub seek.
-#define SCRUB_TIME 100
-
 static guint position_slider_value_changed_cb_id;
 static guint position_slider_value_changed_scrub_seek_cb_id;
-static guint seek_timeout_id = 0;
 static gboolean state_was_playing;
-static gint64 current_seek_target_position;
-static gint64 next_seek_target_position;
 static gint64 cached_duration;
-static gboolean scrub_seek_active = FALSE;
+static gboolean keyframe_marks_shown = FALSE;
+
+// Maximum number of keyframe marks drawn below the slider.
+#define MAX_KEYFRAME_MARKS 200
 
 static void position_slider_value_changed_cb(GtkScale *scale, gpointer data) {
 	if (gstreamer_no_pipeline())
@@ -897,11 +1044,25 @@ void gui_reset_status_bar() {
 	gtk_range_set_value(GTK_RANGE(position_slider), 0);
 	g_signal_handlers_unblock_by_func(position_slider, position_slider_value_changed_cb,
 		NULL);
+	gtk_scale_clear_marks(GTK_SCALE(position_slider));
+	keyframe_marks_shown = FALSE;
 	gtk_label_set_text(GTK_LABEL(status_bar_duration_label),
 		gstreamer_get_duration_str());
 }
 
-// Handler that is called every second to update the progress slider in the status bar.
+// Mark the keyframes on the slider, thinned out for long files.
+
+static void add_keyframe_marks(gint64 duration) {
+	int n = keyframe_index_get_count();
+	int step = (n + MAX_KEYFRAME_MARKS - 1) / MAX_KEYFRAME_MARKS;
+	for (int i = 0; i < n; i += step)
+		gtk_scale_add_mark(GTK_SCALE(position_slider),
+			(gdouble)keyframe_index_get_time(i) * 100.0 / duration, GTK_POS_BOTTOM, NULL);
+	keyframe_marks_shown = TRUE;
+}
+
+// Handler that is called periodically to update the progress slider in the status bar.
+// The duration is cached and the position comes from the video sink, so this is cheap.
 
 gboolean gui_update_status_bar_cb(gpointer data) {
 	if (gstreamer_no_pipeline())
@@ -912,11 +1073,16 @@ gboolean gui_update_status_bar_cb(gpointer data) {
 	gint64 duration = gstreamer_get_duration();
 	if (duration == 0)
 		return TRUE;
+	if (!keyframe_marks_shown && keyframe_index_ready())
+		add_keyframe_marks(duration);
 	gboolean error;
 	gint64 pos = gstreamer_get_position(&error);
 	if (error)
 		return TRUE;
 	gdouble value = (gdouble)pos * 100.0 / duration;
+	// Avoid redrawing the slider when nothing changed, e.g. while paused.
+	if (value == gtk_range_get_value(GTK_RANGE(position_slider)))
+		return TRUE;
 	// Don't trigger a gstreamer seek when the value is changed.
 	g_signal_handlers_block_by_func(position_slider, position_slider_value_changed_cb,
 		NULL);
@@ -926,61 +1092,45 @@ gboolean gui_update_status_bar_cb(gpointer data) {
 	return TRUE;
 }
 
+// Show the thumbnail nearest to the hovered position as the slider's tooltip.
+
+static gboolean position_slider_query_tooltip_cb(GtkWidget *widget, gint x, gint y,
+gboolean keyboard_mode, GtkTooltip *tooltip, gpointer data) {
+	if (keyboard_mode || gstreamer_no_pipeline())
+		return FALSE;
+	gint64 duration = gstreamer_get_duration();
+	if (duration <= 0)
+		return FALSE;
+	GdkRectangle rect;
+	gtk_range_get_range_rect(GTK_RANGE(widget), &rect);
+	if (x < rect.x || x >= rect.x + rect.width)
+		return FALSE;
+	gint64 time = (gdouble)(x - rect.x) / rect.width * duration;
+	GdkPixbuf *pixbuf = thumbnail_get_nearest(time);
+	if (pixbuf == NULL)
+		return FALSE;
+	gtk_tooltip_set_icon(tooltip, pixbuf);
+	g_object_unref(pixbuf);
+	return TRUE;
+}
+
 static gchar *position_slider_format_value_cb(GtkScale *scale, gdouble value) {
 	return g_strdup_printf("%.0lf%%", value);
 }
 
-static gboolean end_scrub(gpointer data) {
-	if (position_slider_value_changed_cb_id != 0)
-		return FALSE;
-	seek_timeout_id = 0;
-	if (next_seek_target_position == - 1) {
-		gstreamer_pause();
-		current_seek_target_position = - 1;
-	}
-	else {
-		// If a new seek target is pending, perform a new seek.
-		gstreamer_pause();
-		gstreamer_seek_to_time(next_seek_target_position);
-		current_seek_target_position = next_seek_target_position;	
-		next_seek_target_position = -1;
-		gstreamer_play();
-	}
-	return FALSE;
-}
+// While dragging, only keyframes are shown (see gstreamer_scrub_begin).
 
-void gui_state_change_to_playing_cb() {
-	// When doing a scrub seek, play for SCRUB_TIME ms.
-	if (scrub_seek_active && position_slider_value_changed_cb_id == 0) {
-		if (seek_timeout_id == 0) {
-			seek_timeout_id = g_timeout_add(SCRUB_TIME,
-				(GSourceFunc)end_scrub, NULL);
-		}
-	}
+static gint64 get_scrub_position(GtkScale *scale) {
+	gdouble v = gtk_range_get_value(GTK_RANGE(scale));
+	if (cached_duration == - 1)
+		cached_duration = gstreamer_get_duration();
+	return (v / 100.0) * cached_duration;
 }
 
 static void position_slider_value_changed_scrub_seek_cb(GtkScale *scale, gpointer data) {
 	if (gstreamer_no_pipeline())
 		return;
-	gdouble v = gtk_range_get_value(GTK_RANGE(scale));
-	if (cached_duration == - 1)
-		cached_duration = gstreamer_get_duration();
-	gint64 pos = (v / 100.0) * cached_duration;
-	// Wait until the current seek operation is finished before updating the
-	// seek position.
-	if (current_seek_target_position == - 1) {
-//		printf("value changed to %lu, seek\n", pos);
-		gstreamer_seek_to_time(pos);
-		current_seek_target_position = pos;
-		gstreamer_play();
-	}
-	else {
-//		printf("value changed to %lu, seek next\n", pos);
-		next_seek_target_position = pos;
-	}
-	// Try to prevent the GUI from taking up most CPU cycles (reduce the frequency of
-	// this callback).
-	main_thread_yield();
+	gstreamer_scrub_to_time(get_scrub_position(scale));
 }
 
 static gboolean position_slider_button_press_cb(GtkWidget *scale, GdkEventButton * event,
@@ -990,15 +1140,11 @@ gpointer data) {
 		g_signal_handler_disconnect(position_slider, position_slider_value_changed_cb_id);
 		position_slider_value_changed_cb_id = 0;
 		state_was_playing = gstreamer_state_is_playing();
-		gstreamer_pause();
-		scrub_seek_active = TRUE;
+		gstreamer_scrub_begin();
 		// Install the scrub seek signal handler.
 		position_slider_value_changed_scrub_seek_cb_id = g_signal_connect(
 			G_OBJECT(position_slider), "value-changed",
 			G_CALLBACK(position_slider_value_changed_scrub_seek_cb), NULL);
-		current_seek_target_position = - 1;
-		next_seek_target_position = - 1;
-		seek_timeout_id = 0;
 		cached_duration = - 1;
 	}
 	return FALSE;
@@ -1013,7 +1159,9 @@ gpointer data) {
 		// Reconnect the signal handler that instantly seeks when the slider value is changed.
 		position_slider_value_changed_cb_id = g_signal_connect(G_OBJECT(position_slider),
 			"value-changed", G_CALLBACK(position_slider_value_changed_cb), NULL);
-		scrub_seek_active = FALSE;
+		// Land exactly on the released position.
+		if (!gstreamer_no_pipeline())
+			gstreamer_scrub_end(get_scrub_position(scale));
 		if (state_was_playing)
 			gstreamer_play();
 	}
@@ -1097,9 +1245,43 @@ static GtkWidget *create_preferences_dialog() {
 	gtk_container_add(GTK_CONTAINER(content), software_volume_check_button);
 	if (gstreamer_have_software_color_balance())
 		gtk_container_add(GTK_CONTAINER(content), software_color_balance_check_button);
+
+	// Video decoder threading.
+	GtkWidget *spacing_label2 = gtk_label_new("");
+	gtk_container_add(GTK_CONTAINER(content), spacing_label2);
+#if GTK_CHECK_VERSION(3, 0, 0)
+	GtkWidget *threads_hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+#else
+	GtkWidget *threads_hbox = gtk_hbox_new(FALSE, 0);
+#endif
+	GtkWidget *threads_label = gtk_label_new("Video decoder threads (0 = automatic): ");
+	decoder_threads_spin_button = gtk_spin_button_new_with_range(0, 64, 1);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(decoder_threads_spin_button),
+		config_get_decoder_max_threads());
+	gtk_container_add(GTK_CONTAINER(threads_hbox), threads_label);
+	gtk_container_add(GTK_CONTAINER(threads_hbox), decoder_threads_spin_button);
+	gtk_container_add(GTK_CONTAINER(content), threads_hbox);
+	GtkWidget *thread_type_label = gtk_label_new("Video decoder threading method:");
+	gtk_container_add(GTK_CONTAINER(content), thread_type_label);
+	const char *thread_type_label_str[3] = {
+		"Automatic", "Frame threading (adds latency)", "Slice threading" };
+	for (int i = 0; i < 3; i++) {
+		decoder_thread_type_radio_button[i] = gtk_radio_button_new_with_label(
+			i == 0 ? NULL : gtk_radio_button_get_group(GTK_RADIO_BUTTON(
+			decoder_thread_type_radio_button[0])), thread_type_label_str[i]);
+		gtk_container_add(GTK_CONTAINER(content), decoder_thread_type_radio_button[i]);
+	}
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(decoder_thread_type_radio_button[
+		config_get_decoder_thread_type()]), TRUE);
 	return dialog;
 }
 
+static GtkWidget *get_preferences_dialog() {
+	if (preferences_dialog == NULL)
+		preferences_dialog = create_preferences_dialog();
+	return preferences_dialog;
+}
+
 #if GTK_CHECK_VERSION(3, 0, 0)
 
 static GtkWidget *create_color_balance_dialog() {
@@ -1150,6 +1332,12 @@ static GtkWidget *create_color_balance_dialog() {
 	return dialog;
 }
 
+static GtkWidget *get_color_balance_dialog() {
+	if (color_balance_dialog == NULL)
+		color_balance_dialog = create_color_balance_dialog();
+	return color_balance_dialog;
+}
+
 #endif
 
 static GtkWidget *create_stats_dialog() {
@@ -1165,6 +1353,9 @@ static GtkWidget *create_stats_dialog() {
  	dropped_frames_text_view = gtk_text_view_new();
 	buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(dropped_frames_text_view));
 	gtk_text_buffer_create_tag(buffer, "my_font", "family", "monospace", NULL);
+	playback_info_text_view = gtk_text_view_new();
+	buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(playback_info_text_view));
+	gtk_text_buffer_create_tag(buffer, "my_font", "family", "monospace", NULL);
 	GtkWidget *thread_info_check_button =
 		gtk_check_button_new_with_label("Show thread info");
 	g_signal_connect(G_OBJECT(thread_info_check_button), "toggled", G_CALLBACK(
@@ -1173,12 +1364,25 @@ static GtkWidget *create_stats_dialog() {
 	GtkWidget *vbox1 = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
 #else
 	GtkWidget *vbox1 = gtk_vbox_new(FALSE, 0);
+#endif
+	thread_sparklines = gtk_drawing_area_new();
+	gtk_widget_set_size_request(thread_sparklines, SPARKLINE_MIN_WIDTH, 0);
+#if GTK_CHECK_VERSION(3, 0, 0)
+	g_signal_connect(G_OBJECT(thread_sparklines), "draw",
+		G_CALLBACK(thread_sparklines_draw_cb), NULL);
+#else
+	g_signal_connect(G_OBJECT(thread_sparklines), "expose-event",
+		G_CALLBACK(thread_sparklines_expose_event_cb), NULL);
 #endif
 	gtk_container_add(GTK_CONTAINER(vbox1), cpu_utilization_text_view);
+	gtk_container_add(GTK_CONTAINER(vbox1), thread_sparklines);
 	gtk_container_add(GTK_CONTAINER(vbox1), thread_info_check_button);
 	GtkWidget *space_label = gtk_label_new("");
 	gtk_container_add(GTK_CONTAINER(vbox1), space_label);
 	gtk_container_add(GTK_CONTAINER(vbox1), dropped_frames_text_view);
+	space_label = gtk_label_new("");
+	gtk_container_add(GTK_CONTAINER(vbox1), space_label);
+	gtk_container_add(GTK_CONTAINER(vbox1), playback_info_text_view);
 	gtk_container_add(GTK_CONTAINER(content), vbox1);
 	GtkWidget *stats_reset_button = gtk_button_new_with_label("Reset");
 	g_signal_connect(G_OBJECT(stats_reset_button), "clicked", G_CALLBACK(
@@ -1190,17 +1394,23 @@ static GtkWidget *create_stats_dialog() {
 	return dialog;
 }
 
-static void create_menus(GMainLoop *loop) {
-	GtkWidget *preferences_dialog = create_preferences_dialog();
-
-#if GTK_CHECK_VERSION(3, 0, 0)
-	// Create the color balance dialog
-	GtkWidget *color_balance_dialog = create_color_balance_dialog();
-#endif
+static GtkWidget *get_stats_dialog() {
+	if (stats_dialog == NULL)
+		stats_dialog = create_stats_dialog();
+	return stats_dialog;
+}
 
-	GtkWidget *stats_dialog = create_stats_dialog();
+static GtkWidget *get_open_file_dialog() {
+	if (open_file_dialog == NULL)
+		open_file_dialog = gtk_file_chooser_dialog_new("Select a video file to open.",
+			GTK_WINDOW(window), GTK_FILE_CHOOSER_ACTION_OPEN,
+			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT,
+			NULL);
+	return open_file_dialog;
+}
 
-	// Create the menu bar.
+static void create_menus(GMainLoop *loop) {
+	// Create the menu bar. The dialogs are only created when they are first used.
 	menu_bar = gtk_menu_bar_new();
 
 	// Create the menu items.
@@ -1212,7 +1422,7 @@ static void create_menus(GMainLoop *loop) {
 		G_CALLBACK(menu_item_properties_activate_cb), NULL);
 	GtkWidget *menu_item_preferences = gtk_menu_item_new_with_label("Preferences");
 	g_signal_connect(G_OBJECT(menu_item_preferences), "activate",
-		G_CALLBACK(menu_item_preferences_activate_cb), preferences_dialog);
+		G_CALLBACK(menu_item_preferences_activate_cb), NULL);
 	GtkWidget *menu_item_close = gtk_menu_item_new_with_label("Close stream");
 	g_signal_connect(G_OBJECT(menu_item_close), "activate",
 		G_CALLBACK(menu_item_close_activate_cb), loop);
@@ -1308,7 +1518,7 @@ static void create_menus(GMainLoop *loop) {
 #if GTK_CHECK_VERSION(3, 0, 0)
 	GtkWidget *menu_item_color_controls = gtk_menu_item_new_with_label("Open color controls");
 	g_signal_connect(G_OBJECT(menu_item_color_controls), "activate",
-		G_CALLBACK(menu_item_color_controls_activate_cb), color_balance_dialog);
+		G_CALLBACK(menu_item_color_controls_activate_cb), NULL);
 	GtkWidget *color_menu = gtk_menu_new();
 	gtk_menu_shell_append(GTK_MENU_SHELL(color_menu), menu_item_color_controls);
 	// Create the color menu.
@@ -1355,7 +1565,7 @@ static void create_menus(GMainLoop *loop) {
 
 	GtkWidget *menu_item_stats = gtk_menu_item_new_with_label("Open performance statistics");
 	g_signal_connect(G_OBJECT(menu_item_stats), "activate",
-		G_CALLBACK(menu_item_stats_activate_cb), stats_dialog);
+		G_CALLBACK(menu_item_stats_activate_cb), NULL);
 	GtkWidget *stats_menu = gtk_menu_new();
 	gtk_menu_shell_append(GTK_MENU_SHELL(stats_menu), menu_item_stats);
 	// Create the stats menu.
@@ -1394,6 +1604,9 @@ static void create_status_bar() {
 		position_slider_format_value_cb), NULL);
 	g_signal_connect(G_OBJECT(position_slider), "button-press-event", G_CALLBACK(
 		position_slider_button_press_cb), NULL);
+	gtk_widget_set_has_tooltip(position_slider, TRUE);
+	g_signal_connect(G_OBJECT(position_slider), "query-tooltip", G_CALLBACK(
+		position_slider_query_tooltip_cb), NULL);
 	g_signal_connect(G_OBJECT(position_slider), "button-release-event", G_CALLBACK(
 		position_slider_button_release_cb), NULL);
 	position_slider_value_changed_cb_id = g_signal_connect(G_OBJECT(position_slider),
@@ -1454,12 +1667,6 @@ gboolean full_screen_requested) {
 	// Add the vbox to the window.
 	gtk_container_add(GTK_CONTAINER(window), menu_vbox);
 
-	// Create the open file load dialog.
-	open_file_dialog = gtk_file_chooser_dialog_new("Select a video file to open.",
-		GTK_WINDOW(window), GTK_FILE_CHOOSER_ACTION_OPEN,
-		GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT,
-		NULL);
-
 	/* Set the default size. */
 	gtk_window_set_default_size(GTK_WINDOW(window), width, height);
 	gtk_widget_show_all(window);
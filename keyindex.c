@@ -0,0 +1,358 @@
+/*
+    gstplay -- Simple gstreamer-based media player
+
+    Copyright 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+    gstplay is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    gstplay is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with gstplay.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Keyframe index. A background pipeline runs the file through parsebin
+ * (demuxer and parsers, no decoders) into fakesinks and records the
+ * timestamp and byte offset of every video buffer that is not a delta unit.
+ * The table is stored in $XDG_CACHE_HOME/gstplay/keyframes, next to the media
+ * cache, in a file named after the hash of the canonical path; like the media
+ * cache, an entry is only valid for the same file size and modification time.
+ *
+ * The index is used to choose the cheapest seek: an accurate seek when the
+ * preceding keyframe is close to the target, otherwise a seek to the nearest
+ * keyframe.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <gst/gst.h>
+#include <glib.h>
+#include "gstplay.h"
+
+#define KEYFRAME_INDEX_MAGIC 0x4b465047	/* "GPFK" */
+#define KEYFRAME_INDEX_VERSION 3
+#define MAX_PATH_LENGTH 448
+#define POLL_INTERVAL_MS 100
+
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	gint64 size;
+	gint64 mtime_sec;
+	gint64 mtime_nsec;
+	char path[MAX_PATH_LENGTH];
+	guint32 entry_size;
+	guint32 nu_entries;
+} KeyframeIndexHeader;
+
+typedef struct {
+	gint64 time;
+	gint64 offset;		/* - 1 when the demuxer doesn't report it. */
+} KeyframeIndexEntry;
+
+static GThread *thread = NULL;
+/* Set while the thread runs; the thread is only joined by keyframe_index_stop(). */
+static volatile gint indexing;
+static volatile gint stop_requested;
+static volatile gint ready;
+static gboolean loaded_from_cache;
+static char *index_filename = NULL;
+static KeyframeIndexHeader header;
+/* Written by the streaming thread until the index is ready, read-only afterwards. */
+static GArray *entries = NULL;
+static GMutex mutex;
+
+static char *get_index_filename(const char *path) {
+	char *dir = g_build_filename(g_get_user_cache_dir(), "gstplay", "keyframes", NULL);
+	g_mkdir_with_parents(dir, 0755);
+	char name[32];
+	sprintf(name, "%08x.idx", g_str_hash(path));
+	char *filename = g_build_filename(dir, name, NULL);
+	g_free(dir);
+	return filename;
+}
+
+static gboolean load_index() {
+	FILE *f = fopen(index_filename, "rb");
+	if (f == NULL)
+		return FALSE;
+	KeyframeIndexHeader h;
+	gboolean ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == KEYFRAME_INDEX_MAGIC &&
+		h.version == KEYFRAME_INDEX_VERSION && h.entry_size == sizeof(KeyframeIndexEntry) &&
+		h.size == header.size && h.mtime_sec == header.mtime_sec &&
+		h.mtime_nsec == header.mtime_nsec && strcmp(h.path, header.path) == 0;
+	if (ok) {
+		g_array_set_size(entries, h.nu_entries);
+		ok = fread(entries->data, sizeof(KeyframeIndexEntry), h.nu_entries, f) ==
+			h.nu_entries;
+		if (!ok)
+			g_array_set_size(entries, 0);
+	}
+	fclose(f);
+	return ok;
+}
+
+static void save_index() {
+	/* Write a temporary file and rename it, so that readers never see a partial index. */
+	char *tmp_filename = g_strdup_printf("%s.%d", index_filename, getpid());
+	FILE *f = fopen(tmp_filename, "wb");
+	if (f == NULL) {
+		printf("gstplay: Could not write keyframe index.\n");
+		g_free(tmp_filename);
+		return;
+	}
+	header.nu_entries = entries->len;
+	gboolean ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(entries->data, sizeof(KeyframeIndexEntry), entries->len, f) == entries->len;
+	ok = fclose(f) == 0 && ok;
+	if (ok)
+		ok = rename(tmp_filename, index_filename) == 0;
+	if (!ok)
+		unlink(tmp_filename);
+	g_free(tmp_filename);
+}
+
+static int compare_entries(gconstpointer a, gconstpointer b) {
+	gint64 x = ((const KeyframeIndexEntry *)a)->time;
+	gint64 y = ((const KeyframeIndexEntry *)b)->time;
+	return x < y ? - 1 : (x > y ? 1 : 0);
+}
+
+#if GST_CHECK_VERSION(1, 10, 0)
+
+static GstPadProbeReturn keyframe_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer data) {
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+		return GST_PAD_PROBE_OK;
+	KeyframeIndexEntry entry;
+	entry.time = GST_BUFFER_PTS_IS_VALID(buffer) ? GST_BUFFER_PTS(buffer) :
+		GST_BUFFER_DTS(buffer);
+	if (!GST_CLOCK_TIME_IS_VALID(entry.time))
+		return GST_PAD_PROBE_OK;
+	entry.offset = GST_BUFFER_OFFSET_IS_VALID(buffer) ? GST_BUFFER_OFFSET(buffer) : - 1;
+	g_mutex_lock(&mutex);
+	g_array_append_val(entries, entry);
+	g_mutex_unlock(&mutex);
+	return GST_PAD_PROBE_OK;
+}
+
+/* Every stream goes into a fakesink; only the first video stream is indexed. */
+
+static void parsebin_pad_added_cb(GstElement *parsebin, GstPad *pad, gpointer data) {
+	GstBin *bin = data;
+	GstElement *sink = gst_element_factory_make("fakesink", NULL);
+	g_object_set(sink, "sync", FALSE, "async", FALSE, NULL);
+	gst_bin_add(bin, sink);
+	gst_element_sync_state_with_parent(sink);
+	GstPad *sink_pad = gst_element_get_static_pad(sink, "sink");
+	gst_pad_link(pad, sink_pad);
+	GstCaps *caps = gst_pad_get_current_caps(pad);
+	if (caps == NULL)
+		caps = gst_pad_query_caps(pad, NULL);
+	if (caps != NULL && gst_caps_get_size(caps) > 0 && g_str_has_prefix(
+	gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/") &&
+	g_object_get_data(G_OBJECT(bin), "video-indexed") == NULL) {
+		g_object_set_data(G_OBJECT(bin), "video-indexed", GINT_TO_POINTER(1));
+		gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, keyframe_probe_cb, NULL,
+			NULL);
+	}
+	if (caps != NULL)
+		gst_caps_unref(caps);
+	gst_object_unref(sink_pad);
+}
+
+static gpointer keyframe_index_thread_func(gpointer data) {
+	GstElement *pipeline = gst_pipeline_new("keyframe-index");
+	GstElement *source = gst_element_factory_make("filesrc", NULL);
+	GstElement *parsebin = gst_element_factory_make("parsebin", NULL);
+	if (source == NULL || parsebin == NULL) {
+		if (source != NULL)
+			gst_object_unref(source);
+		if (parsebin != NULL)
+			gst_object_unref(parsebin);
+		gst_object_unref(pipeline);
+		g_atomic_int_set(&indexing, FALSE);
+		return NULL;
+	}
+	g_object_set(source, "location", header.path, NULL);
+	gst_bin_add_many(GST_BIN(pipeline), source, parsebin, NULL);
+	gst_element_link(source, parsebin);
+	g_signal_connect(parsebin, "pad-added", G_CALLBACK(parsebin_pad_added_cb), pipeline);
+
+	gint64 t = g_get_monotonic_time();
+	GstBus *bus = gst_element_get_bus(pipeline);
+	gst_element_set_state(pipeline, GST_STATE_PLAYING);
+	gboolean eos = FALSE;
+	while (!g_atomic_int_get(&stop_requested)) {
+		GstMessage *msg = gst_bus_timed_pop_filtered(bus, POLL_INTERVAL_MS * GST_MSECOND,
+			GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+		if (msg == NULL)
+			continue;
+		eos = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+		gst_message_unref(msg);
+		break;
+	}
+	gst_element_set_state(pipeline, GST_STATE_NULL);
+	gst_object_unref(bus);
+	gst_object_unref(pipeline);
+
+	if (eos && entries->len > 0) {
+		g_array_sort(entries, compare_entries);
+		save_index();
+		g_atomic_int_set(&ready, TRUE);
+		printf("gstplay: Indexed %u keyframes in %.1lf s.\n", entries->len,
+			(g_get_monotonic_time() - t) * 0.000001);
+	}
+	g_atomic_int_set(&indexing, FALSE);
+	return NULL;
+}
+
+#endif
+
+void keyframe_index_stop() {
+	if (thread != NULL) {
+		g_atomic_int_set(&stop_requested, TRUE);
+		g_thread_join(thread);
+		thread = NULL;
+	}
+	g_atomic_int_set(&ready, FALSE);
+	g_free(index_filename);
+	index_filename = NULL;
+	if (entries != NULL)
+		g_array_set_size(entries, 0);
+}
+
+/* Load the cached index of a local file, or start indexing it in the background. */
+
+void keyframe_index_start(const char *filename) {
+	keyframe_index_stop();
+	if (entries == NULL)
+		entries = g_array_new(FALSE, FALSE, sizeof(KeyframeIndexEntry));
+	memset(&header, 0, sizeof(header));
+	char *canonical_path = realpath(filename, NULL);
+	if (canonical_path == NULL)
+		return;
+	struct stat st;
+	if (strlen(canonical_path) >= MAX_PATH_LENGTH || stat(canonical_path, &st) < 0) {
+		free(canonical_path);
+		return;
+	}
+	header.magic = KEYFRAME_INDEX_MAGIC;
+	header.version = KEYFRAME_INDEX_VERSION;
+	header.size = st.st_size;
+	header.mtime_sec = st.st_mtim.tv_sec;
+	header.mtime_nsec = st.st_mtim.tv_nsec;
+	header.entry_size = sizeof(KeyframeIndexEntry);
+	strcpy(header.path, canonical_path);
+	free(canonical_path);
+	index_filename = get_index_filename(header.path);
+	loaded_from_cache = load_index();
+	if (loaded_from_cache) {
+		g_atomic_int_set(&ready, TRUE);
+		return;
+	}
+#if GST_CHECK_VERSION(1, 10, 0)
+	g_atomic_int_set(&stop_requested, FALSE);
+	g_atomic_int_set(&indexing, TRUE);
+	thread = g_thread_new("gstplay-keyindex", keyframe_index_thread_func, NULL);
+#endif
+}
+
+gboolean keyframe_index_ready() {
+	return g_atomic_int_get(&ready);
+}
+
+int keyframe_index_get_count() {
+	return keyframe_index_ready() ? entries->len : 0;
+}
+
+gint64 keyframe_index_get_time(int i) {
+	return g_array_index(entries, KeyframeIndexEntry, i).time;
+}
+
+gint64 keyframe_index_get_offset(int i) {
+	return g_array_index(entries, KeyframeIndexEntry, i).offset;
+}
+
+/* Index of the last keyframe at or before the time, - 1 if there is none. */
+
+static int find_keyframe_before(gint64 time) {
+	int lo = 0;
+	int hi = entries->len - 1;
+	int found = - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (keyframe_index_get_time(mid) <= time) {
+			found = mid;
+			lo = mid + 1;
+		}
+		else
+			hi = mid - 1;
+	}
+	return found;
+}
+
+/* Return the time of the keyframe nearest to the time, or the time itself without an index. */
+
+gint64 keyframe_index_snap(gint64 time) {
+	if (!keyframe_index_ready() || entries->len == 0)
+		return time;
+	int i = find_keyframe_before(time);
+	if (i < 0)
+		return keyframe_index_get_time(0);
+	if (i + 1 < entries->len && keyframe_index_get_time(i + 1) - time <
+	time - keyframe_index_get_time(i))
+		i++;
+	return keyframe_index_get_time(i);
+}
+
+/*
+ * Estimate the cost of an accurate seek to the time as the number of frames
+ * that have to be decoded from the preceding keyframe; - 1 when unknown.
+ */
+
+int keyframe_index_estimate_accurate_seek_cost(gint64 time, double framerate) {
+	if (!keyframe_index_ready() || framerate <= 0)
+		return - 1;
+	int i = find_keyframe_before(time);
+	if (i < 0)
+		return - 1;
+	return (int)((time - keyframe_index_get_time(i)) * framerate / GST_SECOND) + 1;
+}
+
+gchar *keyframe_index_get_stats_str() {
+	if (index_filename == NULL)
+		return NULL;
+	if (!keyframe_index_ready())
+		return g_strdup_printf(
+			"Keyframe index:                 %s",
+			g_atomic_int_get(&indexing) ? "indexing" : "not available");
+	gint64 duration = keyframe_index_get_time(entries->len - 1) - keyframe_index_get_time(0);
+	GString *s = g_string_new("");
+	g_string_append_printf(s,
+		"Keyframe index:                 %u keyframes (%s)\n"
+		"Average keyframe interval:      %.2lf s",
+		entries->len, loaded_from_cache ? "cached" : "indexed",
+		entries->len > 1 ? (double)duration / GST_SECOND / (entries->len - 1) : 0);
+	gint64 first_offset = keyframe_index_get_offset(0);
+	gint64 last_offset = keyframe_index_get_offset(entries->len - 1);
+	if (entries->len > 1 && first_offset >= 0 && last_offset > first_offset)
+		g_string_append_printf(s,
+			"\nAverage GOP size:               %.2lf MiB",
+			(double)(last_offset - first_offset) / (1024 * 1024) / (entries->len - 1));
+	return g_string_free(s, FALSE);
+}
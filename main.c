@@ -55,21 +55,34 @@ typedef enum {
 #define DECODEBIN_STR "decodebin2"
 #endif
 
-enum { DECODE_PATH_PLAYBIN = 0, DECODE_PATH_DECODEBIN, 
-	DECODE_PATH_MP4AVI, DECODE_PATH_MP4QT, DECODE_PATH_H264QT,
-	DECODE_PATH_MSMP4AVI };
 enum { VIDEO_SINK_AUTO = 0, VIDEO_SINK_XIMAGE, VIDEO_SINK_XVIMAGE };
 
 /* Command line settings that otherwise are not included in the general configuration. */
 static gboolean full_screen = FALSE;
 static int decode_path = DECODE_PATH_PLAYBIN;
+static gboolean auto_path = FALSE;
+static int auto_path_fallback = DECODE_PATH_PLAYBIN;
 static gboolean preload_file = FALSE;
+static int preload_window = 64;	// Preload window ahead of the playback position in MiB.
 static gboolean verbose = FALSE;
 static gboolean console_mode = FALSE;
 static int width = 0;		// Requested width and height (0 = use video dimension).
 static int height = 0;
+static int bench_startup_repetitions = 0;
+static int bench_source_repetitions = 0;
+static int bench_switch_repetitions = 0;
+static int bench_seek_count = 0;
+static gboolean calibrate = FALSE;
+static gboolean video_sink_requested = FALSE;
+static gboolean audio_sink_requested = FALSE;
+
+/* Default size of the video window when the video dimensions are not yet known. */
+#define PROVISIONAL_WIDTH 1024
+#define PROVISIONAL_HEIGHT 576
 
 GMainLoop *loop;
+static gint64 startup_time;
+static gboolean first_frame_reported = FALSE;
 static const char *current_uri;
 static const char *current_video_title_filename;
 
@@ -84,8 +97,15 @@ static void usage(int argc, char *argv[]) {
 		"    --fullscreen      Use full-screen output.\n"
 		"    --videoonly       Display video only, drop audio.\n"
 		"    --decodebin       Use decodebin instead of playbin.\n"
-		"    --preload         Read the entire file into the buffer cache before\n"
-		"                      playing.\n"
+		"    --preload         Read the file into the buffer cache in the background,\n"
+		"                      keeping a window ahead of the playback position.\n"
+		"    --preload-window <n>\n"
+		"                      Size of the preload window in MiB. Default 64.\n"
+		"    --frame-cache <n> Memory for decoded frames kept for stepping back, in MiB.\n"
+		"                      Default 64, 0 disables it.\n"
+		"    --reverse-cache <n>\n"
+		"                      Memory for decoded frames of reverse playback, in MiB.\n"
+		"                      Default 256, 0 disables it.\n"
 		"    --videosink <snk> Select the video output sink to use (for example\n"
 		"                      xvimagesink or ximagesink). Default autovideosink.\n"
 		"    --audiosink <snk> Select the audio output sink to use (for example\n"
@@ -99,36 +119,88 @@ static void usage(int argc, char *argv[]) {
 		"    --nogui           Enables console mode; this makes it possible to use custom\n"
 		"                      sinks (such as a file sink) from an X terminal without\n"
 		"                      opening a video window.\n"
-		"The following three options can be used to replace playbin or decodebin\n"
+		"    --bench-startup <n>\n"
+		"                      Start the pipeline <n> times without a GUI and print a\n"
+		"                      JSON breakdown of the startup phases. The video and\n"
+		"                      audio sinks default to fakesink.\n"
+		"    --bench-source <n>\n"
+		"                      Read the file <n> times with filesrc and with the\n"
+		"                      memory-mapped source and print the throughput and CPU\n"
+		"                      time as JSON.\n"
+		"    --bench-switch <n> <file> ...\n"
+		"                      Switch between the files <n> times by reusing the\n"
+		"                      playbin and <n> times by recreating the pipeline, and\n"
+		"                      print the time to the first buffer as JSON.\n"
+		"    --bench-seek <n>\n"
+		"                      Do <n> random and <n> sequential seeks, each with key\n"
+		"                      unit and with accurate seeking, and print the time to\n"
+		"                      the first buffer at the video sink as JSON. The video\n"
+		"                      and audio sinks default to fakesink.\n"
+		"    --calibrate [<file> ...]\n"
+		"                      Measure the speed of every installed video decoder on the\n"
+		"                      given clips (or on synthetic clips) and save the ranking.\n"
+		"                      The fastest decoders are preferred from then on.\n"
+		"    --filesrc         Read local files with filesrc instead of the zero-copy\n"
+		"                      memory-mapped source.\n"
+		"    --nogovernor      Don't lower the decode quality when frames are dropped.\n"
+		"    --monitor <list>  Comma-separated names or pids of other processes whose CPU\n"
+		"                      and memory use is shown in the statistics and in the\n"
+		"                      benchmark reports. Default Xorg,Xwayland,pulseaudio,\n"
+		"                      pipewire.\n"
+		"    --decoder-threads <n>\n"
+		"                      Maximum number of video decoder threads (0 lets the\n"
+		"                      decoder decide). Default the number of CPU cores.\n"
+		"    --decoder-thread-type <auto|frame|slice>\n"
+		"                      Video decoder threading method. Frame threading adds a\n"
+		"                      frame of latency per thread. Default auto, or slice on\n"
+		"                      single-core systems.\n"
+		"The following options can be used to replace playbin or decodebin\n"
 		"with a specific decode path, which avoids audio processing completely when\n"
 		"--videoonly is specified.\n"
+		"    --auto-path       Select a direct decode path from the container and video\n"
+		"                      codec of the file, falling back to playbin (or decodebin\n"
+		"                      when --decodebin is given) when none matches.\n"
+		"    --path <name>     Use the named decode path; --<name> does the same. Decode\n"
+		"                      paths can also be defined in\n"
+		"                      ~/.config/gstplay/decode-paths.conf.\n"
 		"    --mp4avi          Use the MPEG4 decode path for .avi files.\n"
 		"    --mp4qt           Use the MPEG4 decode path for .mp4/mov files.\n"
 		"    --h264qt          Use the H.264 decode path for .mov files.\n"
 		"    --msmp4avi        Use the MPEG4 decode path for Microsoft .avi files (using avdec_msmpegv2).\n"
+		"    --h264mkv         Use the H.264 decode path for .mkv files.\n"
+		"    --h264ts          Use the H.264 decode path for MPEG transport streams.\n"
 		);
 }
 
+/* Keep the preloader informed of the playback position. */
+
+static gboolean preload_update_position_cb(gpointer data) {
+	if (!preload_active() || gstreamer_no_pipeline())
+		return TRUE;
+	gboolean error;
+	gint64 position = gstreamer_get_position(&error);
+	gint64 duration = gstreamer_get_duration();
+	if (!error && duration > 0)
+		preload_set_position((double)position / duration);
+	return TRUE;
+}
+
+static guint preload_update_position_cb_id = 0;
+
 static void check_and_preload_file(const char *filename, gboolean preload) {
-	FILE *f;
-	f = fopen(filename, "rb");
-	if (f == NULL) {
+	if (access(filename, R_OK) != 0) {
 		printf("Error: Could not open file %s.\n", filename);
 		exit(1);
 	}
 	if (!preload) {
-		fclose(f);
+		preload_stop();
 		return;
 	}
-	printf("gstplay: Preloading file.\n");
-	char *buffer = malloc(4096 * 32);
-	for (;;) {
-		fread(buffer, 1, 4096 * 32, f);
-		if (feof(f))
-			break;
-	}
-	free(buffer);
-	fclose(f);
+	/* Read ahead in a background thread so that playback can start immediately. */
+	printf("gstplay: Preloading file (%d MiB window).\n", preload_window);
+	preload_start(filename, preload_window);
+	if (preload_update_position_cb_id == 0)
+		preload_update_position_cb_id = g_timeout_add(250, preload_update_position_cb, NULL);
 }
 
 /* Signal handling when running in the console. */
@@ -236,68 +308,135 @@ void main_thread_yield() {
 		printf("gstplay: sched_yield failed.\n");
 }
 
-const char *main_create_pipeline(const char *uri, const char *video_title_filename) {
-	const char *adjusted_video_sink;
+/*
+ * The media probe runs at most once per uri. Its result is remembered, so
+ * that recreating the pipeline for the same uri (reconfiguring, restarting,
+ * opening a file) doesn't probe again.
+ */
+
+static char *probed_uri = NULL;
+/* The local file the probe result is cached for, NULL for other uris. */
+static char *probed_filename = NULL;
+static guint probe_generation = 0;
+static gboolean probed_info_valid = FALSE;
+static MediaInfo probed_info;
+
+static void media_probe_done_cb(const MediaInfo *_info, gpointer data);
+
+/*
+ * Start the media probe for uri unless it was already started. Playbin
+ * identifies the stream anyway, so it doubles as the probe instead of
+ * setting up a second demuxer.
+ */
+
+static void start_media_probe(const char *uri, const char *video_title_filename) {
+	if (probed_uri != NULL && strcmp(probed_uri, uri) == 0)
+		return;
+	g_free(probed_uri);
+	g_free(probed_filename);
+	probed_uri = g_strdup(uri);
+	probed_filename = strncmp(uri, "file://", 7) == 0 ? g_strdup(video_title_filename) : NULL;
+	probed_info_valid = FALSE;
+	probe_generation++;
+	if (decode_path == DECODE_PATH_PLAYBIN)
+		gstreamer_probe_media_at_preroll(media_probe_done_cb,
+			GUINT_TO_POINTER(probe_generation));
+	else
+		gstreamer_probe_media_async(uri, media_probe_done_cb,
+			GUINT_TO_POINTER(probe_generation));
+}
+
+/*
+ * Select the decode path for --auto-path. The container and video codec come
+ * from the media cache when the file has been seen before, or from an
+ * earlier probe of the same uri. Otherwise the fallback path is used and the
+ * media is probed in the background; the result is cached, so that the next
+ * time the file is played (or the pipeline is recreated) the direct path is
+ * selected. Reports whether the stream is known to have no audio.
+ */
+
+static void select_auto_path(const char *uri, const char *video_title_filename,
+gboolean *no_audio) {
+	gboolean local = strncmp(uri, "file://", 7) == 0;
+	MediaInfo info;
+	const char *source = "cached";
+	gboolean found = local && media_cache_lookup(video_title_filename, &info);
+	if (!found && probed_info_valid && strcmp(probed_uri, uri) == 0) {
+		info = probed_info;
+		found = TRUE;
+		source = "probed";
+	}
+	int i = found ? decode_path_select(&info) : - 1;
+	decode_path = i >= 0 ? i : auto_path_fallback;
+	*no_audio = i >= 0 && !info.has_audio;
+	/* The startup benchmark runs its own probes. */
+	if (!found && !bench_enabled()) {
+		start_media_probe(uri, video_title_filename);
+		source = "probing";
+	}
+	if (verbose)
+		printf("gstplay: Selected decode path %s for container %s, video %s (%s)\n",
+			decode_path_get_name(decode_path),
+			found ? info.container : "unknown", found ? info.video_codec : "unknown",
+			found ? source : "probing in the background");
+}
+
+static void free_pipeline_spec(PipelineSpec *spec) {
+	g_free(spec->uri);
+	g_free(spec->location);
+	g_free(spec->demuxer);
+	g_free(spec->parser);
+	g_free(spec->decoder);
+	g_free(spec->video_sink);
+	g_free(spec->audio_sink);
+	g_free(spec->description);
+	g_free(spec);
+}
+
+/*
+ * Create the specification of the pipeline for the uri. It stays valid until
+ * the next call.
+ */
+
+const PipelineSpec *main_create_pipeline(const char *uri, const char *video_title_filename) {
+	static PipelineSpec *spec = NULL;
+	if (spec != NULL)
+		free_pipeline_spec(spec);
+	calibrate_apply_preferred_decoders();
+	spec = g_new0(PipelineSpec, 1);
 	const char *video_sink = config_get_current_video_sink();
 	const char *audio_sink = config_get_current_audio_sink();
-	if (strcmp(video_sink, "ximagesink") == 0)
-		adjusted_video_sink = "videoconvert ! ximagesink";
-	else
-		adjusted_video_sink = video_sink;
-	char *audio_pipeline = malloc(strlen(audio_sink) + 128);
-	sprintf(audio_pipeline, "audioconvert ! audioresample ! %s", audio_sink);
-	if (config_video_only())
-		sprintf(audio_pipeline, "");
-
-	char *source = malloc(strlen(uri) + 64);
-	if (strstr(uri, "file://") != NULL)
-		sprintf(source, "filesrc location=%s", video_title_filename);
+	spec->uri = g_strdup(uri);
+	char *source;
+	if (strstr(uri, "file://") != NULL) {
+		spec->location = g_strdup(video_title_filename);
+		source = g_strdup_printf("%s location=\"%s\"", gstreamer_get_file_source_element(),
+			video_title_filename);
+	}
 	else
 		// Any decode path other than playbin will require
-		// the presence of the dataurissrc from the plugins-bad package
-		// for non-file sources.
-		sprintf(source, "dataurisrc uri=%s", uri);
+		// a source element for the uri scheme, such as
+		// dataurisrc from the plugins-bad package.
+		source = g_strdup_printf("dataurisrc uri=%s", uri);
+
+	gboolean no_audio = FALSE;
+	if (auto_path)
+		select_auto_path(uri, video_title_filename, &no_audio);
 
-	char *s = malloc(strlen(uri) + strlen(audio_sink) + strlen(video_sink) + 256);
-	const char *glue = "";
+	decode_path_get_decoder_threading(decode_path, &spec->decoder_max_threads,
+		&spec->decoder_thread_type);
 	gstreamer_inform_playbin_used(FALSE);
-	if (decode_path != DECODE_PATH_DECODEBIN & decode_path != DECODE_PATH_PLAYBIN) {
-		if (!config_video_only())
-			glue = "demuxer. ! queue ! ";
-		if (decode_path == DECODE_PATH_MSMP4AVI)
-			sprintf(s, "%s ! "
-				"avidemux name=demuxer  demuxer. ! "
-				"queue !"
-				"avdec_msmpeg4v2 ! "
-//				"priority nice=-10 ! "
-//				"queue max-size-buffers=0 max-size-time=1000000000 min-size-time=500000000 ! "
-				"queue !"
-//				"priority nice=-10 ! "
-				"%s  %s%s",
-				source, adjusted_video_sink, glue, audio_pipeline);
-		else if (decode_path == DECODE_PATH_MP4AVI)
-			sprintf(s, "%s ! avidemux name=demuxer  "
-				"demuxer. ! queue ! avdec_mpeg4 ! %s  %s%s", source,
-				adjusted_video_sink, glue, audio_pipeline);
-		else if (decode_path == DECODE_PATH_MP4QT)
-			sprintf(s, "%s ! qtdemux name=demuxer  "
-				"demuxer. ! queue ! avdec_mpeg4 ! %s  %s%s", source,
-				adjusted_video_sink, glue, audio_pipeline);
-		else if (decode_path == DECODE_PATH_H264QT)
-			sprintf(s, "%s ! qtdemux name=demuxer  "
-				"demuxer. ! queue ! avdec_h264 ! %s  %s%s", source,
-				adjusted_video_sink, glue, audio_pipeline);
-	}
-	else if (decode_path == DECODE_PATH_DECODEBIN) {
-		if (!config_video_only())
-			glue = "decoder. ! queue !";
-		sprintf(s, "%s ! " DECODEBIN_STR " name=decoder  decoder. ! queue ! "
-			" %s  %s %s", source,
-			video_title_filename, adjusted_video_sink, glue, audio_pipeline);
+	if (decode_path != DECODE_PATH_PLAYBIN) {
+		if (strcmp(video_sink, "ximagesink") == 0)
+			spec->video_sink = g_strdup("videoconvert ! ximagesink");
+		else
+			spec->video_sink = g_strdup(video_sink);
+		/* Without an audio stream, an audio sink would never preroll. */
+		if (!config_video_only() && !no_audio)
+			spec->audio_sink = g_strdup(audio_sink);
+		decode_path_create_pipeline(decode_path, spec, source);
 	}
 	else {	/* DECODE_PATH_PLAYBIN */
-		char flags_str[80];
-		flags_str[0] = '\0';
 		int default_flags = GST_PLAY_FLAG_VIDEO | GST_PLAY_FLAG_AUDIO |
 				GST_PLAY_FLAG_TEXT |
 				GST_PLAY_FLAG_DEINTERLACE | GST_PLAY_FLAG_SOFT_VOLUME |
@@ -320,22 +459,30 @@ const char *main_create_pipeline(const char *uri, const char *video_title_filena
 #endif
 			/* GStreamer 0.10 doesn't support this flag. */
 			flags &= ~(GST_PLAY_FLAG_SOFT_COLORBALANCE);
-		sprintf(flags_str, " flags=%d", flags);
-		sprintf(s,  PLAYBIN_STR " name=playbin uri=%s video-sink=%s audio-sink=%s%s",
-			uri, video_sink, audio_sink, flags_str);
+		spec->type = PIPELINE_PLAYBIN;
+		spec->video_sink = g_strdup(video_sink);
+		spec->audio_sink = g_strdup(audio_sink);
+		spec->playbin_flags = flags;
+		spec->description = g_strdup_printf(PLAYBIN_STR " name=playbin uri=%s "
+			"video-sink=\"%s\" audio-sink=\"%s\" flags=%d", uri, video_sink, audio_sink,
+			flags);
 		gstreamer_inform_playbin_used(TRUE);
 	}
+	g_free(source);
 	current_uri = uri;
 	current_video_title_filename = video_title_filename;
 	char *str;
 	str = g_strdup_printf("gstplay %s", current_video_title_filename);
 	gui_set_window_title(str);
 	g_free(str);
-	return s;
+	return spec;
 }
 
 void main_create_uri(const char *filespec, char **_uri, char **_video_title_filename) {
 	if (strstr(filespec, "://") != NULL) {
+		preload_stop();
+		keyframe_index_stop();
+		thumbnail_stop();
 		*_uri = strdup(filespec);
 		*_video_title_filename = *_uri;
 	}
@@ -343,6 +490,11 @@ void main_create_uri(const char *filespec, char **_uri, char **_video_title_file
 		*_video_title_filename = strdup(filespec);
 
 		check_and_preload_file(*_video_title_filename, preload_file);
+		/* The keyframe index and thumbnails only serve interactive seeking. */
+		if (main_have_gui()) {
+			keyframe_index_start(*_video_title_filename);
+			thumbnail_start(*_video_title_filename);
+		}
 		char *cwd = getcwd(NULL, 0);
 		char *cwdstr;
 		if ((*_video_title_filename)[0] == '/')
@@ -380,15 +532,418 @@ void main_show_error_message(const char *message, const char *details) {
 	}
 }
 
+void main_first_frame_cb() {
+	if (first_frame_reported)
+		return;
+	first_frame_reported = TRUE;
+	if (verbose)
+		printf("gstplay: Time to first frame: %.1lf ms\n",
+			(g_get_monotonic_time() - startup_time) * 0.001);
+}
+
+/* Called from the main loop when the asynchronous media probe has finished. */
+
+static void media_probe_done_cb(const MediaInfo *_info, gpointer data) {
+	/* Ignore the result of a probe for a uri that is no longer played. */
+	if (GPOINTER_TO_UINT(data) != probe_generation)
+		return;
+	probed_info = *_info;
+	probed_info_valid = _info->container[0] != '\0' && _info->video_codec[0] != '\0';
+	MediaInfo info_copy = *_info;
+	MediaInfo *info = &info_copy;
+	strcpy(info->decode_path, decode_path_get_name(decode_path));
+	if (probed_filename != NULL && info->width != 0 && info->height != 0)
+		media_cache_store(probed_filename, info);
+	if (verbose) {
+		printf("gstplay: Video dimensions %dx%d", info->width, info->height);
+		if (info->framerate_denom != 0)
+			printf(", %.2lf fps", (double)info->framerate_num / info->framerate_denom);
+		printf(", duration %" GST_TIME_FORMAT " (probe took %.1lf ms)\n",
+			GST_TIME_ARGS(info->duration),
+			(g_get_monotonic_time() - startup_time) * 0.001);
+	}
+	if (info->width == 0 || info->height == 0)
+		return;
+	/* Only resize when the user didn't request a specific window size. */
+	if (!main_have_gui() || width != 0 || height != 0 || full_screen)
+		return;
+	gui_set_video_window_size(info->width, info->height);
+}
+
+/*
+ * Startup benchmark. Each repetition runs the probe, creates the pipeline and
+ * brings it to PAUSED; once the first buffer has arrived at the video sink the
+ * pipeline is destroyed and the next repetition starts. The media cache is
+ * bypassed so that every repetition measures the actual probe.
+ */
+
+#define STARTUP_TIMEOUT_US 30000000
+
+static const char *bench_uri;
+static const char *bench_video_title_filename;
+static int bench_repetition;
+static gint64 bench_repetition_start_time;
+
+static void bench_media_probe_done_cb(const MediaInfo *info, gpointer data) {
+	bench_phase_end(BENCH_PHASE_PROBE);
+}
+
+static gboolean bench_start_startup_repetition() {
+	bench_start_repetition();
+	bench_repetition_start_time = g_get_monotonic_time();
+	bench_phase_begin(BENCH_PHASE_PROBE);
+	if (decode_path == DECODE_PATH_PLAYBIN)
+		gstreamer_probe_media_at_preroll(bench_media_probe_done_cb, NULL);
+	else if (!gstreamer_probe_media_async(bench_uri, bench_media_probe_done_cb, NULL)) {
+		fprintf(stderr, "gstplay: Could not start the media probe for the startup "
+			"benchmark.\n");
+		return FALSE;
+	}
+	bench_phase_begin(BENCH_PHASE_CREATE_PIPELINE);
+	const PipelineSpec *spec = main_create_pipeline(bench_uri, bench_video_title_filename);
+	bench_phase_end(BENCH_PHASE_CREATE_PIPELINE);
+	return gstreamer_run_pipeline(loop, spec, STARTUP_PAUSED);
+}
+
+static gboolean bench_startup_poll_cb(gpointer data) {
+	if (gstreamer_no_pipeline()) {
+		/* The pipeline was destroyed because of an error. */
+		g_main_loop_quit(loop);
+		return FALSE;
+	}
+	if (!bench_phase_ended(BENCH_PHASE_FIRST_BUFFER) ||
+	!bench_phase_ended(BENCH_PHASE_PREROLL) || !bench_phase_ended(BENCH_PHASE_PROBE)) {
+		if (g_get_monotonic_time() - bench_repetition_start_time < STARTUP_TIMEOUT_US)
+			return TRUE;
+		fprintf(stderr, "gstplay: Startup benchmark repetition %d timed out.\n",
+			bench_repetition + 1);
+		g_main_loop_quit(loop);
+		return FALSE;
+	}
+	gstreamer_destroy_pipeline();
+	bench_repetition++;
+	if (bench_repetition >= bench_get_repetitions() || !bench_start_startup_repetition()) {
+		g_main_loop_quit(loop);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static int run_startup_benchmark(const char *filespec) {
+	char *uri;
+	char *video_title_filename;
+	main_create_uri(filespec, &uri, &video_title_filename);
+	bench_uri = uri;
+	bench_video_title_filename = video_title_filename;
+	if (!video_sink_requested)
+		config_set_current_video_sink("fakesink");
+	if (!audio_sink_requested)
+		config_set_current_audio_sink("fakesink");
+	loop = g_main_loop_new(NULL, FALSE);
+	bench_repetition = 0;
+	if (bench_start_startup_repetition()) {
+		g_timeout_add(5, bench_startup_poll_cb, NULL);
+		g_main_loop_run(loop);
+	}
+	if (!gstreamer_no_pipeline())
+		gstreamer_destroy_pipeline();
+	g_main_loop_unref(loop);
+	bench_print_startup_report(uri, decode_path_get_name(decode_path),
+		config_get_current_video_sink());
+	return 0;
+}
+
+/*
+ * File switch benchmark. Starting from the first file, every step opens the
+ * next file (cyclically), alternately by switching the running playbin to it
+ * and by destroying the pipeline and creating a new one, and times the
+ * request until the first buffer arrives at the video sink. A step that
+ * doesn't get there within SWITCH_TIMEOUT_US fails, and only the pairs of
+ * steps that both completed are reported.
+ */
+
+#define SWITCH_TIMEOUT_US 30000000
+
+static int switch_nu_files;
+static char **switch_uris;
+static char **switch_video_title_filenames;
+static int switch_step;
+static gint64 switch_step_start_time;
+/* The switch step of the current pair, - 1 when it failed. */
+static gint64 pending_switch_us;
+static int switch_nu_pairs;
+static gint64 *switch_us;
+static gint64 *recreate_us;
+
+/* Odd steps switch the playbin, even steps recreate the pipeline. */
+
+static gboolean bench_start_switch_step() {
+	bench_start_repetition();
+	switch_step_start_time = g_get_monotonic_time();
+	int i = switch_step % switch_nu_files;
+	const PipelineSpec *spec = main_create_pipeline(switch_uris[i],
+		switch_video_title_filenames[i]);
+	bench_phase_begin(BENCH_PHASE_FIRST_BUFFER);
+	if (switch_step % 2 == 1) {
+		if (!gstreamer_switch_uri(spec, STARTUP_PAUSED)) {
+			fprintf(stderr, "gstplay: The switch benchmark requires the playbin decode "
+				"path.\n");
+			return FALSE;
+		}
+		return TRUE;
+	}
+	gstreamer_destroy_pipeline();
+	return gstreamer_run_pipeline(loop, spec, STARTUP_PAUSED);
+}
+
+static gboolean bench_switch_poll_cb(gpointer data) {
+	if (gstreamer_no_pipeline()) {
+		g_main_loop_quit(loop);
+		return FALSE;
+	}
+	gint64 duration = - 1;
+	if (bench_phase_ended(BENCH_PHASE_FIRST_BUFFER) && bench_phase_ended(BENCH_PHASE_PREROLL))
+		duration = bench_get_phase_duration(BENCH_PHASE_FIRST_BUFFER);
+	else {
+		if (g_get_monotonic_time() - switch_step_start_time < SWITCH_TIMEOUT_US)
+			return TRUE;
+		fprintf(stderr, "gstplay: Switch benchmark step %d timed out.\n", switch_step);
+		/* Without the initial startup there is nothing to switch from. */
+		if (switch_step == 0) {
+			g_main_loop_quit(loop);
+			return FALSE;
+		}
+	}
+	/* Step 0 is the initial startup, which is not counted. */
+	if (switch_step > 0 && switch_step % 2 == 1)
+		pending_switch_us = duration;
+	else if (switch_step > 0 && pending_switch_us >= 0 && duration >= 0) {
+		switch_us[switch_nu_pairs] = pending_switch_us;
+		recreate_us[switch_nu_pairs] = duration;
+		switch_nu_pairs++;
+	}
+	if (switch_step == 2 * bench_switch_repetitions) {
+		g_main_loop_quit(loop);
+		return FALSE;
+	}
+	switch_step++;
+	if (!bench_start_switch_step()) {
+		g_main_loop_quit(loop);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static int run_switch_benchmark(int nu_files, char **files) {
+	switch_nu_files = nu_files;
+	switch_uris = g_new(char *, nu_files);
+	switch_video_title_filenames = g_new(char *, nu_files);
+	for (int i = 0; i < nu_files; i++)
+		main_create_uri(files[i], &switch_uris[i], &switch_video_title_filenames[i]);
+	switch_us = g_new0(gint64, bench_switch_repetitions);
+	recreate_us = g_new0(gint64, bench_switch_repetitions);
+	if (!video_sink_requested)
+		config_set_current_video_sink("fakesink");
+	if (!audio_sink_requested)
+		config_set_current_audio_sink("fakesink");
+	bench_init(2 * bench_switch_repetitions);
+	loop = g_main_loop_new(NULL, FALSE);
+	switch_step = 0;
+	switch_nu_pairs = 0;
+	bench_start_repetition();
+	switch_step_start_time = g_get_monotonic_time();
+	const PipelineSpec *spec = main_create_pipeline(switch_uris[0],
+		switch_video_title_filenames[0]);
+	if (gstreamer_run_pipeline(loop, spec, STARTUP_PAUSED)) {
+		g_timeout_add(5, bench_switch_poll_cb, NULL);
+		g_main_loop_run(loop);
+	}
+	if (!gstreamer_no_pipeline())
+		gstreamer_destroy_pipeline();
+	g_main_loop_unref(loop);
+	/* Only complete pairs of steps are reported. */
+	int n = switch_nu_pairs;
+	bench_print_switch_report(nu_files, files, config_get_current_video_sink(), switch_us,
+		recreate_us, n);
+	return n == bench_switch_repetitions ? 0 : 1;
+}
+
+/*
+ * Seek benchmark. After the pipeline has prerolled, the same random targets
+ * (with a fixed seed) are visited with key unit and with accurate seeks, and
+ * then evenly spaced targets from start to end. Every seek is timed from the
+ * request to the first buffer after the flush at the video sink; the next
+ * seek starts when the pipeline has prerolled again.
+ */
+
+#define SEEK_TIMEOUT_US 10000000
+
+static gint64 seek_duration;
+static gint64 *seek_targets[BENCH_NU_SEEK_SERIES];
+static gint64 *seek_us[BENCH_NU_SEEK_SERIES];
+static int seek_nu_samples[BENCH_NU_SEEK_SERIES];
+static int seek_series;
+static int seek_index;
+static gboolean seek_in_progress;
+static gint64 seek_start_time;
+
+static gboolean bench_start_seek() {
+	static const SeekMode mode[BENCH_NU_SEEK_SERIES] = {
+		SEEK_MODE_KEY_UNIT, SEEK_MODE_ACCURATE, SEEK_MODE_KEY_UNIT, SEEK_MODE_ACCURATE
+	};
+	bench_start_repetition();
+	seek_in_progress = TRUE;
+	seek_start_time = g_get_monotonic_time();
+	return gstreamer_bench_seek(seek_targets[seek_series][seek_index], mode[seek_series]);
+}
+
+static gboolean bench_seek_poll_cb(gpointer data) {
+	if (gstreamer_no_pipeline()) {
+		g_main_loop_quit(loop);
+		return FALSE;
+	}
+	if (!seek_in_progress) {
+		/* Wait for the initial preroll. */
+		if (!bench_phase_ended(BENCH_PHASE_FIRST_BUFFER) ||
+		!bench_phase_ended(BENCH_PHASE_PREROLL))
+			return TRUE;
+		seek_duration = gstreamer_get_duration();
+		if (seek_duration <= 0) {
+			fprintf(stderr, "gstplay: The seek benchmark requires a stream with a known "
+				"duration.\n");
+			g_main_loop_quit(loop);
+			return FALSE;
+		}
+		GRand *rand = g_rand_new_with_seed(1);
+		for (int i = 0; i < bench_seek_count; i++) {
+			/* Stay clear of the end of the stream. */
+			seek_targets[0][i] = seek_targets[1][i] =
+				g_rand_double(rand) * seek_duration * 0.95;
+			seek_targets[2][i] = seek_targets[3][i] =
+				seek_duration * 0.95 * (i + 1) / (bench_seek_count + 1);
+		}
+		g_rand_free(rand);
+		seek_series = 0;
+		seek_index = 0;
+	}
+	else {
+		if (!gstreamer_bench_seek_done()) {
+			if (g_get_monotonic_time() - seek_start_time < SEEK_TIMEOUT_US)
+				return TRUE;
+			fprintf(stderr, "gstplay: Seek to %.3lf s timed out.\n",
+				seek_targets[seek_series][seek_index] * 0.000000001);
+		}
+		else
+			seek_us[seek_series][seek_nu_samples[seek_series]++] =
+				bench_get_phase_duration(BENCH_PHASE_FIRST_BUFFER);
+		gstreamer_bench_seek_end();
+		seek_index++;
+		if (seek_index == bench_seek_count) {
+			seek_series++;
+			seek_index = 0;
+		}
+		if (seek_series == BENCH_NU_SEEK_SERIES) {
+			g_main_loop_quit(loop);
+			return FALSE;
+		}
+	}
+	if (!bench_start_seek()) {
+		fprintf(stderr, "gstplay: Could not find the video sink for the seek benchmark.\n");
+		g_main_loop_quit(loop);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static int run_seek_benchmark(const char *filespec) {
+	char *uri;
+	char *video_title_filename;
+	main_create_uri(filespec, &uri, &video_title_filename);
+	if (!video_sink_requested)
+		config_set_current_video_sink("fakesink");
+	if (!audio_sink_requested)
+		config_set_current_audio_sink("fakesink");
+	for (int i = 0; i < BENCH_NU_SEEK_SERIES; i++) {
+		seek_targets[i] = g_new0(gint64, bench_seek_count);
+		seek_us[i] = g_new0(gint64, bench_seek_count);
+		seek_nu_samples[i] = 0;
+	}
+	bench_init(BENCH_NU_SEEK_SERIES * bench_seek_count);
+	loop = g_main_loop_new(NULL, FALSE);
+	seek_in_progress = FALSE;
+	bench_start_repetition();
+	const PipelineSpec *spec = main_create_pipeline(uri, video_title_filename);
+	if (gstreamer_run_pipeline(loop, spec, STARTUP_PAUSED)) {
+		g_timeout_add(1, bench_seek_poll_cb, NULL);
+		g_main_loop_run(loop);
+	}
+	gstreamer_bench_seek_end();
+	if (!gstreamer_no_pipeline())
+		gstreamer_destroy_pipeline();
+	g_main_loop_unref(loop);
+	bench_print_seek_report(uri, decode_path_get_name(decode_path),
+		config_get_current_video_sink(), seek_duration, bench_seek_count, seek_us,
+		seek_nu_samples);
+	gboolean complete = TRUE;
+	for (int i = 0; i < BENCH_NU_SEEK_SERIES; i++)
+		if (seek_nu_samples[i] != bench_seek_count)
+			complete = FALSE;
+	return complete ? 0 : 1;
+}
+
+/*
+ * Source benchmark. The file is read once beforehand so that all sources read
+ * from the page cache and the copying and page fault overhead is measured
+ * rather than the disk.
+ */
+
+static int run_source_benchmark(const char *filename) {
+	const char *sources[] = { "filesrc", "filesrc blocksize=2097152", MMAPSRC_ELEMENT_NAME };
+	int nu_sources = 3;
+	if (strcmp(gstreamer_get_file_source_element(), MMAPSRC_ELEMENT_NAME) != 0)
+		/* The memory-mapped source is not available. */
+		nu_sources = 2;
+	gint64 wall_us[3][bench_source_repetitions];
+	gint64 cpu_us[3][bench_source_repetitions];
+	gint64 *wall_us_p[3] = { wall_us[0], wall_us[1], wall_us[2] };
+	gint64 *cpu_us_p[3] = { cpu_us[0], cpu_us[1], cpu_us[2] };
+	guint64 size;
+	gint64 t;
+	if (!gstreamer_bench_source("filesrc", filename, &t, &t, &size))
+		return 1;
+	/* Measure the process usage over the timed reads only. */
+	bench_init(bench_source_repetitions);
+	for (int j = 0; j < bench_source_repetitions; j++)
+		for (int i = 0; i < nu_sources; i++) {
+			guint64 bytes;
+			if (!gstreamer_bench_source(sources[i], filename, &wall_us[i][j], &cpu_us[i][j],
+			&bytes))
+				return 1;
+			if (bytes != size)
+				fprintf(stderr, "gstplay: Warning: %s read %" G_GUINT64_FORMAT
+					" bytes instead of %" G_GUINT64_FORMAT ".\n", sources[i], bytes, size);
+		}
+	bench_print_source_report(filename, nu_sources, sources, wall_us_p, cpu_us_p, size);
+	return 0;
+}
+
 int main(int argc, char *argv[]) {
 	int argi = 1;
 
+	startup_time = g_get_monotonic_time();
+
 	config_init();
 
 	gstreamer_init(&argc, &argv);
+	gint64 gst_init_time = g_get_monotonic_time() - startup_time;
+
+	decode_path_init();
+	calibrate_init();
 
+	gint64 t = g_get_monotonic_time();
 	if (!gui_init(&argc, &argv))
 		console_mode = TRUE;
+	gint64 gui_init_time = g_get_monotonic_time() - t;
 
 	/* Process options. */
 	for (;;) {
@@ -427,38 +982,148 @@ int main(int argc, char *argv[]) {
 			argi++;
 			continue;
 		}
-		if (strcasecmp(argv[argi], "--mp4avi") == 0) {
-			decode_path = DECODE_PATH_MP4AVI;
+		if (strcasecmp(argv[argi], "--auto-path") == 0) {
+			auto_path = TRUE;
 			argi++;
 			continue;
 		}
-		if (strcasecmp(argv[argi], "--mp4qt") == 0) {
-			decode_path = DECODE_PATH_MP4QT;
+		if (strcasecmp(argv[argi], "--path") == 0 && argi + 1 < argc) {
+			decode_path = decode_path_lookup(argv[argi + 1]);
+			if (decode_path < 0) {
+				printf("gstplay: Unknown decode path %s.\n", argv[argi + 1]);
+				return 1;
+			}
+			argi += 2;
+			continue;
+		}
+		/* The direct decode paths can also be selected with --<name>. */
+		if (strncmp(argv[argi], "--", 2) == 0 && decode_path_lookup(argv[argi] + 2) >= 0) {
+			decode_path = decode_path_lookup(argv[argi] + 2);
 			argi++;
 			continue;
 		}
-		if (strcasecmp(argv[argi], "--h264qt") == 0) {
-			decode_path = DECODE_PATH_H264QT;
+		if (strcasecmp(argv[argi], "--preload") == 0) {
+			preload_file = TRUE;
 			argi++;
 			continue;
 		}
-		if (strcasecmp(argv[argi], "--msmp4avi") == 0) {
-			decode_path = DECODE_PATH_MSMP4AVI;
+		if (strcasecmp(argv[argi], "--calibrate") == 0) {
+			calibrate = TRUE;
 			argi++;
 			continue;
 		}
-		if (strcasecmp(argv[argi], "--preload") == 0) {
-			preload_file = TRUE;
+		if (strcasecmp(argv[argi], "--filesrc") == 0) {
+			gstreamer_set_mmap_source_enabled(FALSE);
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--nogovernor") == 0) {
+			governor_set_enabled(FALSE);
 			argi++;
 			continue;
 		}
+		if (strcasecmp(argv[argi], "--decoder-threads") == 0 && argi + 1 < argc) {
+			int n = atoi(argv[argi + 1]);
+			if (n < 0 || n > 256) {
+				printf("gstplay: Number of decoder threads out of range.\n");
+				return 1;
+			}
+			config_set_decoder_max_threads(n);
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--decoder-thread-type") == 0 && argi + 1 < argc) {
+			DecoderThreadType type;
+			if (!decode_path_parse_thread_type(argv[argi + 1], &type)) {
+				printf("gstplay: Unknown decoder thread type %s.\n", argv[argi + 1]);
+				return 1;
+			}
+			config_set_decoder_thread_type(type);
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--bench-source") == 0 && argi + 1 < argc) {
+			bench_source_repetitions = atoi(argv[argi + 1]);
+			if (bench_source_repetitions <= 0) {
+				printf("Number of benchmark repetitions out of range.\n");
+				return 1;
+			}
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--bench-seek") == 0 && argi + 1 < argc) {
+			bench_seek_count = atoi(argv[argi + 1]);
+			if (bench_seek_count <= 0) {
+				printf("Number of benchmark repetitions out of range.\n");
+				return 1;
+			}
+			console_mode = TRUE;
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--bench-switch") == 0 && argi + 1 < argc) {
+			bench_switch_repetitions = atoi(argv[argi + 1]);
+			if (bench_switch_repetitions <= 0) {
+				printf("Number of benchmark repetitions out of range.\n");
+				return 1;
+			}
+			console_mode = TRUE;
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--preload-window") == 0 && argi + 1 < argc) {
+			preload_window = atoi(argv[argi + 1]);
+			if (preload_window <= 0) {
+				printf("gstplay: Invalid preload window size.\n");
+				return 1;
+			}
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--monitor") == 0 && argi + 1 < argc) {
+			stats_set_monitored_processes(argv[argi + 1]);
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--frame-cache") == 0 && argi + 1 < argc) {
+			int frame_cache = atoi(argv[argi + 1]);
+			if (frame_cache < 0) {
+				printf("gstplay: Invalid frame cache size.\n");
+				return 1;
+			}
+			frame_ring_set_budget(frame_cache);
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--reverse-cache") == 0 && argi + 1 < argc) {
+			int reverse_cache = atoi(argv[argi + 1]);
+			if (reverse_cache < 0) {
+				printf("gstplay: Invalid reverse playback cache size.\n");
+				return 1;
+			}
+			reverse_playback_set_budget(reverse_cache);
+			argi += 2;
+			continue;
+		}
 		if (strcasecmp(argv[argi], "--videosink") == 0 && argi + 1 < argc) {
 			config_set_current_video_sink(argv[argi + 1]);
+			video_sink_requested = TRUE;
 			argi += 2;
 			continue;
                 }
 		if (strcasecmp(argv[argi], "--audiosink") == 0 && argi + 1 < argc) {
 			config_set_current_audio_sink(argv[argi + 1]);
+			audio_sink_requested = TRUE;
+			argi += 2;
+			continue;
+                }
+		if (strcasecmp(argv[argi], "--bench-startup") == 0 && argi + 1 < argc) {
+			bench_startup_repetitions = atoi(argv[argi + 1]);
+			if (bench_startup_repetitions <= 0) {
+				printf("Number of benchmark repetitions out of range.\n");
+				return 1;
+			}
+			console_mode = TRUE;
 			argi += 2;
 			continue;
                 }
@@ -510,6 +1175,47 @@ int main(int argc, char *argv[]) {
 		break;
 	}
 
+	if (auto_path && decode_path_is_generic(decode_path))
+		auto_path_fallback = decode_path;
+
+	if (calibrate)
+		return calibrate_run(argc - argi, argv + argi);
+
+	if (bench_source_repetitions > 0) {
+		if (argi >= argc || strstr(argv[argi], "://") != NULL) {
+			printf("gstplay: The source benchmark requires a local filename.\n");
+			return 1;
+		}
+		return run_source_benchmark(argv[argi]);
+	}
+
+	if (bench_switch_repetitions > 0) {
+		if (argi >= argc) {
+			printf("gstplay: No filenames or uris specified.\n");
+			return 1;
+		}
+		return run_switch_benchmark(argc - argi, argv + argi);
+	}
+
+	if (bench_seek_count > 0) {
+		if (argi >= argc) {
+			printf("gstplay: No filename or uri specified.\n");
+			return 1;
+		}
+		return run_seek_benchmark(argv[argi]);
+	}
+
+	if (bench_startup_repetitions > 0) {
+		if (argi >= argc) {
+			printf("gstplay: No filename or uri specified.\n");
+			return 1;
+		}
+		bench_init(bench_startup_repetitions);
+		bench_add_sample(BENCH_PHASE_GST_INIT, gst_init_time);
+		bench_add_sample(BENCH_PHASE_GUI_INIT, gui_init_time);
+		return run_startup_benchmark(argv[argi]);
+	}
+
 	if (argi >= argc) {
 		if (console_mode) {
 			printf("gstplay: No filename or uri specified.\n");
@@ -518,9 +1224,9 @@ int main(int argc, char *argv[]) {
 		/* Run in interactive mode. */
 		loop = g_main_loop_new(NULL, FALSE);
 		if (width == 0)
-			width = 1024;
+			width = PROVISIONAL_WIDTH;
 		if (height == 0)
-			height = 576;
+			height = PROVISIONAL_HEIGHT;
 		gui_setup_window(loop, "", width, height, full_screen);
 		g_main_loop_run(loop);
 		g_main_loop_unref(loop);
@@ -531,28 +1237,42 @@ int main(int argc, char *argv[]) {
 	char *video_title_filename;
 	main_create_uri(argv[argi], &uri, &video_title_filename);
 
-	/* Determine the video dimensions when running in GUI mode. */
-	int video_width, video_height;
-	if (main_have_gui()) {
-		gstreamer_determine_video_dimensions(uri, &video_width, &video_height);
-		if (verbose)
-			printf("gstplay: Video dimensions %dx%d\n", video_width, video_height);
-	}
-
-	const char *s = main_create_pipeline(uri, video_title_filename);
+	const PipelineSpec *spec = main_create_pipeline(uri, video_title_filename);
 
 	loop = g_main_loop_new(NULL, FALSE);
 
+	/*
+	 * In GUI mode, size the window from the media cache when the file has been
+	 * seen before. Otherwise create the window with a provisional size and probe
+	 * the video dimensions while the real pipeline is already starting up; the
+	 * window is resized when the probe finishes.
+	 */
 	if (main_have_gui()) {
-		if (width == 0)
-			width = video_width;
-		if (height == 0)
-			height = video_height;
-		gui_setup_window(loop, video_title_filename, width, height, full_screen);
+		gint64 t = g_get_monotonic_time();
+		MediaInfo info;
+		if (strstr(argv[argi], "://") == NULL &&
+		media_cache_lookup(video_title_filename, &info)) {
+			if (verbose)
+				printf("gstplay: Media cache hit, video dimensions %dx%d, %s, %s\n",
+					info.width, info.height, info.container, info.video_codec);
+			gui_setup_window(loop, video_title_filename,
+				width != 0 ? width : info.width,
+				height != 0 ? height : info.height, full_screen);
+		}
+		else {
+			gui_setup_window(loop, video_title_filename,
+				width != 0 ? width : PROVISIONAL_WIDTH,
+				height != 0 ? height : PROVISIONAL_HEIGHT, full_screen);
+			start_media_probe(uri, video_title_filename);
+		}
+		if (verbose)
+			printf("gstplay: Window set up in %.1lf ms (%.1lf ms after startup)\n",
+				(g_get_monotonic_time() - t) * 0.001,
+				(g_get_monotonic_time() - startup_time) * 0.001);
 	}
 
 	if (verbose)
-		printf("gstplay: pipeline: %s\n", s);
+		printf("gstplay: pipeline: %s\n", spec->description);
 	printf("gstplay: Playing %s\n", video_title_filename);
 
 	/*
@@ -566,12 +1286,16 @@ int main(int argc, char *argv[]) {
 		install_fault_handlers();
 	}
 
-	if (!gstreamer_run_pipeline(loop, s, config_get_startup_preference())) {
+	if (!gstreamer_run_pipeline(loop, spec, config_get_startup_preference())) {
 		main_show_error_message("Pipeline parse problem.", "");
 	}
 
 	g_main_loop_run(loop);
 
+	preload_stop();
+	keyframe_index_stop();
+	thumbnail_stop();
+
 	if (!gstreamer_no_pipeline())
 		gstreamer_destroy_pipeline();
 
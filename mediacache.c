@@ -0,0 +1,205 @@
+/*
+    gstplay -- Simple gstreamer-based media player
+
+    Copyright 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+    gstplay is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    gstplay is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with gstplay.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Persistent media metadata cache.
+ *
+ * The cache is a single file, $XDG_CACHE_HOME/gstplay/media-cache, that is
+ * memory-mapped and consists of a header followed by a fixed-size hash table
+ * of entries. An entry is keyed by the canonical path of the file together
+ * with its size and modification time, so a file that is replaced or modified
+ * is probed again. Collisions are resolved with linear probing over at most
+ * MAX_PROBE_DISTANCE slots; when no free slot is found the home slot is
+ * overwritten.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <glib.h>
+#include "gstplay.h"
+
+#define MEDIA_CACHE_MAGIC 0x434d5047	/* "GPMC" */
+#define MEDIA_CACHE_VERSION 2
+#define NU_SLOTS 1024
+#define MAX_PROBE_DISTANCE 16
+#define MAX_PATH_LENGTH 448
+
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	guint32 nu_slots;
+	guint32 entry_size;
+} MediaCacheHeader;
+
+typedef struct {
+	guint32 hash;		/* 0 means the slot is empty. */
+	guint32 reserved;
+	gint64 size;
+	gint64 mtime_sec;
+	gint64 mtime_nsec;
+	char path[MAX_PATH_LENGTH];
+	MediaInfo info;
+} MediaCacheEntry;
+
+#define MEDIA_CACHE_FILE_SIZE (sizeof(MediaCacheHeader) + NU_SLOTS * sizeof(MediaCacheEntry))
+
+static gboolean media_cache_initialized = FALSE;
+static MediaCacheHeader *media_cache_header = NULL;
+static MediaCacheEntry *media_cache_entries;
+
+static void media_cache_init() {
+	media_cache_initialized = TRUE;
+	char *dir = g_build_filename(g_get_user_cache_dir(), "gstplay", NULL);
+	g_mkdir_with_parents(dir, 0755);
+	char *filename = g_build_filename(dir, "media-cache", NULL);
+	g_free(dir);
+	int fd = open(filename, O_RDWR | O_CREAT, 0644);
+	g_free(filename);
+	if (fd < 0) {
+		printf("gstplay: Could not open media cache file.\n");
+		return;
+	}
+	struct stat st;
+	gboolean reset = FALSE;
+	if (fstat(fd, &st) < 0 || st.st_size != MEDIA_CACHE_FILE_SIZE) {
+		/* New file or different layout; the file stays sparse until entries are written. */
+		if (ftruncate(fd, 0) < 0 || ftruncate(fd, MEDIA_CACHE_FILE_SIZE) < 0) {
+			printf("gstplay: Could not resize media cache file.\n");
+			close(fd);
+			return;
+		}
+		reset = TRUE;
+	}
+	void *p = mmap(NULL, MEDIA_CACHE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		printf("gstplay: Could not map media cache file.\n");
+		return;
+	}
+	media_cache_header = p;
+	media_cache_entries = (MediaCacheEntry *)((char *)p + sizeof(MediaCacheHeader));
+	if (!reset && (media_cache_header->magic != MEDIA_CACHE_MAGIC ||
+	media_cache_header->version != MEDIA_CACHE_VERSION ||
+	media_cache_header->nu_slots != NU_SLOTS ||
+	media_cache_header->entry_size != sizeof(MediaCacheEntry)))
+		reset = TRUE;
+	if (reset) {
+		memset(p, 0, MEDIA_CACHE_FILE_SIZE);
+		media_cache_header->magic = MEDIA_CACHE_MAGIC;
+		media_cache_header->version = MEDIA_CACHE_VERSION;
+		media_cache_header->nu_slots = NU_SLOTS;
+		media_cache_header->entry_size = sizeof(MediaCacheEntry);
+	}
+}
+
+/*
+ * Determine the key of a local file. Returns FALSE if the file can't be
+ * used as a cache key.
+ */
+
+static gboolean get_key(const char *filename, char *path, struct stat *st, guint32 *hash) {
+	char *canonical_path = realpath(filename, NULL);
+	if (canonical_path == NULL)
+		return FALSE;
+	if (strlen(canonical_path) >= MAX_PATH_LENGTH || stat(canonical_path, st) < 0) {
+		free(canonical_path);
+		return FALSE;
+	}
+	strcpy(path, canonical_path);
+	free(canonical_path);
+	*hash = g_str_hash(path);
+	if (*hash == 0)
+		*hash = 1;
+	return TRUE;
+}
+
+static gboolean entry_matches(const MediaCacheEntry *entry, guint32 hash, const char *path) {
+	return entry->hash == hash && strcmp(entry->path, path) == 0;
+}
+
+gboolean media_cache_lookup(const char *filename, MediaInfo *info) {
+	if (!media_cache_initialized)
+		media_cache_init();
+	if (media_cache_header == NULL)
+		return FALSE;
+	char path[MAX_PATH_LENGTH];
+	struct stat st;
+	guint32 hash;
+	if (!get_key(filename, path, &st, &hash))
+		return FALSE;
+	for (int i = 0; i < MAX_PROBE_DISTANCE; i++) {
+		MediaCacheEntry *entry = &media_cache_entries[(hash + i) % NU_SLOTS];
+		if (entry->hash == 0)
+			return FALSE;
+		if (!entry_matches(entry, hash, path))
+			continue;
+		if (entry->size != st.st_size || entry->mtime_sec != st.st_mtim.tv_sec ||
+		entry->mtime_nsec != st.st_mtim.tv_nsec)
+			/* The file has changed since it was cached. */
+			return FALSE;
+		*info = entry->info;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+void media_cache_store(const char *filename, const MediaInfo *info) {
+	if (!media_cache_initialized)
+		media_cache_init();
+	if (media_cache_header == NULL)
+		return;
+	char path[MAX_PATH_LENGTH];
+	struct stat st;
+	guint32 hash;
+	if (!get_key(filename, path, &st, &hash))
+		return;
+	/* Reuse the slot of an older entry for the same path, or the first free slot. */
+	MediaCacheEntry *entry = NULL;
+	for (int i = 0; i < MAX_PROBE_DISTANCE; i++) {
+		MediaCacheEntry *e = &media_cache_entries[(hash + i) % NU_SLOTS];
+		if (e->hash == 0 || entry_matches(e, hash, path)) {
+			entry = e;
+			break;
+		}
+	}
+	if (entry == NULL)
+		entry = &media_cache_entries[hash % NU_SLOTS];
+	/*
+	 * Invalidate the slot while it is being written so that a concurrently
+	 * running instance never sees a half-written entry.
+	 */
+	entry->hash = 0;
+	__sync_synchronize();
+	entry->size = st.st_size;
+	entry->mtime_sec = st.st_mtim.tv_sec;
+	entry->mtime_nsec = st.st_mtim.tv_nsec;
+	strcpy(entry->path, path);
+	entry->info = *info;
+	__sync_synchronize();
+	entry->hash = hash;
+}
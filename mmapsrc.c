@@ -0,0 +1,306 @@
+/*
+    gstplay -- Simple gstreamer-based media player
+
+    Copyright 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+    gstplay is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    gstplay is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with gstplay.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * gstplaymmapsrc, a file source element that memory-maps the file and hands
+ * out read-only buffers that point directly into the mapping, so that no data
+ * is copied between the page cache and the demuxer. The element handles
+ * file:// uris with a rank above filesrc, so playbin picks it up for local
+ * files; the custom decode paths refer to it by name.
+ *
+ * The mapping is reference counted and only unmapped when the last buffer
+ * pointing into it has been freed. As with any mmap-based reader, truncating
+ * the file while it is being played results in SIGBUS.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <gst/gst.h>
+#include <glib.h>
+#include "gstplay.h"
+
+#if GST_CHECK_VERSION(1, 0, 0)
+
+#include <gst/base/gstbasesrc.h>
+
+/* Default size of the buffers produced in push mode. */
+#define DEFAULT_BLOCKSIZE (2 * 1024 * 1024)
+
+typedef struct {
+	gint ref_count;
+	guint8 *data;
+	gsize size;
+} MmapRegion;
+
+typedef struct {
+	GstBaseSrc parent;
+	gchar *location;
+	MmapRegion *region;
+} GstPlayMmapSrc;
+
+typedef struct {
+	GstBaseSrcClass parent_class;
+} GstPlayMmapSrcClass;
+
+enum { PROP_0, PROP_LOCATION };
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src",
+	GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static void gst_play_mmap_src_uri_handler_init(gpointer g_iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE(GstPlayMmapSrc, gst_play_mmap_src, GST_TYPE_BASE_SRC,
+	G_IMPLEMENT_INTERFACE(GST_TYPE_URI_HANDLER, gst_play_mmap_src_uri_handler_init));
+
+static void mmap_region_unref(gpointer data) {
+	MmapRegion *region = data;
+	if (!g_atomic_int_dec_and_test(&region->ref_count))
+		return;
+	munmap(region->data, region->size);
+	g_free(region);
+}
+
+static gboolean gst_play_mmap_src_set_location(GstPlayMmapSrc *src, const gchar *location) {
+	GstState state;
+	GST_OBJECT_LOCK(src);
+	state = GST_STATE(src);
+	if (state != GST_STATE_READY && state != GST_STATE_NULL) {
+		GST_OBJECT_UNLOCK(src);
+		return FALSE;
+	}
+	g_free(src->location);
+	src->location = g_strdup(location);
+	GST_OBJECT_UNLOCK(src);
+	g_object_notify(G_OBJECT(src), "location");
+	return TRUE;
+}
+
+static void gst_play_mmap_src_set_property(GObject *object, guint prop_id,
+const GValue *value, GParamSpec *pspec) {
+	GstPlayMmapSrc *src = (GstPlayMmapSrc *)object;
+	switch (prop_id) {
+	case PROP_LOCATION:
+		gst_play_mmap_src_set_location(src, g_value_get_string(value));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void gst_play_mmap_src_get_property(GObject *object, guint prop_id, GValue *value,
+GParamSpec *pspec) {
+	GstPlayMmapSrc *src = (GstPlayMmapSrc *)object;
+	switch (prop_id) {
+	case PROP_LOCATION:
+		GST_OBJECT_LOCK(src);
+		g_value_set_string(value, src->location);
+		GST_OBJECT_UNLOCK(src);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void gst_play_mmap_src_finalize(GObject *object) {
+	GstPlayMmapSrc *src = (GstPlayMmapSrc *)object;
+	g_free(src->location);
+	G_OBJECT_CLASS(gst_play_mmap_src_parent_class)->finalize(object);
+}
+
+static gboolean gst_play_mmap_src_start(GstBaseSrc *basesrc) {
+	GstPlayMmapSrc *src = (GstPlayMmapSrc *)basesrc;
+	if (src->location == NULL) {
+		GST_ELEMENT_ERROR(src, RESOURCE, NOT_FOUND, ("No file name specified."), (NULL));
+		return FALSE;
+	}
+	int fd = open(src->location, O_RDONLY);
+	if (fd < 0) {
+		GST_ELEMENT_ERROR(src, RESOURCE, OPEN_READ,
+			("Could not open file \"%s\" for reading.", src->location), GST_ERROR_SYSTEM);
+		return FALSE;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		GST_ELEMENT_ERROR(src, RESOURCE, OPEN_READ,
+			("\"%s\" is not a regular, non-empty file.", src->location), (NULL));
+		close(fd);
+		return FALSE;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		GST_ELEMENT_ERROR(src, RESOURCE, OPEN_READ,
+			("Could not map file \"%s\".", src->location), GST_ERROR_SYSTEM);
+		return FALSE;
+	}
+	/* Let the kernel read ahead aggressively and drop pages behind. */
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	src->region = g_new(MmapRegion, 1);
+	src->region->ref_count = 1;
+	src->region->data = data;
+	src->region->size = st.st_size;
+	return TRUE;
+}
+
+static gboolean gst_play_mmap_src_stop(GstBaseSrc *basesrc) {
+	GstPlayMmapSrc *src = (GstPlayMmapSrc *)basesrc;
+	if (src->region != NULL)
+		mmap_region_unref(src->region);
+	src->region = NULL;
+	return TRUE;
+}
+
+static gboolean gst_play_mmap_src_is_seekable(GstBaseSrc *basesrc) {
+	return TRUE;
+}
+
+static gboolean gst_play_mmap_src_get_size(GstBaseSrc *basesrc, guint64 *size) {
+	GstPlayMmapSrc *src = (GstPlayMmapSrc *)basesrc;
+	if (src->region == NULL)
+		return FALSE;
+	*size = src->region->size;
+	return TRUE;
+}
+
+static GstFlowReturn gst_play_mmap_src_create(GstBaseSrc *basesrc, guint64 offset, guint length,
+GstBuffer **buffer) {
+	GstPlayMmapSrc *src = (GstPlayMmapSrc *)basesrc;
+	MmapRegion *region = src->region;
+	if (offset >= region->size)
+		return GST_FLOW_EOS;
+	if (length > region->size - offset)
+		length = region->size - offset;
+	/* The buffer is a read-only view of the mapping; it holds a reference to it. */
+	g_atomic_int_inc(&region->ref_count);
+	GstBuffer *buf = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, region->data,
+		region->size, offset, length, region, mmap_region_unref);
+	GST_BUFFER_OFFSET(buf) = offset;
+	GST_BUFFER_OFFSET_END(buf) = offset + length;
+	*buffer = buf;
+	return GST_FLOW_OK;
+}
+
+static void gst_play_mmap_src_class_init(GstPlayMmapSrcClass *klass) {
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+	GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+	GstBaseSrcClass *basesrc_class = GST_BASE_SRC_CLASS(klass);
+	gobject_class->set_property = gst_play_mmap_src_set_property;
+	gobject_class->get_property = gst_play_mmap_src_get_property;
+	gobject_class->finalize = gst_play_mmap_src_finalize;
+	g_object_class_install_property(gobject_class, PROP_LOCATION,
+		g_param_spec_string("location", "File Location", "Location of the file to read",
+		NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	gst_element_class_set_static_metadata(element_class, "Memory-mapped file source",
+		"Source/File", "Read from a file without copying by memory-mapping it",
+		"gstplay");
+	gst_element_class_add_pad_template(element_class,
+		gst_static_pad_template_get(&src_template));
+	basesrc_class->start = gst_play_mmap_src_start;
+	basesrc_class->stop = gst_play_mmap_src_stop;
+	basesrc_class->is_seekable = gst_play_mmap_src_is_seekable;
+	basesrc_class->get_size = gst_play_mmap_src_get_size;
+	basesrc_class->create = gst_play_mmap_src_create;
+}
+
+static void gst_play_mmap_src_init(GstPlayMmapSrc *src) {
+	src->location = NULL;
+	src->region = NULL;
+	gst_base_src_set_blocksize(GST_BASE_SRC(src), DEFAULT_BLOCKSIZE);
+}
+
+/* URI handler, for file:// uris only. */
+
+static GstURIType gst_play_mmap_src_uri_get_type(GType type) {
+	return GST_URI_SRC;
+}
+
+static const gchar *const *gst_play_mmap_src_uri_get_protocols(GType type) {
+	static const gchar *protocols[] = { "file", NULL };
+	return protocols;
+}
+
+static gchar *gst_play_mmap_src_uri_get_uri(GstURIHandler *handler) {
+	GstPlayMmapSrc *src = (GstPlayMmapSrc *)handler;
+	gchar *uri = NULL;
+	GST_OBJECT_LOCK(src);
+	if (src->location != NULL)
+		uri = gst_filename_to_uri(src->location, NULL);
+	GST_OBJECT_UNLOCK(src);
+	return uri;
+}
+
+static gboolean gst_play_mmap_src_uri_set_uri(GstURIHandler *handler, const gchar *uri,
+GError **error) {
+	gchar *location = g_filename_from_uri(uri, NULL, error);
+	if (location == NULL)
+		return FALSE;
+	gboolean res = gst_play_mmap_src_set_location((GstPlayMmapSrc *)handler, location);
+	g_free(location);
+	if (!res)
+		g_set_error(error, GST_URI_ERROR, GST_URI_ERROR_BAD_STATE,
+			"Changing the location while the element is running is not supported.");
+	return res;
+}
+
+static void gst_play_mmap_src_uri_handler_init(gpointer g_iface, gpointer iface_data) {
+	GstURIHandlerInterface *iface = (GstURIHandlerInterface *)g_iface;
+	iface->get_type = gst_play_mmap_src_uri_get_type;
+	iface->get_protocols = gst_play_mmap_src_uri_get_protocols;
+	iface->get_uri = gst_play_mmap_src_uri_get_uri;
+	iface->set_uri = gst_play_mmap_src_uri_set_uri;
+}
+
+gboolean mmapsrc_register() {
+	/* Rank it above filesrc so that playbin picks it for file:// uris. */
+	return gst_element_register(NULL, MMAPSRC_ELEMENT_NAME, GST_RANK_PRIMARY + 1,
+		gst_play_mmap_src_get_type());
+}
+
+/* Lower the rank to let playbin fall back to filesrc. */
+
+void mmapsrc_set_preferred(gboolean status) {
+	GstElementFactory *factory = gst_element_factory_find(MMAPSRC_ELEMENT_NAME);
+	if (factory == NULL)
+		return;
+	gst_plugin_feature_set_rank(GST_PLUGIN_FEATURE(factory),
+		status ? GST_RANK_PRIMARY + 1 : GST_RANK_NONE);
+	gst_object_unref(factory);
+}
+
+#else
+
+/* Zero-copy buffers are not implemented for gstreamer 0.10; filesrc is used. */
+
+gboolean mmapsrc_register() {
+	return FALSE;
+}
+
+void mmapsrc_set_preferred(gboolean status) {
+}
+
+#endif
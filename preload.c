@@ -0,0 +1,228 @@
+/*
+    gstplay -- Simple gstreamer-based media player
+
+    Copyright 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+    gstplay is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    gstplay is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with gstplay.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Background readahead of the file being played. A thread keeps a window of
+ * the file ahead of the playback position in the page cache (readahead() in
+ * large chunks) and drops the pages behind the playback position with
+ * POSIX_FADV_DONTNEED, so that playback can start immediately and large files
+ * don't thrash the page cache. The playback position is reported by the main
+ * thread as a fraction of the duration and converted to a byte offset.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <glib.h>
+#include "gstplay.h"
+
+#define MIB ((gint64)1024 * 1024)
+/* Size of each readahead() request. */
+#define CHUNK_SIZE (8 * MIB)
+/* Pages closer than this behind the playback position are kept. */
+#define KEEP_BEHIND_SIZE (4 * MIB)
+/* Size of the region at the playback position checked for page cache hits. */
+#define HIT_CHECK_SIZE (256 * 1024)
+#define POLL_INTERVAL_MS 100
+
+static GThread *thread = NULL;
+static GMutex mutex;
+static GCond cond;
+static gboolean stop_requested;
+static int fd = - 1;
+static void *mapping = NULL;
+static gint64 file_size;
+static gint64 window_size;
+static double position_fraction;
+
+/* Statistics, protected by the mutex. */
+static gint64 stats_position;
+static gint64 stats_read_ahead_until;
+static gint64 stats_dropped_until;
+static guint64 stats_hits;
+static guint64 stats_misses;
+
+static gboolean region_is_resident(gint64 offset, gint64 size) {
+	long page_size = sysconf(_SC_PAGESIZE);
+	offset &= ~(gint64)(page_size - 1);
+	if (offset + size > file_size)
+		size = file_size - offset;
+	if (size <= 0)
+		return TRUE;
+	int nu_pages = (size + page_size - 1) / page_size;
+	unsigned char vec[nu_pages];
+	if (mincore((char *)mapping + offset, size, vec) < 0)
+		return FALSE;
+	for (int i = 0; i < nu_pages; i++)
+		if (!(vec[i] & 1))
+			return FALSE;
+	return TRUE;
+}
+
+static gpointer preload_thread_func(gpointer data) {
+	gint64 read_ahead_until = 0;
+	gint64 dropped_until = 0;
+	gint64 last_sampled_position = - 1;
+	g_mutex_lock(&mutex);
+	while (!stop_requested) {
+		gint64 position = position_fraction * file_size;
+		g_mutex_unlock(&mutex);
+
+		/* Sample once per position update, not for every chunk. */
+		if (mapping != NULL && position != last_sampled_position) {
+			last_sampled_position = position;
+			gboolean hit = region_is_resident(position, HIT_CHECK_SIZE);
+			g_mutex_lock(&mutex);
+			if (hit)
+				stats_hits++;
+			else
+				stats_misses++;
+			g_mutex_unlock(&mutex);
+		}
+
+		/* After a backward seek, start reading ahead from the new position again. */
+		if (position < read_ahead_until - window_size || position > read_ahead_until)
+			read_ahead_until = position;
+		if (dropped_until > position)
+			dropped_until = 0;
+
+		/* Drop the pages behind the playback position. */
+		if (position - KEEP_BEHIND_SIZE > dropped_until) {
+			posix_fadvise(fd, dropped_until, position - KEEP_BEHIND_SIZE - dropped_until,
+				POSIX_FADV_DONTNEED);
+			dropped_until = position - KEEP_BEHIND_SIZE;
+		}
+
+		/* Read ahead one chunk at a time until the window is filled. */
+		gint64 end = position + window_size;
+		if (end > file_size)
+			end = file_size;
+		if (read_ahead_until < end) {
+			gint64 size = end - read_ahead_until;
+			if (size > CHUNK_SIZE)
+				size = CHUNK_SIZE;
+			if (readahead(fd, read_ahead_until, size) < 0)
+				posix_fadvise(fd, read_ahead_until, size, POSIX_FADV_WILLNEED);
+			read_ahead_until += size;
+		}
+
+		g_mutex_lock(&mutex);
+		stats_position = position;
+		stats_read_ahead_until = read_ahead_until;
+		stats_dropped_until = dropped_until;
+		/* Keep going without waiting while the window is not yet filled. */
+		if (read_ahead_until >= end && !stop_requested) {
+			gint64 end_time = g_get_monotonic_time() + POLL_INTERVAL_MS * 1000;
+			g_cond_wait_until(&cond, &mutex, end_time);
+		}
+	}
+	g_mutex_unlock(&mutex);
+	return NULL;
+}
+
+void preload_stop() {
+	if (thread == NULL)
+		return;
+	g_mutex_lock(&mutex);
+	stop_requested = TRUE;
+	g_cond_signal(&cond);
+	g_mutex_unlock(&mutex);
+	g_thread_join(thread);
+	thread = NULL;
+	if (mapping != NULL)
+		munmap(mapping, file_size);
+	mapping = NULL;
+	close(fd);
+	fd = - 1;
+}
+
+void preload_start(const char *filename, int window_size_mib) {
+	preload_stop();
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		printf("gstplay: Could not open %s for preloading.\n", filename);
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		fd = - 1;
+		return;
+	}
+	file_size = st.st_size;
+	window_size = window_size_mib * MIB;
+	/* The mapping is only used to check page cache residency with mincore(). */
+	mapping = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED)
+		mapping = NULL;
+	position_fraction = 0;
+	stop_requested = FALSE;
+	stats_position = 0;
+	stats_read_ahead_until = 0;
+	stats_dropped_until = 0;
+	stats_hits = 0;
+	stats_misses = 0;
+	thread = g_thread_new("gstplay-preload", preload_thread_func, NULL);
+}
+
+gboolean preload_active() {
+	return thread != NULL;
+}
+
+/* Report the playback position as a fraction of the duration. */
+
+void preload_set_position(double fraction) {
+	if (thread == NULL)
+		return;
+	if (fraction < 0)
+		fraction = 0;
+	if (fraction > 1.0)
+		fraction = 1.0;
+	g_mutex_lock(&mutex);
+	position_fraction = fraction;
+	g_mutex_unlock(&mutex);
+}
+
+gchar *preload_get_stats_str() {
+	if (thread == NULL)
+		return NULL;
+	g_mutex_lock(&mutex);
+	gint64 ahead = stats_read_ahead_until - stats_position;
+	guint64 samples = stats_hits + stats_misses;
+	gchar *s = g_strdup_printf(
+		"Preload window:                 %.0lf MiB\n"
+		"Playback position:              %.1lf / %.1lf MiB\n"
+		"Read ahead until:               %.1lf MiB (%.1lf MiB ahead)\n"
+		"Dropped behind until:           %.1lf MiB\n"
+		"Page cache hits at position:    %.1lf%% (%" G_GUINT64_FORMAT " samples)",
+		(double)window_size / MIB,
+		(double)stats_position / MIB, (double)file_size / MIB,
+		(double)stats_read_ahead_until / MIB, (double)(ahead > 0 ? ahead : 0) / MIB,
+		(double)stats_dropped_until / MIB,
+		samples == 0 ? 0 : (double)stats_hits * 100.0 / samples, samples);
+	g_mutex_unlock(&mutex);
+	return s;
+}
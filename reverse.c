@@ -0,0 +1,530 @@
+/*
+    gstplay -- Simple gstreamer-based media player
+
+    Copyright 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+    gstplay is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    gstplay is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with gstplay.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Reverse playback. Negative-rate seeks perform badly with most demuxers and
+ * decoders, so instead a worker thread runs a decode pipeline of its own and
+ * decodes one GOP at a time forwards: a key unit seek to just before the
+ * start of the GOP that was decoded last, with that start as the stop
+ * position. The frames of a GOP, converted to the caps of the video sink of
+ * the playback pipeline, are kept in a frame cache. A presenter thread shows
+ * them backwards on the (paused) video sink, following a clock that runs
+ * backwards at the requested rate, while the worker already decodes the
+ * previous GOP. At most two GOPs are cached; when a GOP doesn't fit in half of
+ * the memory budget, every other frame of it is dropped.
+ *
+ * Frames from a buffer pool with a maximum number of buffers are copied into
+ * the cache, since holding two GOPs of them would starve the decoder. Sinks
+ * that take frames in other than system memory, such as GLMemory, are not
+ * supported; the caller then falls back to a negative-rate seek.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <glib.h>
+#include "gstplay.h"
+
+#define DEFAULT_BUDGET_MIB 256
+#define POLL_INTERVAL_MS 100
+
+#if GST_CHECK_VERSION(1, 0, 0)
+
+typedef struct {
+	GPtrArray *frames;	/* GstBuffers in increasing timestamp order. */
+	gsize bytes;
+	gint64 start;		/* Timestamp of the first (key) frame. */
+} Gop;
+
+static GMutex mutex;
+static GCond cond;
+static GThread *worker_thread = NULL;
+static GThread *presenter_thread = NULL;
+static gboolean active = FALSE;
+static gboolean stop_requested;
+static gboolean paused;
+/* Restart the presentation clock from the shown frame. */
+static gboolean reset_clock;
+static double rate;
+static char *uri = NULL;
+static gpointer sink = NULL;
+static gpointer caps = NULL;
+static double frame_duration;
+/* Stop position of the next GOP to decode. */
+static gint64 next_gop_end;
+static gboolean reached_start;
+static gboolean failed;
+static Gop *prefetched_gop = NULL;
+static Gop *current_gop = NULL;
+/* The GOP being decoded, filled by the probe on the worker's sink. */
+static Gop *decoding_gop = NULL;
+static int keep_stride;
+static int nu_decoded_frames;
+static gint64 position;
+static gsize cache_bytes;
+static gsize peak_cache_bytes;
+static int nu_gops;
+static int nu_stalls;
+static int budget_mib = DEFAULT_BUDGET_MIB;
+/* The pool of the last decoded frame, and whether it has a maximum size. */
+static GstBufferPool *last_pool;
+static gboolean bounded_pool;
+
+static Gop *gop_new() {
+	Gop *gop = g_new0(Gop, 1);
+	gop->frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+	return gop;
+}
+
+/* Free a GOP; called with the mutex held. */
+
+static void gop_free(Gop *gop) {
+	if (gop == NULL)
+		return;
+	cache_bytes -= gop->bytes;
+	g_ptr_array_free(gop->frames, TRUE);
+	g_free(gop);
+}
+
+static void update_cache_bytes(gssize delta) {
+	cache_bytes += delta;
+	if (cache_bytes > peak_cache_bytes)
+		peak_cache_bytes = cache_bytes;
+}
+
+/* Drop every other frame of the GOP being decoded and of the frames still to come. */
+
+static void decimate_decoding_gop() {
+	GPtrArray *frames = decoding_gop->frames;
+	for (int i = frames->len - 1; i > 0; i -= 2) {
+		gsize size = gst_buffer_get_size(g_ptr_array_index(frames, i));
+		decoding_gop->bytes -= size;
+		update_cache_bytes(- (gssize)size);
+		g_ptr_array_remove_index(frames, i);
+	}
+	keep_stride *= 2;
+}
+
+/* Copy a frame into memory of its own, so that the pool gets its buffer back. */
+
+static GstBuffer *copy_frame(GstBuffer *buffer) {
+#if GST_CHECK_VERSION(1, 6, 0)
+	return gst_buffer_copy_deep(buffer);
+#else
+	GstBuffer *copy = gst_buffer_new_allocate(NULL, gst_buffer_get_size(buffer), NULL);
+	gst_buffer_copy_into(copy, buffer, GST_BUFFER_COPY_METADATA, 0, - 1);
+	GstMapInfo map;
+	gst_buffer_map(copy, &map, GST_MAP_WRITE);
+	gst_buffer_extract(buffer, 0, map.data, map.size);
+	gst_buffer_unmap(copy, &map);
+	return copy;
+#endif
+}
+
+static GstPadProbeReturn reverse_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer data) {
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	if (!GST_BUFFER_PTS_IS_VALID(buffer))
+		return GST_PAD_PROBE_OK;
+	g_mutex_lock(&mutex);
+	if (buffer->pool != last_pool) {
+		last_pool = buffer->pool;
+		bounded_pool = last_pool != NULL && gstreamer_buffer_pool_is_bounded(last_pool);
+	}
+	if (decoding_gop != NULL && GST_BUFFER_PTS(buffer) < next_gop_end &&
+	nu_decoded_frames++ % keep_stride == 0) {
+		GstBuffer *last = decoding_gop->frames->len > 0 ? g_ptr_array_index(
+			decoding_gop->frames, decoding_gop->frames->len - 1) : NULL;
+		if (last == NULL || GST_BUFFER_PTS(buffer) > GST_BUFFER_PTS(last)) {
+			g_ptr_array_add(decoding_gop->frames, bounded_pool ? copy_frame(buffer) :
+				gst_buffer_ref(buffer));
+			decoding_gop->bytes += gst_buffer_get_size(buffer);
+			update_cache_bytes(gst_buffer_get_size(buffer));
+			if (decoding_gop->bytes > (gsize)budget_mib * 1024 * 1024 / 2)
+				decimate_decoding_gop();
+		}
+	}
+	g_mutex_unlock(&mutex);
+	return GST_PAD_PROBE_OK;
+}
+
+static void decodebin_pad_added_cb(GstElement *decodebin, GstPad *pad, gpointer data) {
+	GstElement *convert = data;
+	GstPad *sink_pad = gst_element_get_static_pad(convert, "sink");
+	GstCaps *pad_caps = gst_pad_query_caps(pad, NULL);
+	if (!gst_pad_is_linked(sink_pad) && gst_caps_get_size(pad_caps) > 0 && g_str_has_prefix(
+	gst_structure_get_name(gst_caps_get_structure(pad_caps, 0)), "video/"))
+		gst_pad_link(pad, sink_pad);
+	gst_caps_unref(pad_caps);
+	gst_object_unref(sink_pad);
+}
+
+/* Wait for a message of the type; returns FALSE on error, stop or an unexpected EOS. */
+
+static gboolean wait_for_message(GstBus *bus, GstMessageType type) {
+	for (;;) {
+		g_mutex_lock(&mutex);
+		gboolean stop = stop_requested;
+		g_mutex_unlock(&mutex);
+		if (stop)
+			return FALSE;
+		GstMessage *msg = gst_bus_timed_pop_filtered(bus, POLL_INTERVAL_MS * GST_MSECOND,
+			type | GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+		if (msg == NULL)
+			continue;
+		gboolean found = GST_MESSAGE_TYPE(msg) & type;
+		gst_message_unref(msg);
+		return found;
+	}
+}
+
+/* Decode the GOP that ends at next_gop_end; returns FALSE on failure or stop. */
+
+static gboolean decode_gop(GstElement *pipeline, GstBus *bus) {
+	g_mutex_lock(&mutex);
+	decoding_gop = gop_new();
+	keep_stride = 1;
+	nu_decoded_frames = 0;
+	gint64 end = next_gop_end;
+	g_mutex_unlock(&mutex);
+	gst_element_set_state(pipeline, GST_STATE_PAUSED);
+	gboolean ok = gst_element_seek(pipeline, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH |
+		GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE, GST_SEEK_TYPE_SET,
+		MAX(end - 1, 0), GST_SEEK_TYPE_SET, end) &&
+		wait_for_message(bus, GST_MESSAGE_ASYNC_DONE);
+	if (ok) {
+		gst_element_set_state(pipeline, GST_STATE_PLAYING);
+		/* The stop position ends the segment with EOS. */
+		ok = wait_for_message(bus, GST_MESSAGE_EOS);
+	}
+	g_mutex_lock(&mutex);
+	Gop *gop = decoding_gop;
+	decoding_gop = NULL;
+	if (ok && gop->frames->len > 0) {
+		gop->start = GST_BUFFER_PTS((GstBuffer *)g_ptr_array_index(gop->frames, 0));
+		reached_start = gop->start >= end || gop->start <= frame_duration / 2;
+		next_gop_end = gop->start;
+		prefetched_gop = gop;
+		nu_gops++;
+	}
+	else {
+		gop_free(gop);
+		if (ok)
+			reached_start = TRUE;
+		else
+			failed = !stop_requested;
+	}
+	g_cond_broadcast(&cond);
+	g_mutex_unlock(&mutex);
+	return ok;
+}
+
+static gpointer worker_thread_func(gpointer data) {
+	GstElement *pipeline = gst_pipeline_new("reverse");
+	GstElement *decodebin = gst_element_factory_make("uridecodebin", NULL);
+	GstElement *convert = gst_element_factory_make("videoconvert", NULL);
+	GstElement *scale = gst_element_factory_make("videoscale", NULL);
+	GstElement *filter = gst_element_factory_make("capsfilter", NULL);
+	GstElement *fakesink = gst_element_factory_make("fakesink", NULL);
+	if (decodebin == NULL || convert == NULL || scale == NULL || filter == NULL ||
+	fakesink == NULL) {
+		g_mutex_lock(&mutex);
+		failed = TRUE;
+		g_cond_broadcast(&cond);
+		g_mutex_unlock(&mutex);
+		gst_object_unref(pipeline);
+		return NULL;
+	}
+	g_object_set(decodebin, "uri", uri, NULL);
+	g_object_set(filter, "caps", caps, NULL);
+	g_object_set(fakesink, "sync", FALSE, NULL);
+	gst_bin_add_many(GST_BIN(pipeline), decodebin, convert, scale, filter, fakesink, NULL);
+	gst_element_link_many(convert, scale, filter, fakesink, NULL);
+	g_signal_connect(decodebin, "pad-added", G_CALLBACK(decodebin_pad_added_cb), convert);
+	GstPad *pad = gst_element_get_static_pad(fakesink, "sink");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, reverse_probe_cb, NULL, NULL);
+	gst_object_unref(pad);
+	GstBus *bus = gst_element_get_bus(pipeline);
+
+	gst_element_set_state(pipeline, GST_STATE_PAUSED);
+	gboolean ok = wait_for_message(bus, GST_MESSAGE_ASYNC_DONE);
+	while (ok) {
+		g_mutex_lock(&mutex);
+		/* Decode the previous GOP as soon as the cached one is taken. */
+		while (!stop_requested && (prefetched_gop != NULL || reached_start))
+			g_cond_wait(&cond, &mutex);
+		gboolean stop = stop_requested;
+		g_mutex_unlock(&mutex);
+		if (stop)
+			break;
+		ok = decode_gop(pipeline, bus);
+	}
+	if (!ok) {
+		g_mutex_lock(&mutex);
+		failed = !stop_requested && !reached_start;
+		g_cond_broadcast(&cond);
+		g_mutex_unlock(&mutex);
+	}
+	gst_element_set_state(pipeline, GST_STATE_NULL);
+	gst_object_unref(bus);
+	gst_object_unref(pipeline);
+	return NULL;
+}
+
+/* Index of the frame to show at the time: the last one at or before it. */
+
+static int find_frame(Gop *gop, gint64 time) {
+	int i = gop->frames->len - 1;
+	while (i > 0 && GST_BUFFER_PTS((GstBuffer *)g_ptr_array_index(gop->frames, i)) > time)
+		i--;
+	return i;
+}
+
+static gpointer presenter_thread_func(gpointer data) {
+	g_mutex_lock(&mutex);
+	/* The presentation clock runs backwards from media_anchor at the rate. */
+	gint64 media_anchor = position;
+	gint64 wall_anchor = g_get_monotonic_time();
+	GstBuffer *shown = NULL;
+	while (!stop_requested) {
+		if (paused) {
+			g_cond_wait(&cond, &mutex);
+			continue;
+		}
+		if (reset_clock) {
+			media_anchor = position;
+			wall_anchor = g_get_monotonic_time();
+			reset_clock = FALSE;
+		}
+		gint64 now = g_get_monotonic_time();
+		gint64 media_time = media_anchor - (gint64)((now - wall_anchor) * 1000 * rate);
+		if (current_gop == NULL || media_time < current_gop->start) {
+			if (prefetched_gop == NULL) {
+				if (reached_start || failed) {
+					/* Stay on the first frame. */
+					paused = TRUE;
+					continue;
+				}
+				if (current_gop != NULL)
+					nu_stalls++;
+				g_cond_wait(&cond, &mutex);
+				/* Don't skip the frames that arrived late. */
+				reset_clock = TRUE;
+				continue;
+			}
+			gop_free(current_gop);
+			current_gop = prefetched_gop;
+			prefetched_gop = NULL;
+			g_cond_broadcast(&cond);
+			continue;
+		}
+		int i = find_frame(current_gop, media_time);
+		GstBuffer *buffer = g_ptr_array_index(current_gop->frames, i);
+		if (buffer != shown) {
+			shown = buffer;
+			position = GST_BUFFER_PTS(buffer);
+			gst_buffer_ref(buffer);
+			g_mutex_unlock(&mutex);
+			gstreamer_render_video_frame(sink, buffer);
+			gst_buffer_unref(buffer);
+			g_mutex_lock(&mutex);
+			continue;
+		}
+		/* Sleep until the clock passes the start of the shown frame. */
+		gint64 wait = (gint64)((media_time - GST_BUFFER_PTS(buffer)) / (1000 * rate)) + 1;
+		g_cond_wait_until(&cond, &mutex, now + MIN(wait, POLL_INTERVAL_MS * 1000));
+	}
+	g_mutex_unlock(&mutex);
+	return NULL;
+}
+
+/* Whether the caps describe frames in system memory, which the cache can hold. */
+
+static gboolean caps_are_system_memory(GstCaps *caps) {
+#if GST_CHECK_VERSION(1, 2, 0)
+	for (guint i = 0; i < gst_caps_get_size(caps); i++) {
+		GstCapsFeatures *features = gst_caps_get_features(caps, i);
+		if (features != NULL && !gst_caps_features_is_any(features) &&
+		!gst_caps_features_contains(features, GST_CAPS_FEATURE_MEMORY_SYSTEM_MEMORY))
+			return FALSE;
+	}
+#endif
+	return TRUE;
+}
+
+/*
+ * Start reverse playback from the position at the rate (positive, 1.0 is
+ * normal speed). The playback pipeline has to be paused and prerolled; the
+ * frames are shown on its rendering video sink. Returns FALSE when the frame
+ * cache is disabled, the sink caps can't be determined or the sink doesn't
+ * take system memory.
+ */
+
+gboolean reverse_playback_start(const char *_uri, gpointer rendering_sink, gint64 _position,
+double _rate, double framerate) {
+	reverse_playback_stop();
+	if (budget_mib <= 0)
+		return FALSE;
+	GstPad *pad = gst_element_get_static_pad(rendering_sink, "sink");
+	if (pad == NULL)
+		return FALSE;
+	GstCaps *sink_caps = gst_pad_get_current_caps(pad);
+	gst_object_unref(pad);
+	if (sink_caps == NULL)
+		return FALSE;
+	if (!caps_are_system_memory(sink_caps)) {
+		printf("gstplay: Reverse playback needs a video sink that takes system memory.\n");
+		gst_caps_unref(sink_caps);
+		return FALSE;
+	}
+	caps = sink_caps;
+	sink = gst_object_ref(rendering_sink);
+	uri = g_strdup(_uri);
+	rate = _rate;
+	frame_duration = GST_SECOND / framerate;
+	position = _position;
+	next_gop_end = _position + (gint64)frame_duration;
+	stop_requested = FALSE;
+	paused = FALSE;
+	reset_clock = FALSE;
+	reached_start = FALSE;
+	failed = FALSE;
+	cache_bytes = 0;
+	peak_cache_bytes = 0;
+	nu_gops = 0;
+	nu_stalls = 0;
+	last_pool = NULL;
+	bounded_pool = FALSE;
+	active = TRUE;
+	worker_thread = g_thread_new("gstplay-reverse", worker_thread_func, NULL);
+	presenter_thread = g_thread_new("gstplay-reverse-present", presenter_thread_func, NULL);
+	return TRUE;
+}
+
+/* Stop reverse playback and return the position of the frame shown last. */
+
+gint64 reverse_playback_stop() {
+	if (!active)
+		return - 1;
+	g_mutex_lock(&mutex);
+	stop_requested = TRUE;
+	g_cond_broadcast(&cond);
+	g_mutex_unlock(&mutex);
+	g_thread_join(worker_thread);
+	g_thread_join(presenter_thread);
+	worker_thread = NULL;
+	presenter_thread = NULL;
+	g_mutex_lock(&mutex);
+	gop_free(current_gop);
+	gop_free(prefetched_gop);
+	current_gop = NULL;
+	prefetched_gop = NULL;
+	g_mutex_unlock(&mutex);
+	gst_object_unref(sink);
+	gst_caps_unref(caps);
+	g_free(uri);
+	sink = NULL;
+	caps = NULL;
+	uri = NULL;
+	active = FALSE;
+	return position;
+}
+
+gboolean reverse_playback_active() {
+	return active;
+}
+
+/* Memory budget of the frame cache in MiB; 0 disables it. Takes effect on the next start. */
+
+void reverse_playback_set_budget(int mib) {
+	budget_mib = mib;
+}
+
+void reverse_playback_set_paused(gboolean status) {
+	g_mutex_lock(&mutex);
+	paused = status;
+	reset_clock = TRUE;
+	g_cond_broadcast(&cond);
+	g_mutex_unlock(&mutex);
+}
+
+void reverse_playback_set_rate(double _rate) {
+	g_mutex_lock(&mutex);
+	rate = _rate;
+	reset_clock = TRUE;
+	g_cond_broadcast(&cond);
+	g_mutex_unlock(&mutex);
+}
+
+gint64 reverse_playback_get_position() {
+	g_mutex_lock(&mutex);
+	gint64 pos = position;
+	g_mutex_unlock(&mutex);
+	return pos;
+}
+
+gchar *reverse_playback_get_stats_str() {
+	if (!active)
+		return NULL;
+	g_mutex_lock(&mutex);
+	gchar *s = g_strdup_printf(
+		"Reverse playback:               %.2lfx%s%s\n"
+		"Reverse frame cache:            %.1lf MiB (peak %.1lf MiB, budget %d MiB)\n"
+		"GOPs decoded:                   %d (%d stalls)",
+		- rate, bounded_pool ? " (frames copied)" : "", failed ? " (decoding failed)" : "",
+		cache_bytes / (1024.0 * 1024.0), peak_cache_bytes / (1024.0 * 1024.0),
+		budget_mib, nu_gops, nu_stalls);
+	g_mutex_unlock(&mutex);
+	return s;
+}
+
+#else
+
+gboolean reverse_playback_start(const char *_uri, gpointer rendering_sink, gint64 _position,
+double _rate, double framerate) {
+	return FALSE;
+}
+
+gint64 reverse_playback_stop() {
+	return - 1;
+}
+
+gboolean reverse_playback_active() {
+	return FALSE;
+}
+
+void reverse_playback_set_budget(int mib) {
+}
+
+void reverse_playback_set_paused(gboolean status) {
+}
+
+void reverse_playback_set_rate(double _rate) {
+}
+
+gint64 reverse_playback_get_position() {
+	return 0;
+}
+
+gchar *reverse_playback_get_stats_str() {
+	return NULL;
+}
+
+#endif
@@ -28,8 +28,8 @@
 #include <sys/resource.h>
 #include <sched.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdint.h>
-#include <glob.h>
 #include <glib.h>
 #include <glib-object.h>
 #include "gstplay.h"
@@ -37,308 +37,636 @@
 static gboolean thread_info_enabled = FALSE;
 
 /*
- * Get pid of process by name.
+ * CPU usage sampling. A sampler thread reads /proc/stat and /proc/self/stat,
+ * and the stat file of every thread when thread info is enabled, at a fixed
+ * interval. The files are kept open and re-read with pread() into a fixed
+ * buffer, and parsed without allocating.
+ *
+ * Other processes that take part in playback (the X server, the sound server,
+ * the compositor) can be monitored as well, see stats_set_monitored_processes().
+ * A process that is not found when sampling starts is not looked for again; a
+ * process that exits is looked for once more at the next RESOLVE_INTERVAL_MS
+ * tick of the sampler, so that a restarted helper is picked up.
+ *
+ * The samples go into a ring buffer holding the last HISTORY_SECONDS. The
+ * sampler is the only writer; every slot carries the number of the sample in
+ * it (0 while it is being written), so that readers can copy samples out
+ * without a lock and detect a slot that was overwritten in the meantime.
  */
 
-static pid_t find_pid(const char *process_name)
-{
-	pid_t pid = -1;
-	glob_t pglob;
-	char *procname, *readbuf;
-	int buflen = strlen(process_name) + 2;
-	unsigned i;
-
-	/* Get a list of all comm files. man 5 proc */
-	if (glob("/proc/*/comm", 0, NULL, &pglob) != 0)
-		return pid;
-
-	/* The comm files include trailing newlines, so... */
-	procname = malloc(buflen);
-	strcpy(procname, process_name);
-	procname[buflen - 2] = '\n';
-	procname[buflen - 1] = 0;
-
-	/* readbuff will hold the contents of the comm files. */
-	readbuf = malloc(buflen);
-
-	for (i = 0; i < pglob.gl_pathc; ++i) {
-		FILE *comm;
-		char *ret;
-
-		/* Read the contents of the file. */
-		if ((comm = fopen(pglob.gl_pathv[i], "r")) == NULL)
-			continue;
-		ret = fgets(readbuf, buflen, comm);
-		fclose(comm);
-		if (ret == NULL)
-			continue;
+#define SAMPLE_INTERVAL_MS 200
+#define HISTORY_SECONDS 120
+#define HISTORY_LENGTH (HISTORY_SECONDS * 1000 / SAMPLE_INTERVAL_MS)
+#define STAT_BUFFER_SIZE 1024
+#define RESOLVE_INTERVAL_MS 10000
 
-		/*
-		   If comm matches our process name, extract the process ID from the
-		   path, convert it to a pid_t, and return it.
-		 */
-		if (strcmp(readbuf, procname) == 0) {
-			pid =
-			    (pid_t) atoi(pglob.gl_pathv[i] + strlen("/proc/"));
-			break;
-		}
-	}
+typedef struct {
+	char name[16];
+	guint64 utime_ticks;
+	gint64 cutime_ticks;
+	guint64 stime_ticks;
+	gint64 cstime_ticks;
+	int num_threads;
+	guint64 start_time;
+	guint64 vsize;
+	gint64 rss_pages;
+} ProcStat;
+
+typedef struct {
+	/* Process name or pid as given. */
+	char spec[32];
+	gboolean by_pid;
+	/* Set once the process has been looked for in /proc. */
+	gboolean resolved;
+	pid_t pid;
+	guint64 start_time;
+	char name[16];
+	int fd;
+	/* The process the file was opened for. */
+	pid_t fd_pid;
+} MonitoredProcess;
+
+typedef struct {
+	gboolean valid;
+	pid_t pid;
+	guint64 user_ticks;
+	guint64 sys_ticks;
+	guint64 rss;
+} ProcessSample;
+
+typedef struct {
+	int tid;
+	char name[16];
+	guint64 user_ticks;
+	guint64 sys_ticks;
+} ThreadSample;
+
+typedef struct {
+	guint seq;
+	gint64 time;
+	guint64 cpu_total_time;
+	guint64 user_ticks;
+	guint64 sys_ticks;
+	guint64 vsize;
+	guint64 rss;
+	int num_threads;
+	ProcessSample processes[STATS_MAX_MONITORED_PROCESSES];
+	int nu_thread_samples;
+	ThreadSample threads[STATS_MAX_THREADS];
+} Sample;
+
+typedef struct {
+	int tid;
+	int fd;
+} TaskFile;
+
+static Sample *history = NULL;
+static guint nu_samples_written = 0;
+
+static GThread *sampler_thread = NULL;
+static GMutex sampler_mutex;
+static GCond sampler_cond;
+static gboolean sampler_quit;
+static int proc_stat_fd = - 1;
+static int process_stat_fd = - 1;
+/*
+ * The pids and names of the monitored processes change under monitored_mutex;
+ * the files are only opened and closed by the sampler, or while it is stopped.
+ */
+static MonitoredProcess monitored[STATS_MAX_MONITORED_PROCESSES];
+static int nu_monitored = - 1;
+static GMutex monitored_mutex;
+/* Only used by the sampler thread. */
+static TaskFile task_files[STATS_MAX_THREADS];
+static int nu_task_files = 0;
+static gboolean task_files_stale;
+
+static const char *skip_spaces(const char *p) {
+	while (*p == ' ')
+		p++;
+	return p;
+}
+
+/* Parse a decimal integer; returns the position after it, or NULL. */
 
-	/* Clean up. */
-	free(procname);
-	free(readbuf);
-	globfree(&pglob);
+static const char *parse_int64(const char *p, gint64 *value) {
+	gboolean negative = FALSE;
+	gint64 v = 0;
+	p = skip_spaces(p);
+	if (*p == '-') {
+		negative = TRUE;
+		p++;
+	}
+	if (*p < '0' || *p > '9')
+		return NULL;
+	while (*p >= '0' && *p <= '9') {
+		v = v * 10 + *p - '0';
+		p++;
+	}
+	*value = negative ? - v : v;
+	return p;
+}
 
-	return pid;
+static const char *skip_fields(const char *p, int n) {
+	for (int i = 0; i < n; i++) {
+		p = skip_spaces(p);
+		if (*p == '\0')
+			return NULL;
+		while (*p != ' ' && *p != '\0')
+			p++;
+	}
+	return p;
 }
 
 /*
- * CPU usage calculation module.
+ * Parse a /proc/<pid>/stat or /proc/<pid>/task/<tid>/stat file (man 5 proc).
+ * The command name may contain spaces and parentheses, so the fields are
+ * counted from the last ')'.
  */
 
-struct thread_stats_t {
-	int pid;
-	char name[32];
-	uint64_t utime_ticks;
-	int64_t cutime_ticks;
-	uint64_t stime_ticks;
-	int64_t cstime_ticks;
-	uint64_t vsize;		// virtual memory size in bytes
-	uint64_t rss;		//Resident  Set  Size in bytes
-};
-
-struct pstat {
-	struct thread_stats_t process_stats;
-	int num_threads;
-	int max_thread_stats;
-	struct thread_stats_t *thread_stats;
-	uint64_t cpu_total_time;
-};
+static gboolean parse_proc_stat(const char *buf, ProcStat *st) {
+	const char *name = strchr(buf, '(');
+	const char *name_end = strrchr(buf, ')');
+	if (name == NULL || name_end == NULL || name_end < name)
+		return FALSE;
+	int len = MIN(name_end - name - 1, (int)sizeof(st->name) - 1);
+	memcpy(st->name, name + 1, len);
+	st->name[len] = '\0';
+	/* Skip the fields from the state (3) up to utime (14). */
+	const char *p = skip_fields(name_end + 1, 11);
+	/* Fields 14 (utime) to 24 (rss). */
+	gint64 v[11];
+	for (int i = 0; i < 11; i++) {
+		if (p == NULL)
+			return FALSE;
+		p = parse_int64(p, &v[i]);
+	}
+	if (p == NULL)
+		return FALSE;
+	st->utime_ticks = v[0];
+	st->stime_ticks = v[1];
+	st->cutime_ticks = v[2];
+	st->cstime_ticks = v[3];
+	st->num_threads = v[6];
+	st->start_time = v[8];
+	st->vsize = v[9];
+	st->rss_pages = v[10];
+	return TRUE;
+}
 
-static void init_pstat(struct pstat *p) {
-	p->num_threads = 0;
-	p->max_thread_stats = 0;
-	strcpy(p->process_stats.name, "Undefined");
+/* Sum of the times on the "cpu" line of /proc/stat. */
+
+static gboolean parse_cpu_total_time(const char *buf, guint64 *total) {
+	if (strncmp(buf, "cpu ", 4) != 0)
+		return FALSE;
+	const char *p = buf + 4;
+	*total = 0;
+	/* Older kernels have fewer than ten fields. */
+	for (int i = 0; i < 10 && p != NULL; i++) {
+		gint64 v;
+		p = parse_int64(p, &v);
+		if (p != NULL)
+			*total += v;
+	}
+	return TRUE;
 }
 
-static void clear_thread_stats(struct thread_stats_t *thread_stats) {
-	thread_stats->utime_ticks = 0;
-	thread_stats->cutime_ticks = 0;
-	thread_stats->stime_ticks = 0;
-	thread_stats->cstime_ticks = 0;
-	thread_stats->vsize = 0;
-	thread_stats->rss = 0;
+/* Read a /proc file from the start; FALSE on error, e.g. when the task exited. */
+
+static gboolean read_proc_file(int fd, char *buf, int size) {
+	ssize_t n = pread(fd, buf, size - 1, 0);
+	if (n <= 0)
+		return FALSE;
+	buf[n] = '\0';
+	return TRUE;
+}
+
+/*
+ * Monitored processes. Processes given by name are looked up in a single
+ * pass over /proc, the first time only; after that they are identified by
+ * pid and start time, so that a reused pid is not mistaken for the process.
+ * A process given by name that exited is looked up again.
+ */
+
+#define DEFAULT_MONITORED_PROCESSES "Xorg,Xwayland,pulseaudio,pipewire"
+
+static gboolean read_proc_stat_of(pid_t pid, ProcStat *st) {
+	char path[32];
+	char buf[STAT_BUFFER_SIZE];
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return FALSE;
+	gboolean ok = read_proc_file(fd, buf, sizeof(buf)) && parse_proc_stat(buf, st);
+	close(fd);
+	return ok;
 }
 
 /*
- * read /proc data into the passed struct pstat
- * returns 0 on success, -1 on error
+ * Set the processes to monitor besides gstplay, as a comma-separated list of
+ * process names and pids. Must be called before statistics are enabled.
  */
-static int get_usage(const pid_t pid, struct pstat *result)
+
+void stats_set_monitored_processes(const char *list)
 {
-	//convert  pid to string
-	char pid_s[20];
-	snprintf(pid_s, sizeof(pid_s), "%d", pid);
-	char stat_filepath[30] = "/proc/";
-	strncat(stat_filepath, pid_s,
-		sizeof(stat_filepath) - strlen(stat_filepath) - 1);
-	char tasks_filepath[64];
-	strcpy(tasks_filepath, stat_filepath);
-	strncat(stat_filepath, "/stat", sizeof(stat_filepath) -
-		strlen(stat_filepath) - 1);
-
-	FILE *fpstat = fopen(stat_filepath, "r");
-	if (fpstat == NULL) {
-		printf("gstplay: Couldn't open %s.", stat_filepath);
-		return -1;
+	nu_monitored = 0;
+	const char *p = list;
+	while (*p != '\0' && nu_monitored < STATS_MAX_MONITORED_PROCESSES) {
+		int len = strcspn(p, ",");
+		if (len > 0 && len < (int)sizeof(monitored[0].spec)) {
+			MonitoredProcess *m = &monitored[nu_monitored++];
+			memcpy(m->spec, p, len);
+			m->spec[len] = '\0';
+			m->by_pid = strspn(m->spec, "0123456789") == len;
+			m->resolved = FALSE;
+			m->pid = - 1;
+			m->fd = - 1;
+			m->fd_pid = - 1;
+		}
+		p += len;
+		if (*p == ',')
+			p++;
 	}
+}
 
-	FILE *fstat = fopen("/proc/stat", "r");
-	if (fstat == NULL) {
-		printf("gstplay: Couldn't open /proc/stat.\n");
-		fclose(fstat);
-		return -1;
-	}
-	// Read values from /proc/pid/stat.
-	clear_thread_stats(&result->process_stats);
-	result->process_stats.pid = pid;
-	int64_t rss;
-	if (fscanf
-	    (fpstat,
-	     "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu"
-	     "%lu %ld %ld %*d %*d %d %*d %*u %lu %ld",
-	     &result->process_stats.utime_ticks,
-	     &result->process_stats.stime_ticks,
-	     &result->process_stats.cutime_ticks,
-	     &result->process_stats.cstime_ticks, &result->num_threads,
-	     &result->process_stats.vsize, &rss) == EOF) {
-		fclose(fpstat);
-		return -1;
+/* Look up the pids of the monitored processes; called with monitored_mutex held. */
+
+static void resolve_monitored_processes() {
+	if (nu_monitored < 0)
+		stats_set_monitored_processes(DEFAULT_MONITORED_PROCESSES);
+	gboolean need_scan = FALSE;
+	for (int i = 0; i < nu_monitored; i++) {
+		MonitoredProcess *m = &monitored[i];
+		ProcStat st;
+		if (m->pid >= 0) {
+			if (read_proc_stat_of(m->pid, &st) && st.start_time == m->start_time)
+				continue;
+			/* The process exited, or its pid was reused. */
+			m->pid = - 1;
+			if (!m->by_pid)
+				m->resolved = FALSE;
+		}
+		if (m->resolved)
+			continue;
+		m->resolved = TRUE;
+		if (!m->by_pid) {
+			need_scan = TRUE;
+			continue;
+		}
+		pid_t pid = atoi(m->spec);
+		if (read_proc_stat_of(pid, &st)) {
+			m->pid = pid;
+			m->start_time = st.start_time;
+			strcpy(m->name, st.name);
+		}
 	}
-	fclose(fpstat);
-	result->process_stats.rss = rss * getpagesize();
-
-	//read+calc cpu total time from /proc/stat
-	uint64_t cpu_time[10];
-	bzero(cpu_time, sizeof(cpu_time));
-	if (fscanf(fstat, "%*s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
-		   &cpu_time[0], &cpu_time[1], &cpu_time[2], &cpu_time[3],
-		   &cpu_time[4], &cpu_time[5], &cpu_time[6], &cpu_time[7],
-		   &cpu_time[8], &cpu_time[9]) == EOF) {
-		fclose(fstat);
-		return -1;
+	if (!need_scan)
+		return;
+	DIR *dir = opendir("/proc");
+	if (dir == NULL)
+		return;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+			continue;
+		pid_t pid = atoi(entry->d_name);
+		ProcStat st;
+		if (pid == getpid() || !read_proc_stat_of(pid, &st))
+			continue;
+		for (int i = 0; i < nu_monitored; i++) {
+			MonitoredProcess *m = &monitored[i];
+			/* The kernel truncates process names to 15 characters. */
+			if (m->by_pid || m->pid >= 0 || strncmp(m->spec, st.name, 15) != 0)
+				continue;
+			m->pid = pid;
+			m->start_time = st.start_time;
+			strcpy(m->name, st.name);
+		}
 	}
-	fclose(fstat);
+	closedir(dir);
+}
+
+static void close_task_files() {
+	for (int i = 0; i < nu_task_files; i++)
+		close(task_files[i].fd);
+	nu_task_files = 0;
+}
 
-	result->cpu_total_time = 0;
-	for (int i = 0; i < 10; i++)
-		result->cpu_total_time += cpu_time[i];
+/*
+ * Open the stat file of every thread of the process, keeping the files of
+ * threads that were already open. Only done when the set of threads changed.
+ */
 
-	if (!thread_info_enabled) {
-		result->num_threads = 0;
-		return 0;
+static void scan_task_files() {
+	TaskFile old_task_files[STATS_MAX_THREADS];
+	int nu_old_task_files = nu_task_files;
+	memcpy(old_task_files, task_files, sizeof(TaskFile) * nu_task_files);
+	nu_task_files = 0;
+	DIR *dir = opendir("/proc/self/task");
+	if (dir != NULL) {
+		struct dirent *entry;
+		while (nu_task_files < STATS_MAX_THREADS && (entry = readdir(dir)) != NULL) {
+			if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+				continue;
+			int tid = atoi(entry->d_name);
+			int fd = - 1;
+			for (int i = 0; i < nu_old_task_files; i++)
+				if (old_task_files[i].tid == tid) {
+					fd = old_task_files[i].fd;
+					old_task_files[i].fd = - 1;
+					break;
+				}
+			if (fd < 0) {
+				char path[64];
+				snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+				fd = open(path, O_RDONLY | O_CLOEXEC);
+				if (fd < 0)
+					continue;
+			}
+			task_files[nu_task_files].tid = tid;
+			task_files[nu_task_files].fd = fd;
+			nu_task_files++;
+		}
+		closedir(dir);
 	}
+	for (int i = 0; i < nu_old_task_files; i++)
+		if (old_task_files[i].fd >= 0)
+			close(old_task_files[i].fd);
+	task_files_stale = FALSE;
+}
 
-	// Read thread info.
-	if (result->max_thread_stats < result->num_threads) {
-		if (result->max_thread_stats > 0)
-			free(result->thread_stats);
-		result->thread_stats = malloc(sizeof(struct thread_stats_t) *
-					      result->num_threads);
-		result->max_thread_stats = result->num_threads;
+static gboolean take_sample(Sample *s) {
+	char buf[STAT_BUFFER_SIZE];
+	ProcStat st;
+	if (!read_proc_file(proc_stat_fd, buf, sizeof(buf)) ||
+	!parse_cpu_total_time(buf, &s->cpu_total_time))
+		return FALSE;
+	if (!read_proc_file(process_stat_fd, buf, sizeof(buf)) || !parse_proc_stat(buf, &st))
+		return FALSE;
+	s->user_ticks = st.utime_ticks + st.cutime_ticks;
+	s->sys_ticks = st.stime_ticks + st.cstime_ticks;
+	s->vsize = st.vsize;
+	s->rss = st.rss_pages * getpagesize();
+	s->num_threads = st.num_threads;
+	for (int i = 0; i < nu_monitored; i++) {
+		ProcessSample *ps = &s->processes[i];
+		ps->valid = monitored[i].fd >= 0 &&
+			read_proc_file(monitored[i].fd, buf, sizeof(buf)) && parse_proc_stat(buf, &st);
+		ps->pid = monitored[i].fd_pid;
+		if (ps->valid) {
+			ps->user_ticks = st.utime_ticks + st.cutime_ticks;
+			ps->sys_ticks = st.stime_ticks + st.cstime_ticks;
+			ps->rss = st.rss_pages * getpagesize();
+		}
+	}
+	s->nu_thread_samples = 0;
+	if (!__atomic_load_n(&thread_info_enabled, __ATOMIC_RELAXED)) {
+		close_task_files();
+		return TRUE;
+	}
+	if (task_files_stale || nu_task_files != MIN(s->num_threads, STATS_MAX_THREADS))
+		scan_task_files();
+	for (int i = 0; i < nu_task_files; i++) {
+		if (!read_proc_file(task_files[i].fd, buf, sizeof(buf)) ||
+		!parse_proc_stat(buf, &st)) {
+			task_files_stale = TRUE;
+			continue;
+		}
+		ThreadSample *t = &s->threads[s->nu_thread_samples++];
+		t->tid = task_files[i].tid;
+		strcpy(t->name, st.name);
+		t->user_ticks = st.utime_ticks + st.cutime_ticks;
+		t->sys_ticks = st.stime_ticks + st.cstime_ticks;
 	}
+	return TRUE;
+}
 
-	strncat(tasks_filepath, "/task/", 64 - strlen(tasks_filepath) - 1);
-	DIR *tasks_dir = opendir(tasks_filepath);
+/* Open the stat file of every monitored process that has a new pid. */
 
-	for (int i = - 2; i < result->num_threads; i++) {
-		struct dirent *dir_entry = readdir(tasks_dir);
-		if (dir_entry == NULL)
-			break;
-		if (i < 0)
+static void open_monitored_files() {
+	for (int i = 0; i < nu_monitored; i++) {
+		MonitoredProcess *m = &monitored[i];
+		if (m->fd >= 0 && m->fd_pid == m->pid)
+			continue;
+		if (m->fd >= 0)
+			close(m->fd);
+		m->fd = - 1;
+		m->fd_pid = - 1;
+		if (m->pid < 0)
 			continue;
+		char path[32];
+		snprintf(path, sizeof(path), "/proc/%d/stat", m->pid);
+		m->fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (m->fd >= 0)
+			m->fd_pid = m->pid;
+	}
+}
 
-		clear_thread_stats(&result->thread_stats[i]);
-		char pid_str[16];
-		strncpy(pid_str, dir_entry->d_name, 16);
-		int j;
-		for (j = 0; pid_str[j] >= '0' && pid_str[j] <= '9'; j++);
-			pid_str[j] = '\0';
-		result->thread_stats[i].pid = atoi(pid_str);
-
-		char thread_stat_filepath[64];
-		strcpy(thread_stat_filepath, tasks_filepath);
-		strncat(thread_stat_filepath, pid_str,
-			sizeof(thread_stat_filepath)
-			- strlen(thread_stat_filepath) - 1);
-		strcat(thread_stat_filepath, "/stat");
-		FILE *ftstat = fopen(thread_stat_filepath, "rb");
-		if (ftstat == NULL) {
-			printf("gstplay: Couldn't open %s.", thread_stat_filepath);
-			return -1;
+/*
+ * Look once more for monitored processes that were found before but have
+ * exited since, i.e. that have a stat file that can no longer be read.
+ */
+
+static void refresh_monitored_processes(const Sample *s) {
+	gboolean exited = FALSE;
+	for (int i = 0; i < nu_monitored; i++)
+		if (!s->processes[i].valid && monitored[i].fd >= 0)
+			exited = TRUE;
+	if (!exited)
+		return;
+	g_mutex_lock(&monitored_mutex);
+	for (int i = 0; i < nu_monitored; i++)
+		if (!s->processes[i].valid && monitored[i].fd >= 0 && !monitored[i].by_pid)
+			monitored[i].resolved = FALSE;
+	resolve_monitored_processes();
+	open_monitored_files();
+	g_mutex_unlock(&monitored_mutex);
+}
+
+static gpointer sampler_thread_func(gpointer data) {
+	g_mutex_lock(&sampler_mutex);
+	while (!sampler_quit) {
+		g_mutex_unlock(&sampler_mutex);
+		guint n = nu_samples_written;
+		Sample *s = &history[n % HISTORY_LENGTH];
+		__atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		s->time = g_get_monotonic_time();
+		if (take_sample(s)) {
+			__atomic_store_n(&s->seq, n + 1, __ATOMIC_RELEASE);
+			__atomic_store_n(&nu_samples_written, n + 1, __ATOMIC_RELEASE);
+			if ((n + 1) % (RESOLVE_INTERVAL_MS / SAMPLE_INTERVAL_MS) == 0)
+				refresh_monitored_processes(s);
 		}
-		int64_t rss;
-		char s[1024];
-		fread(s, 1024, 1, ftstat);
-		fflush(stdout);
-		int k = 0;
-		while (s[k] != '(')
-			k++;
-		char *name = &s[k];
-		while (s[k] != ')')
-			k++;
-		s[k + 1] = '\0';
-		strncpy(result->thread_stats[i].name, name, 32);
-		result->thread_stats[i].name[31] = '\0';
-		if (sscanf(&s[k + 2],
-		     "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu"
-		     "%lu %ld %ld %*d %*d %d %*d %*u %lu %ld",
-		     &result->thread_stats[i].utime_ticks,
-		     &result->thread_stats[i].stime_ticks,
-		     &result->thread_stats[i].cutime_ticks,
-		     &result->thread_stats[i].cstime_ticks,
-		     &result->num_threads, &result->thread_stats[i].vsize,
-		     &rss) == EOF) {
-			printf("Error reading %s.\n", thread_stat_filepath);
-//			fclose(ftstat);
-//			return -1;
+		g_mutex_lock(&sampler_mutex);
+		gint64 end_time = g_get_monotonic_time() + SAMPLE_INTERVAL_MS * 1000;
+		while (!sampler_quit && g_cond_wait_until(&sampler_cond, &sampler_mutex, end_time));
+	}
+	g_mutex_unlock(&sampler_mutex);
+	close_task_files();
+	return NULL;
+}
+
+static void close_stat_files() {
+	if (proc_stat_fd >= 0)
+		close(proc_stat_fd);
+	if (process_stat_fd >= 0)
+		close(process_stat_fd);
+	for (int i = 0; i < nu_monitored; i++)
+		if (monitored[i].fd >= 0) {
+			close(monitored[i].fd);
+			monitored[i].fd = - 1;
+			monitored[i].fd_pid = - 1;
 		}
-		fclose(ftstat);
-		result->thread_stats[i].rss = rss * getpagesize();
+	proc_stat_fd = process_stat_fd = - 1;
+}
+
+static void start_sampler() {
+	if (sampler_thread != NULL)
+		return;
+	if (history == NULL)
+		history = g_new0(Sample, HISTORY_LENGTH);
+	proc_stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+	process_stat_fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+	g_mutex_lock(&monitored_mutex);
+	resolve_monitored_processes();
+	open_monitored_files();
+	g_mutex_unlock(&monitored_mutex);
+	if (proc_stat_fd < 0 || process_stat_fd < 0) {
+		printf("gstplay: Couldn't open /proc/stat or /proc/self/stat.\n");
+		close_stat_files();
+		return;
 	}
-	closedir(tasks_dir);
+	sampler_quit = FALSE;
+	sampler_thread = g_thread_new("stats sampler", sampler_thread_func, NULL);
+}
+
+static void stop_sampler() {
+	if (sampler_thread == NULL)
+		return;
+	g_mutex_lock(&sampler_mutex);
+	sampler_quit = TRUE;
+	g_cond_signal(&sampler_cond);
+	g_mutex_unlock(&sampler_mutex);
+	g_thread_join(sampler_thread);
+	sampler_thread = NULL;
+	close_stat_files();
+}
+
+/*
+ * Copy sample number n (counting from 1) out of the ring. Returns FALSE when
+ * it has not been written yet or was overwritten.
+ */
 
-	return 0;
+static gboolean read_sample(guint n, Sample *out) {
+	if (n == 0 || history == NULL)
+		return FALSE;
+	const Sample *s = &history[(n - 1) % HISTORY_LENGTH];
+	if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != n)
+		return FALSE;
+	memcpy(out, s, sizeof(Sample));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == n;
+}
+
+static gdouble ticks_to_percent(guint64 ticks, guint64 base_ticks, guint64 total_time_diff) {
+	if (total_time_diff == 0)
+		return 0;
+	return 100.0 * (gint64)(ticks - base_ticks) / total_time_diff;
 }
 
 /*
- * Calculate the elapsed CPU usage between two measuring points, in percent.
+ * CPU time (user + system) used by the process so far, in seconds. Reads
+ * /proc directly, so it also works without the sampler.
  */
-static void calc_cpu_usage_pct(const struct pstat *cur_usage,
-			       const struct pstat *last_usage,
-			       double *ucpu_usage, double *scpu_usage,
-				double *thread_ucpu_usage, double *thread_scpu_usage)
+
+gdouble stats_get_process_cpu_time()
 {
-	const uint64_t total_time_diff = cur_usage->cpu_total_time -
-	    last_usage->cpu_total_time;
-
-	*ucpu_usage = 100 * (((cur_usage->process_stats.utime_ticks +
-			       cur_usage->process_stats.cutime_ticks)
-			      - (last_usage->process_stats.utime_ticks +
-				 last_usage->process_stats.cutime_ticks))
-			     / (double)total_time_diff);
-
-	*scpu_usage =
-	    100 *
-	    ((((cur_usage->process_stats.stime_ticks +
-		cur_usage->process_stats.cstime_ticks)
-	       - (last_usage->process_stats.stime_ticks +
-		  last_usage->process_stats.cstime_ticks))) /
-	     (double)total_time_diff);
-
-	if (thread_info_enabled && (thread_ucpu_usage != NULL || thread_scpu_usage != NULL)) {
-		int j = 0;
-		for (int i = 0; i < cur_usage->num_threads; i++) {
-			fflush(stdout);
-			if (j >= last_usage->num_threads ||
-			last_usage->thread_stats[j].pid > cur_usage->thread_stats[i].pid) {
-				thread_ucpu_usage[i] = - 1.0;
-				thread_scpu_usage[i] = - 1.0;
-				continue;
-			}
-			for (;;) {
-				fflush(stdout);
-				if (cur_usage->thread_stats[i].pid == last_usage->thread_stats[j].pid)
-					break;
-				j++;
-				if (j >= last_usage->num_threads ||
-				last_usage->thread_stats[j].pid > cur_usage->thread_stats[i].pid) {
-					thread_ucpu_usage[i] = - 1.0;
-					thread_scpu_usage[i] = - 1.0;
-					goto next;
-				}
-			}
-			fflush(stdout);
-			if (thread_ucpu_usage != NULL) {
-				thread_ucpu_usage[i] = 100 * ((
-				(cur_usage->thread_stats[i].utime_ticks +
-			       cur_usage->thread_stats[i].cutime_ticks)
-			      - (last_usage->thread_stats[j].utime_ticks +
-				 last_usage->thread_stats[j].cutime_ticks))
-			     / (double)total_time_diff);
-			}
-			if (thread_scpu_usage != NULL) {
-				thread_scpu_usage[i] = 100 * ((
-				(cur_usage->thread_stats[i].stime_ticks +
-			       cur_usage->thread_stats[i].cstime_ticks)
-			      - (last_usage->thread_stats[j].stime_ticks +
-				 last_usage->thread_stats[j].cstime_ticks))
-			     / (double)total_time_diff);
-			}
-			j++;
-next:			;
-		}
+	ProcStat st;
+	if (!read_proc_stat_of(getpid(), &st))
+		return 0;
+	return (gdouble)(st.utime_ticks + st.stime_ticks) / sysconf(_SC_CLK_TCK);
+}
+
+/*
+ * Process usage over a longer run (a benchmark), measured from /proc directly
+ * at the start and the end so that it does not depend on the sampler.
+ */
+
+static guint64 usage_base_cpu_total_time;
+static guint64 usage_base_ticks[STATS_MAX_MONITORED_PROCESSES + 1];
+static pid_t usage_base_pid[STATS_MAX_MONITORED_PROCESSES + 1];
+static gboolean usage_base_valid[STATS_MAX_MONITORED_PROCESSES + 1];
+
+static gboolean read_cpu_total_time(guint64 *total) {
+	char buf[STAT_BUFFER_SIZE];
+	int fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return FALSE;
+	gboolean ok = read_proc_file(fd, buf, sizeof(buf)) && parse_cpu_total_time(buf, total);
+	close(fd);
+	return ok;
+}
+
+/*
+ * Read usage of gstplay (index 0) or monitored process i - 1, checking the
+ * start time; called with monitored_mutex held.
+ */
+
+static gboolean read_process_usage(int i, ProcStat *st, pid_t *pid) {
+	*pid = i == 0 ? getpid() : monitored[i - 1].pid;
+	if (i == 0)
+		return read_proc_stat_of(*pid, st);
+	const MonitoredProcess *m = &monitored[i - 1];
+	return m->pid >= 0 && read_proc_stat_of(m->pid, st) && st->start_time == m->start_time;
+}
+
+void stats_begin_process_usage()
+{
+	g_mutex_lock(&monitored_mutex);
+	resolve_monitored_processes();
+	if (!read_cpu_total_time(&usage_base_cpu_total_time))
+		usage_base_cpu_total_time = 0;
+	for (int i = 0; i <= nu_monitored; i++) {
+		ProcStat st;
+		usage_base_valid[i] = read_process_usage(i, &st, &usage_base_pid[i]);
+		if (usage_base_valid[i])
+			usage_base_ticks[i] = st.utime_ticks + st.cutime_ticks + st.stime_ticks +
+				st.cstime_ticks;
+	}
+	g_mutex_unlock(&monitored_mutex);
+}
+
+/*
+ * Fill in the usage of gstplay (first) and of the monitored processes since
+ * stats_begin_process_usage(). Returns the number of entries.
+ */
+
+int stats_get_process_usage(StatsProcessUsage *usage, int max_processes)
+{
+	guint64 cpu_total_time;
+	if (!read_cpu_total_time(&cpu_total_time))
+		return 0;
+	int n = 0;
+	g_mutex_lock(&monitored_mutex);
+	for (int i = 0; i <= nu_monitored && n < max_processes; i++) {
+		ProcStat st;
+		pid_t pid;
+		/* A process that was restarted since the start is left out. */
+		if (!usage_base_valid[i] || !read_process_usage(i, &st, &pid) ||
+		pid != usage_base_pid[i])
+			continue;
+		guint64 ticks = st.utime_ticks + st.cutime_ticks + st.stime_ticks + st.cstime_ticks;
+		strcpy(usage[n].name, i == 0 ? "gstplay" : monitored[i - 1].name);
+		usage[n].pid = pid;
+		usage[n].cpu_percent = ticks_to_percent(ticks, usage_base_ticks[i],
+			cpu_total_time - usage_base_cpu_total_time);
+		usage[n].cpu_seconds = (gdouble)(ticks - usage_base_ticks[i]) / sysconf(_SC_CLK_TCK);
+		usage[n].rss = st.rss_pages * getpagesize();
+		n++;
 	}
+	g_mutex_unlock(&monitored_mutex);
+	return n;
 }
 
 // Statistics
@@ -354,19 +682,25 @@ typedef struct {
 
 static GList *element_statistics_list = NULL;
 static gboolean stats_enabled = FALSE;
-struct pstat pstat_process_base, pstat_Xserver_base;
-struct pstat pstat_process_current, pstat_Xserver_current;
-static pid_t process_pid = -1;
-static pid_t X_pid = -1;
+/* The sample that utilization is measured from, see stats_reset(). */
+static guint base_sample_nu = 1;
+static Sample base_sample;
+static gboolean have_base_sample = FALSE;
+
+/* Sampling runs while statistics are enabled, i.e. while the dialog is shown. */
 
 void stats_set_enabled(gboolean status)
 {
 	stats_enabled = status;
+	if (status)
+		start_sampler();
+	else
+		stop_sampler();
 }
 
 void stats_set_thread_info(gboolean status)
 {
-	thread_info_enabled = status;
+	__atomic_store_n(&thread_info_enabled, status, __ATOMIC_RELAXED);
 }
 
 void stats_reset()
@@ -374,24 +708,10 @@ void stats_reset()
 	g_list_free(element_statistics_list);
 	element_statistics_list = NULL;
 
-	if (X_pid < 0) {
-		X_pid = find_pid("Xorg");
-		init_pstat(&pstat_Xserver_base);
-		init_pstat(&pstat_Xserver_current);
-		strcpy(pstat_Xserver_base.process_stats.name, "Xorg");
-		strcpy(pstat_Xserver_current.process_stats.name, "Xorg");
-	}
-
-	if (process_pid < 0) {
-		process_pid = getpid();
-		init_pstat(&pstat_process_base);
-		init_pstat(&pstat_process_current);
-		strcpy(pstat_process_base.process_stats.name, "gstplay");
-		strcpy(pstat_process_current.process_stats.name, "gstplay");
-	}
-	get_usage(process_pid, &pstat_process_base);
-	if (X_pid >= 0)
-		get_usage(X_pid, &pstat_Xserver_base);
+	/* Measure from the newest sample, or from the first one of a new run. */
+	guint n = __atomic_load_n(&nu_samples_written, __ATOMIC_ACQUIRE);
+	base_sample_nu = sampler_thread != NULL && n > 0 ? n : n + 1;
+	have_base_sample = FALSE;
 }
 
 void stats_report_dropped_frames_cb(gpointer element, const char *name,
@@ -424,58 +744,109 @@ void stats_report_dropped_frames_cb(gpointer element, const char *name,
 
 gchar *stats_get_cpu_utilization_str()
 {
-	get_usage(process_pid, &pstat_process_current);
-	double user_percent, sys_percent;
-	double *thread_user_percentp, *thread_sys_percentp = NULL;
-	if (thread_info_enabled) {
-		thread_user_percentp = malloc(sizeof(double) * pstat_process_current.num_threads);
-		thread_sys_percentp = malloc(sizeof(double) * pstat_process_current.num_threads);
+	static Sample current;
+	guint n = __atomic_load_n(&nu_samples_written, __ATOMIC_ACQUIRE);
+	if (!have_base_sample) {
+		/* The base sample should never fall out of the ring, but be safe. */
+		if (n >= base_sample_nu + HISTORY_LENGTH)
+			base_sample_nu = n;
+		have_base_sample = read_sample(base_sample_nu, &base_sample);
 	}
-	calc_cpu_usage_pct(&pstat_process_current, &pstat_process_base,
-			   &user_percent, &sys_percent, thread_user_percentp, thread_sys_percentp);
-	char *s = g_strdup_printf("CPU utilization (application)\n"
-		"%-38s user %4.1lf%%, sys %4.1lf%%\n"
-		"Number of threads: %d\n",
-		pstat_process_current.process_stats.name,
-		user_percent, sys_percent, pstat_process_current.num_threads);
-	if (thread_info_enabled) {
-		for (int i = 0; i < pstat_process_current.num_threads; i++) {
-			char *s2;
-			if (thread_user_percentp[i] >= 0 && thread_sys_percentp[i] >= 0)
-				s2 = g_strdup_printf("Thread %6d %-24s "
-					"user %4.1lf%%, sys %4.1lf%%\n",
-					pstat_process_current.thread_stats[i].pid,
-					pstat_process_current.thread_stats[i].name,
-					thread_user_percentp[i], thread_sys_percentp[i]);
-			else
-				s2 = g_strdup_printf("Thread %6d %-24s\n",
-					pstat_process_current.thread_stats[i].pid,
-					pstat_process_current.thread_stats[i].name);
-			char *s1 = s;
-			s = g_strconcat(s, s2, NULL);
-			g_free(s2);
-			g_free(s1);
-		}
-		if (thread_info_enabled) {
-			free(thread_user_percentp);
-			free(thread_sys_percentp);
-		}
+	if (!have_base_sample || n <= base_sample_nu || !read_sample(n, &current))
+		return g_strdup("CPU utilization (application)\nSampling...\n");
+
+	guint64 total_time_diff = current.cpu_total_time - base_sample.cpu_total_time;
+	gdouble user_percent = ticks_to_percent(current.user_ticks, base_sample.user_ticks,
+		total_time_diff);
+	gdouble sys_percent = ticks_to_percent(current.sys_ticks, base_sample.sys_ticks,
+		total_time_diff);
+	gdouble total_user_percent = user_percent;
+	gdouble total_sys_percent = sys_percent;
+	GString *s = g_string_new("");
+	g_string_append_printf(s, "CPU utilization (application)\n"
+		"%-30s user %4.1lf%%, sys %4.1lf%%, RSS %6.1lf MiB\n"
+		"Number of threads: %d\n", "gstplay", user_percent, sys_percent,
+		current.rss / (1024.0 * 1024.0), current.num_threads);
+	if (current.num_threads > STATS_MAX_THREADS && current.nu_thread_samples > 0)
+		g_string_append_printf(s, "(thread info for the first %d threads only)\n",
+			STATS_MAX_THREADS);
+	gboolean have_helpers = FALSE;
+	for (int i = 0; i < nu_monitored; i++) {
+		const ProcessSample *ps = &current.processes[i];
+		const ProcessSample *base_ps = &base_sample.processes[i];
+		if (!ps->valid || !base_ps->valid || ps->pid != base_ps->pid)
+			continue;
+		if (!have_helpers)
+			g_string_append(s, "\nCPU utilization (helper processes)\n");
+		have_helpers = TRUE;
+		user_percent = ticks_to_percent(ps->user_ticks, base_ps->user_ticks, total_time_diff);
+		sys_percent = ticks_to_percent(ps->sys_ticks, base_ps->sys_ticks, total_time_diff);
+		total_user_percent += user_percent;
+		total_sys_percent += sys_percent;
+		char name[40];
+		g_mutex_lock(&monitored_mutex);
+		snprintf(name, sizeof(name), "%s (%d)", monitored[i].name, ps->pid);
+		g_mutex_unlock(&monitored_mutex);
+		g_string_append_printf(s, "%-30s user %4.1lf%%, sys %4.1lf%%, RSS %6.1lf MiB\n",
+			name, user_percent, sys_percent, ps->rss / (1024.0 * 1024.0));
 	}
-	if (X_pid >= 0) {
-		get_usage(X_pid, &pstat_Xserver_current);
-		double X_user_percent, X_sys_percent;
-		calc_cpu_usage_pct(&pstat_Xserver_current, &pstat_Xserver_base,
-				   &X_user_percent, &X_sys_percent, NULL, NULL);
-		char *s2 = g_strdup_printf
-			("\nCPU utilization (X server)\n"
-			"%-38s user %4.1lf%%, sys %4.1lf%%\n",
-		  pstat_Xserver_current.process_stats.name, X_user_percent, X_sys_percent);
-		char *s1 = s;
-		s = g_strconcat(s, s2, NULL);
-		g_free(s2);
-		g_free(s1);
+	if (have_helpers)
+		g_string_append_printf(s, "%-30s user %4.1lf%%, sys %4.1lf%%\n", "Total",
+			total_user_percent, total_sys_percent);
+	return g_string_free(s, FALSE);
+}
+
+static const ThreadSample *find_thread_sample(const Sample *s, int tid, int hint) {
+	if (hint < s->nu_thread_samples && s->threads[hint].tid == tid)
+		return &s->threads[hint];
+	for (int i = 0; i < s->nu_thread_samples; i++)
+		if (s->threads[i].tid == tid)
+			return &s->threads[i];
+	return NULL;
+}
+
+/*
+ * Recent CPU usage of every sampled thread, one value per sampling interval
+ * for the last STATS_SPARKLINE_POINTS intervals. Returns the number of
+ * threads filled in; 0 when thread info is disabled.
+ */
+
+int stats_get_thread_history(StatsThreadHistory *threads, int max_threads)
+{
+	static Sample samples[2];
+	Sample *current = &samples[0];
+	Sample *previous = &samples[1];
+	guint n = __atomic_load_n(&nu_samples_written, __ATOMIC_ACQUIRE);
+	if (!read_sample(n, current))
+		return 0;
+	int nu_threads = MIN(current->nu_thread_samples, max_threads);
+	for (int i = 0; i < nu_threads; i++) {
+		threads[i].tid = current->threads[i].tid;
+		strcpy(threads[i].name, current->threads[i].name);
+		for (int k = 0; k < STATS_SPARKLINE_POINTS; k++)
+			threads[i].cpu_percent[k] = - 1.0;
+	}
+	/* Walk back from the newest interval. */
+	for (int k = STATS_SPARKLINE_POINTS - 1; k >= 0; k--, n--) {
+		if (!read_sample(n - 1, previous))
+			break;
+		/* A gap means the sampler was stopped in between. */
+		if (current->time - previous->time > 2 * SAMPLE_INTERVAL_MS * 1000)
+			break;
+		guint64 total_time_diff = current->cpu_total_time - previous->cpu_total_time;
+		for (int i = 0; i < nu_threads; i++) {
+			const ThreadSample *t1 = find_thread_sample(current, threads[i].tid, i);
+			const ThreadSample *t0 = find_thread_sample(previous, threads[i].tid, i);
+			if (t0 != NULL && t1 != NULL)
+				threads[i].cpu_percent[k] = ticks_to_percent(
+					t1->user_ticks + t1->sys_ticks,
+					t0->user_ticks + t0->sys_ticks, total_time_diff);
+		}
+		Sample *tmp = current;
+		current = previous;
+		previous = tmp;
 	}
-	return s;
+	return nu_threads;
 }
 
 gchar *stats_get_dropped_frames_str()
@@ -523,3 +894,32 @@ gchar *stats_get_dropped_frames_str()
 		(gdouble) total_dropped * 100.0 / (total_processed + total_dropped),
 		(gdouble) sink_dropped * 100.0 / (sink_processed + sink_dropped));
 }
+
+/*
+ * Information about the playback machinery (preloading etc.), one section per
+ * active feature. Returns an empty string when there is nothing to report.
+ */
+
+static void append_playback_info_section(GString *s, gchar *section) {
+	if (section == NULL)
+		return;
+	if (s->len > 0)
+		g_string_append(s, "\n");
+	g_string_append(s, section);
+	g_free(section);
+}
+
+gchar *stats_get_playback_info_str()
+{
+	GString *s = g_string_new("");
+	append_playback_info_section(s, gstreamer_get_decoder_threading_str());
+	append_playback_info_section(s, gstreamer_get_playback_speed_str());
+	append_playback_info_section(s, governor_get_stats_str());
+	append_playback_info_section(s, keyframe_index_get_stats_str());
+	append_playback_info_section(s, thumbnail_get_stats_str());
+	append_playback_info_section(s, gstreamer_get_scrub_stats_str());
+	append_playback_info_section(s, frame_ring_get_stats_str());
+	append_playback_info_section(s, reverse_playback_get_stats_str());
+	append_playback_info_section(s, preload_get_stats_str());
+	return g_string_free(s, FALSE);
+}
@@ -0,0 +1,435 @@
+/*
+    gstplay -- Simple gstreamer-based media player
+
+    Copyright 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+    gstplay is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    gstplay is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+    License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with gstplay.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Thumbnails for the position slider. A separate pipeline decodes the file
+ * into a 160 pixel wide RGB fakesink; it is kept paused and for every interval
+ * a key unit seek prerolls one keyframe, which is taken from the sink's
+ * last-sample and copied into a sprite (a grid of thumbnails in one pixbuf).
+ * The sprite is saved as PNG together with a table of the thumbnail
+ * timestamps in $XDG_CACHE_HOME/gstplay/thumbnails, keyed by canonical path,
+ * size and modification time like the media cache.
+ *
+ * The controlling thread and all streaming threads of the pipeline run with
+ * SCHED_IDLE and nice 19. The streaming threads come from a task pool that
+ * starts a thread of its own for every task and ends it with the task, so that
+ * a thread with idle priority never serves the playback pipeline; the default
+ * task pool takes its threads from the thread pool of the whole process.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib.h>
+#include "gstplay.h"
+
+#define THUMBNAIL_INDEX_MAGIC 0x4d485447	/* "GTHM" */
+#define THUMBNAIL_INDEX_VERSION 1
+#define MAX_PATH_LENGTH 448
+#define THUMBNAIL_WIDTH 160
+#define SPRITE_COLUMNS 10
+#define MAX_THUMBNAILS 200
+#define MIN_THUMBNAIL_INTERVAL (10 * GST_SECOND)
+#define POLL_INTERVAL_MS 100
+
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	gint64 size;
+	gint64 mtime_sec;
+	gint64 mtime_nsec;
+	char path[MAX_PATH_LENGTH];
+	guint32 thumbnail_width;
+	guint32 thumbnail_height;
+	guint32 nu_thumbnails;
+} ThumbnailIndexHeader;
+
+static GThread *thread = NULL;
+static volatile gint stop_requested;
+static volatile gint generating;
+static char *cache_basename = NULL;
+static ThumbnailIndexHeader header;
+static gboolean loaded_from_cache;
+/* Protects the published sprite, the timestamps and the thumbnail count. */
+static GMutex mutex;
+static GdkPixbuf *sprite = NULL;
+static gint64 times[MAX_THUMBNAILS];
+static int nu_thumbnails;
+static int thumbnail_height;
+
+static void set_idle_priority() {
+	struct sched_param param;
+	param.sched_priority = 0;
+#ifdef SCHED_IDLE
+	sched_setscheduler(0, SCHED_IDLE, &param);
+#endif
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+}
+
+static char *get_cache_basename(const char *path) {
+	char *dir = g_build_filename(g_get_user_cache_dir(), "gstplay", "thumbnails", NULL);
+	g_mkdir_with_parents(dir, 0755);
+	char name[16];
+	sprintf(name, "%08x", g_str_hash(path));
+	char *basename = g_build_filename(dir, name, NULL);
+	g_free(dir);
+	return basename;
+}
+
+static gboolean load_thumbnails() {
+	char *filename = g_strdup_printf("%s.idx", cache_basename);
+	FILE *f = fopen(filename, "rb");
+	g_free(filename);
+	if (f == NULL)
+		return FALSE;
+	ThumbnailIndexHeader h;
+	gboolean ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == THUMBNAIL_INDEX_MAGIC &&
+		h.version == THUMBNAIL_INDEX_VERSION && h.size == header.size &&
+		h.mtime_sec == header.mtime_sec && h.mtime_nsec == header.mtime_nsec &&
+		strcmp(h.path, header.path) == 0 && h.nu_thumbnails > 0 &&
+		h.nu_thumbnails <= MAX_THUMBNAILS &&
+		fread(times, sizeof(gint64), h.nu_thumbnails, f) == h.nu_thumbnails;
+	fclose(f);
+	if (!ok)
+		return FALSE;
+	filename = g_strdup_printf("%s.png", cache_basename);
+	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file(filename, NULL);
+	g_free(filename);
+	if (pixbuf == NULL)
+		return FALSE;
+	g_mutex_lock(&mutex);
+	sprite = pixbuf;
+	thumbnail_height = h.thumbnail_height;
+	nu_thumbnails = h.nu_thumbnails;
+	g_mutex_unlock(&mutex);
+	return TRUE;
+}
+
+static void save_thumbnails() {
+	char *filename = g_strdup_printf("%s.png", cache_basename);
+	gboolean ok = gdk_pixbuf_save(sprite, filename, "png", NULL, NULL);
+	g_free(filename);
+	if (!ok) {
+		printf("gstplay: Could not write thumbnail cache.\n");
+		return;
+	}
+	filename = g_strdup_printf("%s.idx", cache_basename);
+	FILE *f = fopen(filename, "wb");
+	g_free(filename);
+	if (f == NULL)
+		return;
+	header.thumbnail_width = THUMBNAIL_WIDTH;
+	header.thumbnail_height = thumbnail_height;
+	header.nu_thumbnails = nu_thumbnails;
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(times, sizeof(gint64), nu_thumbnails, f);
+	fclose(f);
+}
+
+#if GST_CHECK_VERSION(1, 0, 0)
+
+/* A task pool with a dedicated thread with idle priority per task. */
+
+typedef GstTaskPool IdleTaskPool;
+typedef GstTaskPoolClass IdleTaskPoolClass;
+
+G_DEFINE_TYPE(IdleTaskPool, idle_task_pool, GST_TYPE_TASK_POOL);
+
+typedef struct {
+	GstTaskPoolFunction func;
+	gpointer user_data;
+} IdleTask;
+
+static gpointer idle_task_thread_func(gpointer data) {
+	IdleTask *task = data;
+	set_idle_priority();
+	task->func(task->user_data);
+	g_free(task);
+	return NULL;
+}
+
+/* No shared thread pool is needed. */
+
+static void idle_task_pool_prepare(GstTaskPool *pool, GError **error) {
+}
+
+static void idle_task_pool_cleanup(GstTaskPool *pool) {
+}
+
+static gpointer idle_task_pool_push(GstTaskPool *pool, GstTaskPoolFunction func,
+gpointer user_data, GError **error) {
+	IdleTask *task = g_new(IdleTask, 1);
+	task->func = func;
+	task->user_data = user_data;
+	GThread *thread = g_thread_try_new("gstplay-thumbnail-task", idle_task_thread_func,
+		task, error);
+	if (thread == NULL)
+		g_free(task);
+	return thread;
+}
+
+static void idle_task_pool_join(GstTaskPool *pool, gpointer id) {
+	if (id != NULL)
+		g_thread_join(id);
+}
+
+static void idle_task_pool_class_init(IdleTaskPoolClass *klass) {
+	klass->prepare = idle_task_pool_prepare;
+	klass->cleanup = idle_task_pool_cleanup;
+	klass->push = idle_task_pool_push;
+	klass->join = idle_task_pool_join;
+}
+
+static void idle_task_pool_init(IdleTaskPool *pool) {
+}
+
+static GstTaskPool *task_pool;
+
+/* Run the streaming threads of the thumbnail pipeline in the idle task pool. */
+
+static GstBusSyncReply stream_status_sync_handler(GstBus *bus, GstMessage *msg, gpointer data) {
+	if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_STREAM_STATUS)
+		return GST_BUS_PASS;
+	GstStreamStatusType type;
+	gst_message_parse_stream_status(msg, &type, NULL);
+	if (type == GST_STREAM_STATUS_TYPE_CREATE) {
+		const GValue *value = gst_message_get_stream_status_object(msg);
+		if (value != NULL && G_VALUE_HOLDS_OBJECT(value) && GST_IS_TASK(
+		g_value_get_object(value)))
+			gst_task_set_pool(GST_TASK(g_value_get_object(value)), task_pool);
+	}
+	gst_message_unref(msg);
+	return GST_BUS_DROP;
+}
+
+/* Wait for the pipeline to preroll; returns FALSE on error or when stopped. */
+
+static gboolean wait_for_preroll(GstBus *bus) {
+	while (!g_atomic_int_get(&stop_requested)) {
+		GstMessage *msg = gst_bus_timed_pop_filtered(bus, POLL_INTERVAL_MS * GST_MSECOND,
+			GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+		if (msg == NULL)
+			continue;
+		gboolean prerolled = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ASYNC_DONE;
+		gst_message_unref(msg);
+		return prerolled;
+	}
+	return FALSE;
+}
+
+/* Copy the prerolled frame into the next cell of the sprite. */
+
+static void add_thumbnail(GstElement *sink, int nu_planned) {
+	GstSample *sample = NULL;
+	g_object_get(sink, "last-sample", &sample, NULL);
+	if (sample == NULL)
+		return;
+	GstBuffer *buffer = gst_sample_get_buffer(sample);
+	GstVideoInfo info;
+	GstVideoFrame frame;
+	if (buffer == NULL || !gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) ||
+	GST_VIDEO_INFO_WIDTH(&info) != THUMBNAIL_WIDTH ||
+	!gst_video_frame_map(&frame, &info, buffer, GST_MAP_READ)) {
+		gst_sample_unref(sample);
+		return;
+	}
+	if (sprite == NULL) {
+		int rows = (nu_planned + SPRITE_COLUMNS - 1) / SPRITE_COLUMNS;
+		GdkPixbuf *pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8,
+			THUMBNAIL_WIDTH * SPRITE_COLUMNS, GST_VIDEO_INFO_HEIGHT(&info) * rows);
+		gdk_pixbuf_fill(pixbuf, 0);
+		g_mutex_lock(&mutex);
+		thumbnail_height = GST_VIDEO_INFO_HEIGHT(&info);
+		sprite = pixbuf;
+		g_mutex_unlock(&mutex);
+	}
+	if (GST_VIDEO_INFO_HEIGHT(&info) == thumbnail_height) {
+		int x = (nu_thumbnails % SPRITE_COLUMNS) * THUMBNAIL_WIDTH;
+		int y = (nu_thumbnails / SPRITE_COLUMNS) * thumbnail_height;
+		int rowstride = gdk_pixbuf_get_rowstride(sprite);
+		guchar *dest = gdk_pixbuf_get_pixels(sprite) + y * rowstride + x * 3;
+		const guint8 *src = GST_VIDEO_FRAME_PLANE_DATA(&frame, 0);
+		int src_stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+		for (int i = 0; i < thumbnail_height; i++)
+			memcpy(dest + i * rowstride, src + i * src_stride, THUMBNAIL_WIDTH * 3);
+		/* The cell is complete before it is published. */
+		g_mutex_lock(&mutex);
+		times[nu_thumbnails] = GST_BUFFER_PTS(buffer);
+		nu_thumbnails++;
+		g_mutex_unlock(&mutex);
+	}
+	gst_video_frame_unmap(&frame);
+	gst_sample_unref(sample);
+}
+
+static gpointer thumbnail_thread_func(gpointer data) {
+	set_idle_priority();
+	char *description = g_strdup_printf("filesrc name=source ! decodebin ! videoconvert ! "
+		"videoscale ! video/x-raw,format=RGB,width=%d,pixel-aspect-ratio=1/1 ! "
+		"fakesink name=sink sync=false", THUMBNAIL_WIDTH);
+	GstElement *pipeline = gst_parse_launch(description, NULL);
+	g_free(description);
+	if (pipeline == NULL) {
+		g_atomic_int_set(&generating, FALSE);
+		return NULL;
+	}
+	GstElement *source = gst_bin_get_by_name(GST_BIN(pipeline), "source");
+	g_object_set(source, "location", header.path, NULL);
+	gst_object_unref(source);
+	GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+	task_pool = gst_object_ref_sink(g_object_new(idle_task_pool_get_type(), NULL));
+	gst_task_pool_prepare(task_pool, NULL);
+	GstBus *bus = gst_element_get_bus(pipeline);
+	gst_bus_set_sync_handler(bus, stream_status_sync_handler, NULL, NULL);
+
+	gint64 t = g_get_monotonic_time();
+	gst_element_set_state(pipeline, GST_STATE_PAUSED);
+	gint64 duration = 0;
+	if (wait_for_preroll(bus) && gst_element_query_duration(pipeline, GST_FORMAT_TIME,
+	&duration) && duration > 0) {
+		gint64 interval = MAX(MIN_THUMBNAIL_INTERVAL, duration / MAX_THUMBNAILS);
+		int nu_planned = MIN(MAX_THUMBNAILS, duration / interval + 1);
+		add_thumbnail(sink, nu_planned);
+		for (int i = 1; i < nu_planned && !g_atomic_int_get(&stop_requested); i++) {
+			if (!gst_element_seek_simple(pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH |
+			GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE, i * interval) ||
+			!wait_for_preroll(bus))
+				break;
+			/* Skip keyframes that were already used for the previous interval. */
+			gint64 position;
+			if (gst_element_query_position(pipeline, GST_FORMAT_TIME, &position) &&
+			nu_thumbnails > 0 && position <= times[nu_thumbnails - 1])
+				continue;
+			add_thumbnail(sink, nu_planned);
+		}
+		if (!g_atomic_int_get(&stop_requested) && nu_thumbnails > 0) {
+			save_thumbnails();
+			printf("gstplay: Generated %d thumbnails in %.1lf s.\n", nu_thumbnails,
+				(g_get_monotonic_time() - t) * 0.000001);
+		}
+	}
+	gst_element_set_state(pipeline, GST_STATE_NULL);
+	gst_object_unref(bus);
+	gst_object_unref(sink);
+	gst_object_unref(pipeline);
+	gst_task_pool_cleanup(task_pool);
+	gst_object_unref(task_pool);
+	g_atomic_int_set(&generating, FALSE);
+	return NULL;
+}
+
+#endif
+
+void thumbnail_stop() {
+	if (thread != NULL) {
+		g_atomic_int_set(&stop_requested, TRUE);
+		g_thread_join(thread);
+		thread = NULL;
+	}
+	g_mutex_lock(&mutex);
+	if (sprite != NULL)
+		g_object_unref(sprite);
+	sprite = NULL;
+	nu_thumbnails = 0;
+	g_mutex_unlock(&mutex);
+	g_free(cache_basename);
+	cache_basename = NULL;
+}
+
+/* Load the cached thumbnails of a local file, or generate them in the background. */
+
+void thumbnail_start(const char *filename) {
+	thumbnail_stop();
+	memset(&header, 0, sizeof(header));
+	char *canonical_path = realpath(filename, NULL);
+	if (canonical_path == NULL)
+		return;
+	struct stat st;
+	if (strlen(canonical_path) >= MAX_PATH_LENGTH || stat(canonical_path, &st) < 0) {
+		free(canonical_path);
+		return;
+	}
+	header.magic = THUMBNAIL_INDEX_MAGIC;
+	header.version = THUMBNAIL_INDEX_VERSION;
+	header.size = st.st_size;
+	header.mtime_sec = st.st_mtim.tv_sec;
+	header.mtime_nsec = st.st_mtim.tv_nsec;
+	strcpy(header.path, canonical_path);
+	free(canonical_path);
+	cache_basename = get_cache_basename(header.path);
+	loaded_from_cache = load_thumbnails();
+	if (loaded_from_cache)
+		return;
+#if GST_CHECK_VERSION(1, 0, 0)
+	/* Ranks must not change while the thumbnail pipeline autoplugs its decoder. */
+	calibrate_apply_preferred_decoders();
+	g_atomic_int_set(&stop_requested, FALSE);
+	g_atomic_int_set(&generating, TRUE);
+	thread = g_thread_new("gstplay-thumbnail", thumbnail_thread_func, NULL);
+#endif
+}
+
+/*
+ * Return a new reference to the thumbnail (a GdkPixbuf) nearest to the time,
+ * or NULL when there is none yet. It shares the pixels of the sprite.
+ */
+
+gpointer thumbnail_get_nearest(gint64 time) {
+	GdkPixbuf *pixbuf = NULL;
+	g_mutex_lock(&mutex);
+	if (nu_thumbnails > 0) {
+		int best = 0;
+		for (int i = 1; i < nu_thumbnails; i++)
+			if (llabs(times[i] - time) < llabs(times[best] - time))
+				best = i;
+		pixbuf = gdk_pixbuf_new_subpixbuf(sprite, (best % SPRITE_COLUMNS) * THUMBNAIL_WIDTH,
+			(best / SPRITE_COLUMNS) * thumbnail_height, THUMBNAIL_WIDTH, thumbnail_height);
+	}
+	g_mutex_unlock(&mutex);
+	return pixbuf;
+}
+
+gchar *thumbnail_get_stats_str() {
+	if (cache_basename == NULL)
+		return NULL;
+	g_mutex_lock(&mutex);
+	int n = nu_thumbnails;
+	g_mutex_unlock(&mutex);
+	const char *status = "generated";
+	if (loaded_from_cache)
+		status = "cached";
+	else if (g_atomic_int_get(&generating))
+		status = "generating";
+	else if (n == 0)
+		status = "not available";
+	return g_strdup_printf(
+		"Slider thumbnails:              %d (%s)", n, status);
+}